@@ -1,15 +1,26 @@
 #include "amplifierserial.h"
-#include <QCoreApplication>
-#include <QSettings>
+#include "tuneconfig.h"
 #include <QSerialPort>
 #include <QSerialPortInfo>
 #include <QRegularExpression>
 #include <QDebug>
 #include <QDir>
+#include <QDateTime>
+#include <QTimer>
+#include "simulatedrig.h"
 
 AmplifierSerial::AmplifierSerial(QObject *parent)
-    : QObject(parent)
+    : QObject(parent),
+    m_expiryTimer(new QTimer(this))
 {
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    m_setCommandsReply = config->ampSetCommandsReply;
+    m_ackWindowMs = config->ampAckWindowMs;
+    m_replyTimeoutMs = config->ampReplyTimeoutMs;
+
+    m_linkClock.start();
+    m_expiryTimer->setInterval(50);
+    connect(m_expiryTimer, &QTimer::timeout, this, &AmplifierSerial::expirePending);
 }
 
 AmplifierSerial::~AmplifierSerial()
@@ -30,6 +41,9 @@ void AmplifierSerial::disconnectAll() {
     }
     m_ports.clear();
     m_buffers.clear();
+    m_settings.clear();
+    m_simDevices.clear();
+    failPending("disconnected");
 }
 
 
@@ -62,6 +76,15 @@ void AmplifierSerial::searchAndConnect()
     }
     m_ports.clear();
     m_buffers.clear();
+    m_settings.clear();
+    m_simDevices.clear();
+    failPending("disconnected");
+
+    if (SimulatedRig::isEnabled()) {
+        m_simDevices = SimulatedRig::instance().devices();
+        qDebug() << "Using simulated amps:" << m_simDevices;
+        return;
+    }
 
     // Loop over available serial ports.
     for (const QSerialPortInfo &info : availablePorts) {
@@ -95,28 +118,241 @@ void AmplifierSerial::searchAndConnect()
     }
 }
 
-void AmplifierSerial::sendCommand(const QString &command, const QString &device)
+void AmplifierSerial::sendCommand(const QString &command, const QString &device, int tag)
 {
-    if (m_ports.contains(device)) {
-        QSerialPort *port = m_ports.value(device);
-        if (port->isOpen()) {
-            QByteArray cmd = command.toUtf8() + "\n";
-            port->write(cmd);
-        } else {
-            qWarning() << "Port for device" << device << "is not open.";
+    writeCommands(QStringList() << command, device, 0, tag);
+}
+
+int AmplifierSerial::sendBatch(const QStringList &commands, const QStringList &devices)
+{
+    const int batchId = m_nextBatchId++;
+    m_batches[batchId].outstanding = commands.size() * devices.size();
+    if (m_batches[batchId].outstanding == 0) {
+        m_batches.remove(batchId);
+        QTimer::singleShot(0, this, [this, batchId]() { emit batchFinished(batchId, true, QStringList()); });
+        return batchId;
+    }
+    // Every port gets its whole sequence before any reply is waited for.
+    for (const QString &device : devices) {
+        if (writeCommands(commands, device, batchId))
+            continue;
+        for (const QString &command : commands) {
+            PendingCommand failed;
+            failed.command = command;
+            failed.batchId = batchId;
+            completeCommand(device, failed, "port not open");
         }
-    } else {
+    }
+    return batchId;
+}
+
+bool AmplifierSerial::writeCommands(const QStringList &commands, const QString &device, int batchId, int tag)
+{
+    if (m_simDevices.contains(device))
+        return writeSimulated(commands, device, batchId, tag);
+
+    QSerialPort *port = m_ports.value(device, nullptr);
+    if (!port) {
         qWarning() << "Device" << device << "not found.";
+        return false;
+    }
+    if (!port->isOpen()) {
+        qWarning() << "Port for device" << device << "is not open.";
+        return false;
+    }
+
+    QByteArray payload;
+    for (const QString &command : commands)
+        payload += command.toUtf8() + "\n";
+    port->write(payload);
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QList<PendingCommand> &queue = m_pending[device];
+    for (const QString &command : commands) {
+        trackCommand(command, device);
+        PendingCommand pending;
+        pending.command = command;
+        pending.batchId = batchId;
+        pending.tag = tag;
+        pending.expectsReply = expectsReply(command);
+        pending.deadline = now + (pending.expectsReply ? m_replyTimeoutMs : m_ackWindowMs);
+        pending.sentUs = m_linkClock.nsecsElapsed() / 1000;
+        queue.append(pending);
+    }
+    if (!m_expiryTimer->isActive())
+        m_expiryTimer->start();
+    return true;
+}
+
+bool AmplifierSerial::writeSimulated(const QStringList &commands, const QString &device, int batchId, int tag)
+{
+    SimulatedRig &rig = SimulatedRig::instance();
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    int delay = 0;
+    for (const QString &command : commands) {
+        trackCommand(command, device);
+        PendingCommand pending;
+        pending.command = command;
+        pending.batchId = batchId;
+        pending.tag = tag;
+        pending.expectsReply = expectsReply(command);
+        pending.deadline = now + (pending.expectsReply ? m_replyTimeoutMs : m_ackWindowMs);
+        pending.sentUs = m_linkClock.nsecsElapsed() / 1000;
+        m_pending[device].append(pending);
+
+        // Replies arrive in order, one link latency apart, like the real amps'.
+        const QString reply = rig.handle(device, command);
+        delay += rig.latencyMs();
+        if (reply.isEmpty())
+            continue;
+        QTimer::singleShot(delay, this, [this, device, reply]() {
+            if (m_simDevices.contains(device))
+                processLine(device, reply);
+        });
+    }
+    if (!m_expiryTimer->isActive())
+        m_expiryTimer->start();
+    return true;
+}
+
+bool AmplifierSerial::expectsReply(const QString &command) const
+{
+    return m_setCommandsReply || command.trimmed().endsWith('?');
+}
+
+void AmplifierSerial::handleResponse(const QString &device, const QString &response)
+{
+    // The amp answers in order: an error belongs to the oldest outstanding command, a
+    // reply to the oldest query, and any silent command written before that query has
+    // been accepted.
+    QList<PendingCommand> &queue = m_pending[device];
+    const bool isError = response.contains("ERROR:");
+    if (isError) {
+        if (queue.isEmpty()) {
+            m_linkStats.recordUnmatched(device, true);
+            return;
+        }
+        PendingCommand pending = popPending(device);
+        m_linkStats.recordError(device, pending.command);
+        completeCommand(device, pending, response);
+        return;
+    }
+    while (!queue.isEmpty() && !queue.first().expectsReply)
+        completeCommand(device, popPending(device), QString());
+    if (queue.isEmpty()) {
+        // Typically the late answer to a query that already timed out.
+        m_linkStats.recordUnmatched(device, false);
+        return;
     }
+    PendingCommand pending = popPending(device);
+    m_linkStats.recordReply(device, pending.command, m_linkClock.nsecsElapsed() / 1000 - pending.sentUs);
+    if (pending.command == "SERIAL?")
+        m_serials.insert(device, response);
+    emit commandReply(device, pending.command, response, pending.tag);
+    completeCommand(device, pending, QString());
 }
 
+AmplifierSerial::PendingCommand AmplifierSerial::popPending(const QString &device)
+{
+    QList<PendingCommand> &queue = m_pending[device];
+    PendingCommand pending = queue.takeFirst();
+    // A query's timeout runs from when it reaches the head of the queue.
+    if (!queue.isEmpty() && queue.first().expectsReply)
+        queue.first().deadline = qMax(queue.first().deadline,
+                                      QDateTime::currentMSecsSinceEpoch() + m_replyTimeoutMs);
+    return pending;
+}
+
+void AmplifierSerial::completeCommand(const QString &device, const PendingCommand &pending, const QString &error)
+{
+    if (!error.isEmpty())
+        qWarning() << "Amp" << device << "command" << pending.command << "failed:" << error;
+    if (pending.batchId == 0 || !m_batches.contains(pending.batchId))
+        return;
+    BatchState &batch = m_batches[pending.batchId];
+    if (!error.isEmpty())
+        batch.errors << QString("%1: %2: %3").arg(device, pending.command, error);
+    if (--batch.outstanding > 0)
+        return;
+    const int batchId = pending.batchId;
+    const QStringList errors = batch.errors;
+    m_batches.remove(batchId);
+    // Queued so a batch that fails inside sendBatch is reported after its id is returned.
+    QTimer::singleShot(0, this, [this, batchId, errors]() {
+        emit batchFinished(batchId, errors.isEmpty(), errors);
+    });
+}
+
+void AmplifierSerial::expirePending()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    bool anyPending = false;
+    for (auto it = m_pending.begin(); it != m_pending.end(); ++it) {
+        const QString device = it.key();
+        while (!it.value().isEmpty() && now >= it.value().first().deadline) {
+            PendingCommand pending = popPending(device);
+            if (pending.expectsReply)
+                m_linkStats.recordTimeout(device, pending.command);
+            // A set command that drew no error within its window was accepted.
+            completeCommand(device, pending, pending.expectsReply ? QString("no reply") : QString());
+        }
+        anyPending = anyPending || !it.value().isEmpty();
+    }
+    if (!anyPending)
+        m_expiryTimer->stop();
+}
+
+void AmplifierSerial::failPending(const QString &reason)
+{
+    const QMap<QString, QList<PendingCommand>> pending = m_pending;
+    m_pending.clear();
+    for (auto it = pending.cbegin(); it != pending.cend(); ++it) {
+        for (const PendingCommand &command : it.value())
+            completeCommand(it.key(), command, reason);
+    }
+    if (m_expiryTimer)
+        m_expiryTimer->stop();
+}
+
+void AmplifierSerial::trackCommand(const QString &command, const QString &device)
+{
+    AmpSettings &s = m_settings[device];
+    const QStringList parts = command.split(' ', Qt::SkipEmptyParts);
+    if (parts.isEmpty() || parts.first().endsWith('?'))
+        return;
+    const QString verb = parts.first().toUpper();
+    if (verb == "ONLINE") {
+        s.online = true;
+    } else if (verb == "STANDBY") {
+        s.online = false;
+    } else if (verb == "MODE" && parts.size() > 1) {
+        s.mode = parts.at(1).toUpper();
+    } else if (verb == "VVA_LEVEL" && parts.size() > 1) {
+        s.vvaLevel = parts.at(1).toDouble();
+    } else if (verb == "ALC_LEVEL" && parts.size() > 1) {
+        s.alcLevel = parts.at(1).toDouble();
+    } else {
+        return;
+    }
+    s.known = true;
+}
+
+AmpSettings AmplifierSerial::settings(const QString &device) const
+{
+    return m_settings.value(device);
+}
+
+QString AmplifierSerial::identity(const QString &device) const
+{
+    return m_serials.value(device, device);
+}
 
 // Convenience amplifier commands:
 void AmplifierSerial::getMode(const QString &device) { sendCommand("MODE?", device); }
 void AmplifierSerial::setMode(const QString &mode, const QString &device) { sendCommand("MODE " + mode, device); }
 void AmplifierSerial::setStandby(const QString &device) { sendCommand("STANDBY", device); }
 void AmplifierSerial::setOnline(const QString &device) { sendCommand("ONLINE", device); }
-void AmplifierSerial::getFwdPwr(const QString &device) { sendCommand("FWD_PWR?", device); }
+void AmplifierSerial::getFwdPwr(const QString &device, int tag) { sendCommand("FWD_PWR?", device, tag); }
 void AmplifierSerial::getRevPwr(const QString &device) { sendCommand("REV_PWR?", device); }
 void AmplifierSerial::getAlcLvl(const QString &device) { sendCommand("ALC_LEVEL?", device); }
 void AmplifierSerial::setAlcLvl(double level, const QString &device)
@@ -146,40 +382,36 @@ void AmplifierSerial::handleReadyRead()
     m_buffers[device].append(newData);
 
     // Check if the buffer contains one or more newline characters.
-    if (m_buffers[device].contains('\n')) {
-        // Split the buffer into complete lines.
-        QStringList lines = QString::fromUtf8(m_buffers[device]).split('\n', Qt::SkipEmptyParts);
+    int end = m_buffers[device].lastIndexOf('\n');
+    if (end >= 0) {
+        // Split the complete lines off; a partial last line waits for the next read.
+        QStringList lines = QString::fromUtf8(m_buffers[device].left(end)).split('\n', Qt::SkipEmptyParts);
+        m_buffers[device].remove(0, end + 1);
         for (const QString &line : lines) {
             QString response = line.trimmed();
-            // Emit error or output signal depending on response content.
-            if (response.contains("ERROR:"))
-                emit ampError(device, response);
-            else
-                emit ampOutput(device, response);
+            if (!response.isEmpty())
+                processLine(device, response);
         }
-        // Clear the buffer since we've processed the complete lines.
-        m_buffers[device].clear();
     }
 }
 
+void AmplifierSerial::processLine(const QString &device, const QString &response)
+{
+    handleResponse(device, response);
+    // Emit error or output signal depending on response content.
+    if (response.contains("ERROR:"))
+        emit ampError(device, response);
+    else
+        emit ampOutput(device, response);
+}
+
 QStringList AmplifierSerial::connectedDevices() const
 {
     // Get the raw device list from discovered ports.
-    QStringList devices = m_ports.keys();
-
-    // Read amplifier names from waveTuneConfig.ini in the application directory.
-    QString configFile = QCoreApplication::applicationDirPath() + "/waveTuneConfig.ini";
-    QSettings settings(configFile, QSettings::IniFormat);
-
-    QString configAmpL1 = settings.value("Amplifiers/L1", "").toString();
-    QString configAmpL2 = settings.value("Amplifiers/L2", "").toString();
+    QStringList devices = m_ports.keys() + m_simDevices;
 
-    // If any amplifier is specified in the config, create a list of them.
-    QStringList configDevices;
-    if (!configAmpL1.trimmed().isEmpty())
-        configDevices << configAmpL1.trimmed();
-    if (!configAmpL2.trimmed().isEmpty())
-        configDevices << configAmpL2.trimmed();
+    // Amplifier names pinned in the config snapshot, L1 first.
+    const QStringList configDevices = TuneConfig::current()->pinnedAmps();
 
     // If the config specified one or more amplifiers,
     // filter them to only include devices that are in our discovered list.
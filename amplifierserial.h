@@ -5,6 +5,20 @@
 #include <QSerialPort>
 #include <QMap>
 #include <QByteArray>
+#include <QStringList>
+#include <QElapsedTimer>
+#include "linkstats.h"
+
+class QTimer;
+
+// Last settings this process commanded on an amp (not read back from the amp).
+struct AmpSettings {
+    bool known = false;     // Nothing commanded since connecting
+    bool online = false;
+    QString mode;           // "VVA" or "ALC", empty if not set
+    double vvaLevel = -1.0; // Negative when not set
+    double alcLevel = -1.0;
+};
 
 class AmplifierSerial : public QObject
 {
@@ -14,14 +28,22 @@ public:
     ~AmplifierSerial();
     void disconnectAll();
     void searchAndConnect();
-    void sendCommand(const QString &command, const QString &device);
+    // A non-zero tag comes back with the reply, so callers sharing a port can tell
+    // their own queries' answers apart.
+    void sendCommand(const QString &command, const QString &device, int tag = 0);
+    // A tag no other caller of this AmplifierSerial has been given.
+    int nextTag() { return m_nextTag++; }
+    // Writes commands back to back to every device (each port in one write, all ports
+    // before any reply is awaited) and emits batchFinished once every command has been
+    // acknowledged, has failed or has timed out. Returns the batch id.
+    int sendBatch(const QStringList &commands, const QStringList &devices);
 
     // Convenience amplifier commands
     void getMode(const QString &device);
     void setMode(const QString &mode, const QString &device);
     void setStandby(const QString &device);
     void setOnline(const QString &device);
-    void getFwdPwr(const QString &device);
+    void getFwdPwr(const QString &device, int tag = 0);
     void getRevPwr(const QString &device);
     void getAlcLvl(const QString &device);
     void setAlcLvl(double level, const QString &device);
@@ -33,17 +55,66 @@ public:
     void getModelId(const QString &device);
 
     QStringList connectedDevices() const;
+    // Settings commanded on device since it was connected. Lets a tuner that follows
+    // another on the same ports skip setup the amp already has.
+    AmpSettings settings(const QString &device) const;
+    // Serial number from the last SERIAL? reply, or the device name until one arrives.
+    QString identity(const QString &device) const;
+    // Reply latency and link errors per device since construction (or resetLinkStats).
+    const LinkStats &linkStats() const { return m_linkStats; }
+    void resetLinkStats() { m_linkStats.clear(); }
 
 signals:
     void ampOutput(const QString &device, const QString &output);
     void ampError(const QString &device, const QString &error);
+    // A reply line matched to the command it answers, with the tag it was sent with.
+    void commandReply(const QString &device, const QString &command, const QString &reply, int tag);
+    void batchFinished(int batchId, bool ok, const QStringList &errors);
 
 private slots:
     void handleReadyRead();
+    void expirePending();
 
 private:
+    // A command written to a device whose reply (or silence) is still outstanding.
+    struct PendingCommand {
+        QString command;
+        int batchId = 0;
+        int tag = 0;
+        bool expectsReply = false;
+        qint64 deadline = 0;    // Ms since epoch
+        qint64 sentUs = 0;      // m_linkClock when written
+    };
+    struct BatchState {
+        int outstanding = 0;
+        QStringList errors;
+    };
+
+    void trackCommand(const QString &command, const QString &device);
+    bool expectsReply(const QString &command) const;
+    bool writeCommands(const QStringList &commands, const QString &device, int batchId, int tag = 0);
+    bool writeSimulated(const QStringList &commands, const QString &device, int batchId, int tag);
+    void processLine(const QString &device, const QString &response);
+    void handleResponse(const QString &device, const QString &response);
+    PendingCommand popPending(const QString &device);
+    void completeCommand(const QString &device, const PendingCommand &pending, const QString &error);
+    void failPending(const QString &reason);
+
     QMap<QString, QSerialPort*> m_ports; // Maps devices to their corresponding serial ports
     QMap<QString, QByteArray> m_buffers; // Maps devices to their buffers for responses
+    QMap<QString, AmpSettings> m_settings; // Commanded state per device
+    QMap<QString, QString> m_serials;      // SERIAL? replies per device
+    QStringList m_simDevices;              // SimulatedRig amps in use instead of ports
+    QMap<QString, QList<PendingCommand>> m_pending; // Per device, in the order written
+    QMap<int, BatchState> m_batches;
+    int m_nextBatchId = 1;
+    int m_nextTag = 1;
+    QTimer *m_expiryTimer;
+    bool m_setCommandsReply;    // Amp answers set commands with a line of its own
+    int m_ackWindowMs;          // How long a silent set command may still draw an error
+    int m_replyTimeoutMs;
+    QElapsedTimer m_linkClock;
+    LinkStats m_linkStats;
 };
 
 #endif // AMPLIFIERSERIAL_H
@@ -0,0 +1,216 @@
+#include "batcheta.h"
+#include "batchjournal.h"
+#include "batchplanner.h"
+#include "tuneconfig.h"
+#include "wavelogger.h"
+#include <QTextStream>
+#include <QTimer>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+
+BatchEta::BatchEta(QTextStream *out, WaveLogger *logger, QObject *parent)
+    : QObject(parent),
+    m_out(out),
+    m_logger(logger),
+    m_timer(new QTimer(this))
+{
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    m_stragglerFactor = config->stragglerFactor;
+    m_statusFile = config->statusFile;
+    m_timer->setInterval(config->etaSeconds * 1000);
+    connect(m_timer, &QTimer::timeout, this, &BatchEta::report);
+}
+
+void BatchEta::addJob(const TuneJob &job, int predictedSeconds, const QString &category)
+{
+    Item item;
+    item.file = QFileInfo(job.file).fileName();
+    item.category = category;
+    item.predictedSeconds = predictedSeconds;
+    m_items.insert(BatchJournal::keyFor(job), item);
+}
+
+void BatchEta::setLanes(int lanes)
+{
+    m_lanes = qMax(1, lanes);
+}
+
+void BatchEta::started(const TuneJob &job)
+{
+    Item &item = m_items[BatchJournal::keyFor(job)];
+    if (item.file.isEmpty())
+        item.file = QFileInfo(job.file).fileName();
+    item.state = "running";
+    item.timer.start();
+    ++item.attempts;
+    if (!m_timer->isActive()) {
+        m_timer->start();
+        writeStatus();
+    }
+}
+
+void BatchEta::parked(const TuneJob &job)
+{
+    Item &item = m_items[BatchJournal::keyFor(job)];
+    if (item.timer.isValid())
+        item.spentMs += item.timer.elapsed();
+    item.timer.invalidate();
+    item.state = "parked";
+    item.parkedOnce = true;
+}
+
+void BatchEta::finished(const TuneJob &job, bool ok)
+{
+    Item &item = m_items[BatchJournal::keyFor(job)];
+    if (item.timer.isValid())
+        item.spentMs += item.timer.elapsed();
+    item.timer.invalidate();
+    item.state = ok ? "done" : "failed";
+    bool left = false;
+    for (const Item &other : qAsConst(m_items))
+        left = left || other.state == "pending" || other.state == "running" || other.state == "parked";
+    if (!left)
+        m_timer->stop();
+    writeStatus();
+}
+
+void BatchEta::addRun(const TuneJob &job)
+{
+    ++m_items[BatchJournal::keyFor(job)].runs;
+}
+
+int BatchEta::runs(const TuneJob &job) const
+{
+    return m_items.value(BatchJournal::keyFor(job)).runs;
+}
+
+int BatchEta::predictedSeconds(const TuneJob &job) const
+{
+    return m_items.value(BatchJournal::keyFor(job)).predictedSeconds;
+}
+
+QString BatchEta::category(const TuneJob &job) const
+{
+    return m_items.value(BatchJournal::keyFor(job)).category;
+}
+
+int BatchEta::elapsedSeconds(const TuneJob &job) const
+{
+    const auto it = m_items.constFind(BatchJournal::keyFor(job));
+    return it == m_items.constEnd() ? 0 : int(spentMs(*it) / 1000);
+}
+
+qint64 BatchEta::spentMs(const Item &item) const
+{
+    return item.spentMs + (item.timer.isValid() ? item.timer.elapsed() : 0);
+}
+
+bool BatchEta::isStraggler(const Item &item) const
+{
+    return item.predictedSeconds > 0 && spentMs(item) > item.predictedSeconds * m_stragglerFactor * 1000;
+}
+
+int BatchEta::remainingSeconds() const
+{
+    qint64 remainingMs = 0;
+    for (const Item &item : qAsConst(m_items)) {
+        const qint64 predictedMs = qint64(item.predictedSeconds) * 1000;
+        if (item.state == "pending")
+            remainingMs += predictedMs;
+        else if (item.state == "running" || item.state == "parked")
+            remainingMs += qMax<qint64>(0, predictedMs - spentMs(item));
+    }
+    return int(remainingMs / 1000 / m_lanes);
+}
+
+void BatchEta::report()
+{
+    int done = 0, failed = 0, parked = 0, waiting = 0;
+    QStringList running;
+    for (auto it = m_items.cbegin(); it != m_items.cend(); ++it) {
+        const Item &item = it.value();
+        if (item.state == "done")
+            ++done;
+        else if (item.state == "failed")
+            ++failed;
+        else if (item.state == "parked")
+            ++parked;
+        else if (item.state == "pending")
+            ++waiting;
+        if (item.state != "running")
+            continue;
+        const bool straggler = isStraggler(item);
+        running << QString("%1 %2 of %3%4")
+                       .arg(item.file, BatchPlanner::formatDuration(int(spentMs(item) / 1000)),
+                            BatchPlanner::formatDuration(item.predictedSeconds),
+                            straggler ? " (straggler)" : "");
+        if (straggler && !m_flagged.contains(it.key())) {
+            m_flagged.insert(it.key());
+            if (m_logger)
+                m_logger->logToFile(QString("Straggler: %1 has run %2 against a prediction of %3")
+                                        .arg(item.file, BatchPlanner::formatDuration(int(spentMs(item) / 1000)),
+                                             BatchPlanner::formatDuration(item.predictedSeconds)));
+        }
+    }
+    const int remaining = remainingSeconds();
+    *m_out << QString("ETA %1 (about %2): %3 of %4 done, %5 failed, %6 parked, %7 waiting.")
+                  .arg(BatchPlanner::formatDuration(remaining),
+                       QDateTime::currentDateTime().addSecs(remaining).toString("HH:mm"))
+                  .arg(done).arg(m_items.size()).arg(failed).arg(parked).arg(waiting);
+    if (!running.isEmpty())
+        *m_out << " Running: " << running.join(", ") << ".";
+    *m_out << "\n" << Qt::flush;
+    writeStatus();
+}
+
+void BatchEta::writeStatus() const
+{
+    QJsonArray files;
+    for (const Item &item : qAsConst(m_items)) {
+        files.append(QJsonObject{{"file", item.file},
+                                 {"category", item.category},
+                                 {"state", item.state},
+                                 {"predictedSeconds", item.predictedSeconds},
+                                 {"elapsedSeconds", int(spentMs(item) / 1000)},
+                                 {"attempts", item.attempts},
+                                 {"runs", item.runs},
+                                 {"straggler", isStraggler(item)}});
+    }
+    const int remaining = remainingSeconds();
+    const QJsonObject status{{"updated", QDateTime::currentDateTimeUtc().toString(Qt::ISODate)},
+                             {"remainingSeconds", remaining},
+                             {"eta", QDateTime::currentDateTimeUtc().addSecs(remaining).toString(Qt::ISODate)},
+                             {"lanes", m_lanes},
+                             {"files", files}};
+    QSaveFile file(m_statusFile);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Cannot write batch status:" << m_statusFile;
+        return;
+    }
+    file.write(QJsonDocument(status).toJson());
+    file.commit();
+}
+
+QString BatchEta::summary() const
+{
+    QStringList lines;
+    for (const Item &item : qAsConst(m_items)) {
+        if (!item.parkedOnce && !isStraggler(item))
+            continue;
+        lines << QString("  %1 (%2): %3 against a prediction of %4 over %5 attempt(s)%6")
+                     .arg(item.file, item.category.isEmpty() ? QString("-") : item.category,
+                          BatchPlanner::formatDuration(int(spentMs(item) / 1000)),
+                          BatchPlanner::formatDuration(item.predictedSeconds))
+                     .arg(item.attempts)
+                     .arg(item.state == "done" ? QString() : ", " + item.state);
+    }
+    if (lines.isEmpty())
+        return QString();
+    lines.prepend("Stragglers:");
+    return lines.join('\n');
+}
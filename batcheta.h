@@ -0,0 +1,74 @@
+#ifndef BATCHETA_H
+#define BATCHETA_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QSet>
+#include <QString>
+#include "tunejob.h"
+
+class QTextStream;
+class QTimer;
+class WaveLogger;
+
+// Tracks a running batch against the planner's predicted durations. Every
+// [Batch] EtaSeconds it prints the time left and calls out stragglers: files running
+// longer than [Batch] StragglerFactor times their prediction. It also rewrites
+// [Batch] StatusFile (waveBatchStatus.json) so the ETA can be watched from outside.
+class BatchEta : public QObject
+{
+    Q_OBJECT
+public:
+    BatchEta(QTextStream *out, WaveLogger *logger, QObject *parent = nullptr);
+
+    void addJob(const TuneJob &job, int predictedSeconds, const QString &category);
+    // Files tuned side by side; the remaining work is shared between them.
+    void setLanes(int lanes);
+
+    void started(const TuneJob &job);
+    // Stopped at its budget, to be retried at the end of the batch.
+    void parked(const TuneJob &job);
+    void finished(const TuneJob &job, bool ok);
+    // One waveform run of job started.
+    void addRun(const TuneJob &job);
+
+    int predictedSeconds(const TuneJob &job) const;
+    QString category(const TuneJob &job) const;
+    // Time spent on job so far, over all attempts.
+    int elapsedSeconds(const TuneJob &job) const;
+    // Waveform runs of job so far, over all attempts.
+    int runs(const TuneJob &job) const;
+    int remainingSeconds() const;
+    // Files that were parked or ran well over their prediction.
+    QString summary() const;
+
+private:
+    struct Item {
+        QString file;
+        QString category;
+        int predictedSeconds = 0;
+        QString state = "pending";  // pending, running, parked, done, failed
+        qint64 spentMs = 0;         // Earlier attempts
+        QElapsedTimer timer;        // Current attempt, while running
+        int attempts = 0;
+        int runs = 0;               // Over all attempts
+        bool parkedOnce = false;
+    };
+
+    qint64 spentMs(const Item &item) const;
+    bool isStraggler(const Item &item) const;
+    void report();
+    void writeStatus() const;
+
+    QTextStream *m_out;
+    WaveLogger *m_logger;
+    QTimer *m_timer;
+    QMap<QString, Item> m_items;    // BatchJournal::keyFor -> item
+    QSet<QString> m_flagged;        // Stragglers already logged
+    int m_lanes = 1;
+    double m_stragglerFactor;
+    QString m_statusFile;
+};
+
+#endif // BATCHETA_H
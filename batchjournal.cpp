@@ -0,0 +1,153 @@
+#include "batchjournal.h"
+#include "tuneconfig.h"
+#include "simulatedrig.h"
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+#include <unistd.h>
+
+BatchJournal::BatchJournal(const QString &path, QObject *parent)
+    : QObject(parent),
+    m_path(path)
+{
+}
+
+BatchJournal::~BatchJournal()
+{
+    if (m_file.isOpen())
+        m_file.close();
+}
+
+QString BatchJournal::defaultPath()
+{
+    // A simulated batch must not resume, or clear, the bench's journal.
+    if (SimulatedRig::isEnabled())
+        return SimulatedRig::instance().sandboxPath("waveJournal.jsonl");
+    return TuneConfig::current()->journalPath;
+}
+
+QString BatchJournal::keyFor(const TuneJob &job)
+{
+    // The same file tuned to different targets is a different job.
+    if (job.characterize)
+        return QString("%1|characterize|%2").arg(job.file, job.ampModel.toLower());
+    return QString("%1|tune|%2|%3|%4|%5").arg(job.file, job.ampModel.toLower())
+        .arg(job.minPower, 0, 'f', 2)
+        .arg(job.maxPower, 0, 'f', 2)
+        .arg(job.critical.toUpper());
+}
+
+bool BatchJournal::open()
+{
+    m_entries.clear();
+    m_file.setFileName(m_path);
+    if (m_file.exists()) {
+        if (!m_file.open(QIODevice::ReadOnly)) {
+            qWarning() << "Cannot read batch journal:" << m_path;
+            return false;
+        }
+        // Later records supersede earlier ones; a torn last line from a crash is ignored.
+        while (!m_file.atEnd()) {
+            QJsonObject obj = QJsonDocument::fromJson(m_file.readLine()).object();
+            if (obj.isEmpty())
+                continue;
+            JournalEntry e;
+            e.key = obj.value("key").toString();
+            e.file = obj.value("file").toString();
+            e.state = obj.value("state").toString();
+            e.channel = obj.value("channel").toInt();
+            e.gain = obj.value("gain").toInt();
+            e.iteration = obj.value("iteration").toInt();
+            e.detail = obj.value("detail").toString();
+            e.failures = obj.value("failures").toInt();
+            m_entries.insert(e.key, e);
+        }
+        m_file.close();
+    }
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "Cannot open batch journal for writing:" << m_path;
+        return false;
+    }
+    return true;
+}
+
+bool BatchJournal::contains(const TuneJob &job) const
+{
+    return m_entries.contains(keyFor(job));
+}
+
+JournalEntry BatchJournal::entry(const TuneJob &job) const
+{
+    return m_entries.value(keyFor(job));
+}
+
+void BatchJournal::markPending(const TuneJob &job)
+{
+    JournalEntry e;
+    e.key = keyFor(job);
+    e.file = job.file;
+    e.state = "pending";
+    e.failures = entry(job).failures;
+    record(e);
+}
+
+void BatchJournal::markRunning(const TuneJob &job, int channel, int gain, int iteration)
+{
+    JournalEntry e = entry(job);
+    e.key = keyFor(job);
+    e.file = job.file;
+    e.state = "running";
+    e.channel = channel;
+    e.gain = gain;
+    e.iteration = iteration;
+    record(e);
+}
+
+void BatchJournal::markDone(const TuneJob &job, const QString &result)
+{
+    JournalEntry e = entry(job);
+    e.key = keyFor(job);
+    e.file = job.file;
+    e.state = "done";
+    e.detail = result;
+    record(e);
+}
+
+void BatchJournal::markFailed(const TuneJob &job, const QString &reason)
+{
+    JournalEntry e = entry(job);
+    e.key = keyFor(job);
+    e.file = job.file;
+    e.state = "failed";
+    e.detail = reason;
+    ++e.failures;
+    record(e);
+}
+
+void BatchJournal::clear()
+{
+    m_entries.clear();
+    if (m_file.isOpen())
+        m_file.close();
+    QFile::remove(m_path);
+}
+
+void BatchJournal::record(const JournalEntry &e)
+{
+    m_entries.insert(e.key, e);
+    if (!m_file.isOpen())
+        return;
+    QJsonObject obj{{"key", e.key},
+                    {"file", e.file},
+                    {"state", e.state},
+                    {"channel", e.channel},
+                    {"gain", e.gain},
+                    {"iteration", e.iteration}};
+    if (!e.detail.isEmpty())
+        obj.insert("detail", e.detail);
+    if (e.failures > 0)
+        obj.insert("failures", e.failures);
+    m_file.write(QJsonDocument(obj).toJson(QJsonDocument::Compact) + "\n");
+    m_file.flush();
+    ::fsync(m_file.handle());
+}
@@ -0,0 +1,55 @@
+#ifndef BATCHJOURNAL_H
+#define BATCHJOURNAL_H
+
+#include <QObject>
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include "tunejob.h"
+
+// Latest recorded state of one job.
+struct JournalEntry {
+    QString key;
+    QString file;
+    QString state;      // pending, running, done, failed
+    int channel = 0;    // Channel being tuned when last seen running
+    int gain = 0;       // Gain of the last waveform run
+    int iteration = 0;  // Waveform runs so far
+    QString detail;     // Result or failure reason
+    int failures = 0;   // Batches in which the job has failed
+};
+
+// Write-ahead journal of batch progress (one JSON object per line, synced on every
+// record) so a batch interrupted by a crash or power loss can resume where it stopped.
+class BatchJournal : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BatchJournal(const QString &path, QObject *parent = nullptr);
+    ~BatchJournal();
+
+    static QString defaultPath();
+    static QString keyFor(const TuneJob &job);
+
+    // Replays any existing journal and opens it for appending.
+    bool open();
+    bool contains(const TuneJob &job) const;
+    JournalEntry entry(const TuneJob &job) const;
+
+    // Keeps the job's failure count, so a job retried on resume is not retried forever.
+    void markPending(const TuneJob &job);
+    void markRunning(const TuneJob &job, int channel, int gain, int iteration);
+    void markDone(const TuneJob &job, const QString &result);
+    void markFailed(const TuneJob &job, const QString &reason);
+    // Removes the journal once a batch has completed.
+    void clear();
+
+private:
+    void record(const JournalEntry &entry);
+
+    QString m_path;
+    QFile m_file;
+    QHash<QString, JournalEntry> m_entries;
+};
+
+#endif // BATCHJOURNAL_H
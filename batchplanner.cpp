@@ -0,0 +1,225 @@
+#include "batchplanner.h"
+#include "tuneconfig.h"
+#include "waveformtuner.h"
+#include "tuneduration.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QtConcurrent>
+#include <QSet>
+#include <algorithm>
+
+namespace {
+
+struct ProfileFile {
+    typedef FlowgraphProfile result_type;
+
+    FlowgraphProfile operator()(const TuneJob &job) const
+    {
+        return BatchPlanner::profile(job.file);
+    }
+};
+
+// Returns the first numeric value captured by any of the patterns.
+double firstNumber(const QString &content, const QStringList &patterns)
+{
+    for (const QString &pattern : patterns) {
+        QRegularExpressionMatch match = QRegularExpression(pattern).match(content);
+        if (match.hasMatch()) {
+            bool ok = false;
+            double value = match.captured(1).toDouble(&ok);
+            if (ok)
+                return value;
+        }
+    }
+    return 0.0;
+}
+
+// ALC level the amp is brought online with for this job.
+double alcLevelFor(const TuneJob &job, double characterizeAlc)
+{
+    return job.characterize ? characterizeAlc : job.minPower;
+}
+
+// ALC levels are sent with one decimal.
+bool sameLevel(double a, double b)
+{
+    return qAbs(a - b) < 0.05;
+}
+
+} // namespace
+
+FlowgraphProfile BatchPlanner::profile(const QString &file)
+{
+    FlowgraphProfile p;
+    QString fileName = QFileInfo(file).fileName();
+    if (fileName.startsWith("L1_L2_")) {
+        p.firstChannel = 0;
+        p.lastChannel = 1;
+    } else if (fileName.startsWith("L2_")) {
+        p.firstChannel = p.lastChannel = WaveformTuner::extractChannelFromFile(file);
+    }
+
+    QFile f(file);
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text))
+        return p;
+    const QString content = QString::fromUtf8(f.readAll());
+
+    // GRC writes variables as "self.name = name = value"; fall back to the block setters.
+    static const QString number = "([-+]?\\d*\\.?\\d+(?:[eE][-+]?\\d+)?)";
+    p.centerFreq = firstNumber(content, {
+        "self\\.(?:center_freq|freq|fc)\\s*=\\s*\\w+\\s*=\\s*" + number,
+        "\\.set_center_freq\\s*\\(\\s*" + number});
+    p.sampRate = firstNumber(content, {
+        "self\\.samp_rate\\s*=\\s*\\w+\\s*=\\s*" + number,
+        "\\.set_samp_rate\\s*\\(\\s*" + number});
+
+    // GRC passes the device arguments as a string such as "addr=192.168.40.2".
+    static const QRegularExpression addrRx("\\b(?:addr|serial|resource)\\s*=\\s*([A-Za-z0-9_.:\\-]+)");
+    QRegularExpressionMatch addr = addrRx.match(content);
+    if (addr.hasMatch())
+        p.sdrAddress = addr.captured(1);
+    p.category = TuneDurationStore::category(file);
+    return p;
+}
+
+bool BatchPlanner::splitLanes(const QList<TuneJob> &jobs, QList<TuneJob> *shared,
+                              QList<TuneJob> *lane0, QList<TuneJob> *lane1, QString *reason)
+{
+    const bool assumeSeparate = TuneConfig::current()->assumeSeparateSdrs;
+
+    const QList<FlowgraphProfile> profiles =
+        QtConcurrent::blockingMapped<QList<FlowgraphProfile>>(jobs, ProfileFile());
+
+    QList<TuneJob> s, l0, l1;
+    QSet<QString> addr0, addr1;
+    bool unknownAddress = false;
+    for (int i = 0; i < jobs.size(); ++i) {
+        const FlowgraphProfile &p = profiles.at(i);
+        if (p.firstChannel != p.lastChannel) {
+            s << jobs.at(i);
+            continue;
+        }
+        if (p.sdrAddress.isEmpty())
+            unknownAddress = true;
+        if (p.firstChannel == 0) {
+            l0 << jobs.at(i);
+            addr0.insert(p.sdrAddress);
+        } else {
+            l1 << jobs.at(i);
+            addr1.insert(p.sdrAddress);
+        }
+    }
+
+    QString why;
+    if (l0.isEmpty() || l1.isEmpty())
+        why = "only one amp has single-channel work";
+    else if (!assumeSeparate && unknownAddress)
+        why = "some flowgraphs do not name their SDR";
+    else if (!assumeSeparate && addr0.intersects(addr1))
+        why = "both lanes use the same SDR";
+
+    if (!why.isEmpty()) {
+        if (reason)
+            *reason = why;
+        *shared = jobs;
+        lane0->clear();
+        lane1->clear();
+        return false;
+    }
+    *shared = s;
+    *lane0 = l0;
+    *lane1 = l1;
+    return true;
+}
+
+BatchPlan BatchPlanner::plan(const QList<TuneJob> &jobs)
+{
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    const double characterizeAlc = config->sweepAlcLevel;
+    // Costs used for the estimate; the setup figures are the tuner's own state delays.
+    const int fullSetupMs = config->fullSetupMs;
+    const int reusedSetupMs = config->reusedSetupMs;
+    const int changeoverMs = config->changeoverMs;
+    const bool shortestFirst = config->shortestFirst;
+    const int bucketSeconds = config->durationBucketSeconds;
+
+    const QList<FlowgraphProfile> profiles =
+        QtConcurrent::blockingMapped<QList<FlowgraphProfile>>(jobs, ProfileFile());
+    QList<int> seconds;
+    for (int i = 0; i < jobs.size(); ++i) {
+        const FlowgraphProfile &p = profiles.at(i);
+        seconds << TuneDurationStore::predict(jobs.at(i), p.category,
+                                              p.firstChannel == p.lastChannel ? 1 : 2).seconds;
+    }
+
+    QList<int> order;
+    for (int i = 0; i < jobs.size(); ++i)
+        order << i;
+
+    // Files finishing on the amp the next one starts on come first (L1, L1_L2, L2),
+    // so a change of target amp happens at most twice per ALC level.
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        const TuneJob &ja = jobs.at(a);
+        const TuneJob &jb = jobs.at(b);
+        if (ja.priority != jb.priority)
+            return ja.priority > jb.priority;
+        if (ja.characterize != jb.characterize)
+            return !ja.characterize;
+        if (shortestFirst && seconds.at(a) / bucketSeconds != seconds.at(b) / bucketSeconds)
+            return seconds.at(a) < seconds.at(b);
+        double alcA = alcLevelFor(ja, characterizeAlc);
+        double alcB = alcLevelFor(jb, characterizeAlc);
+        if (!sameLevel(alcA, alcB))
+            return alcA < alcB;
+        const FlowgraphProfile &pa = profiles.at(a);
+        const FlowgraphProfile &pb = profiles.at(b);
+        int ampA = pa.firstChannel * 2 + pa.lastChannel;
+        int ampB = pb.firstChannel * 2 + pb.lastChannel;
+        if (ampA != ampB)
+            return ampA < ampB;
+        if (!qFuzzyCompare(pa.centerFreq + 1.0, pb.centerFreq + 1.0))
+            return pa.centerFreq < pb.centerFreq;
+        return pa.sampRate < pb.sampRate;
+    });
+
+    BatchPlan plan;
+    qint64 totalMs = 0;
+    int previous = -1;
+    for (int index : qAsConst(order)) {
+        const TuneJob &job = jobs.at(index);
+        const FlowgraphProfile &p = profiles.at(index);
+        plan.jobs << job;
+
+        // The tuner skips the amp setup when the previous file left the target amp
+        // online at the same ALC level.
+        bool reuse = false;
+        if (previous >= 0) {
+            const TuneJob &prev = jobs.at(previous);
+            reuse = sameLevel(alcLevelFor(prev, characterizeAlc), alcLevelFor(job, characterizeAlc)) &&
+                    profiles.at(previous).lastChannel == p.firstChannel;
+        }
+        if (reuse) {
+            ++plan.setupsSkipped;
+            totalMs += reusedSetupMs;
+        } else {
+            ++plan.setupGroups;
+            totalMs += fullSetupMs;
+        }
+        plan.jobSeconds << seconds.at(index);
+        plan.categories << p.category;
+        totalMs += qint64(seconds.at(index)) * 1000;
+        totalMs += changeoverMs;
+        previous = index;
+    }
+    plan.estimatedSeconds = int(totalMs / 1000);
+    return plan;
+}
+
+QString BatchPlanner::formatDuration(int seconds)
+{
+    return QString("%1:%2:%3")
+        .arg(seconds / 3600)
+        .arg((seconds / 60) % 60, 2, 10, QChar('0'))
+        .arg(seconds % 60, 2, 10, QChar('0'));
+}
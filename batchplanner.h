@@ -0,0 +1,49 @@
+#ifndef BATCHPLANNER_H
+#define BATCHPLANNER_H
+
+#include <QList>
+#include <QString>
+#include "tunejob.h"
+
+// What the planner knows about one flowgraph.
+struct FlowgraphProfile {
+    double centerFreq = 0.0;   // Hz, 0 when not found
+    double sampRate = 0.0;     // Samples/s, 0 when not found
+    int firstChannel = 0;      // Channel (and so amp) tuned first
+    int lastChannel = 0;       // Channel the file finishes on (1 for L1_L2)
+    QString sdrAddress;        // addr=/serial= from the USRP block arguments, if given
+    QString category;          // TuneDurationStore::category()
+};
+
+// A batch in the order it will run, with its expected cost.
+struct BatchPlan {
+    QList<TuneJob> jobs;
+    QList<int> jobSeconds;     // Predicted tuning time of each job, in jobs order
+    QList<QString> categories; // Duration category of each job, in jobs order
+    int setupGroups = 0;       // Runs of consecutive jobs sharing the same amp setup
+    int setupsSkipped = 0;     // Jobs expected to find the amp already configured
+    int estimatedSeconds = 0;
+};
+
+// Orders a batch so consecutive waveforms share amp and SDR setup: jobs are grouped by
+// amp model, ALC level and target amp, then by center frequency and sample rate.
+// Priority from the job file always wins over grouping. With [Batch] Order=shortest (the
+// default) quick files go first: jobs are bucketed by predicted duration
+// ([Batch] DurationBucketSeconds) and grouped for setup within each bucket.
+class BatchPlanner
+{
+public:
+    static FlowgraphProfile profile(const QString &file);
+    static BatchPlan plan(const QList<TuneJob> &jobs);
+    static QString formatDuration(int seconds);
+
+    // Splits jobs into files that need only the channel 0 amp, files that need only the
+    // channel 1 amp, and files that need the whole rig (L1_L2). The two single-amp lanes
+    // can run side by side only if their flowgraphs address different SDRs (or
+    // [Concurrent] AssumeSeparateSdrs is set); otherwise returns false with the reason
+    // and leaves every job in shared. Order within each list is kept.
+    static bool splitLanes(const QList<TuneJob> &jobs, QList<TuneJob> *shared,
+                           QList<TuneJob> *lane0, QList<TuneJob> *lane1, QString *reason);
+};
+
+#endif // BATCHPLANNER_H
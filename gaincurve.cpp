@@ -0,0 +1,126 @@
+#include "gaincurve.h"
+#include "simulatedrig.h"
+#include "storekey.h"
+#include <QCoreApplication>
+#include <QSettings>
+#include <QStringList>
+#include <QDateTime>
+#include <QDebug>
+#include <algorithm>
+
+static QString curveGroup(const QString &waveform, const QString &ampModel, int channel)
+{
+    return QString("%1/%2/ch%3").arg(StoreKey::segment(waveform), ampModel.toLower()).arg(channel);
+}
+
+QString GainCurveStore::storePath()
+{
+    if (SimulatedRig::isEnabled())
+        return SimulatedRig::instance().sandboxPath("waveCurves.ini");
+    return QCoreApplication::applicationDirPath() + "/waveCurves.ini";
+}
+
+bool GainCurveStore::save(const GainCurve &curve)
+{
+    QSettings settings(storePath(), QSettings::IniFormat);
+    settings.beginGroup(curveGroup(curve.waveform, curve.ampModel, curve.channel));
+    settings.remove("");
+    QStringList points;
+    for (const GainPoint &p : curve.points) {
+        points << QString("%1:%2:%3:%4")
+                      .arg(p.gain)
+                      .arg(p.vvaPower, 0, 'f', 2)
+                      .arg(p.alcPower, 0, 'f', 2)
+                      .arg(p.alcSaturated ? 1 : 0);
+    }
+    settings.setValue("AlcLevel", curve.alcLevel);
+    settings.setValue("Points", points);
+    settings.setValue("Measured", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    settings.endGroup();
+    settings.sync();
+    if (settings.status() != QSettings::NoError) {
+        qWarning() << "Failed to write gain curve store:" << storePath();
+        return false;
+    }
+    return true;
+}
+
+bool GainCurveStore::load(const QString &waveform, const QString &ampModel, int channel, GainCurve *curve)
+{
+    QSettings settings(storePath(), QSettings::IniFormat);
+    settings.beginGroup(curveGroup(waveform, ampModel, channel));
+    if (!settings.contains("Points"))
+        return false;
+
+    GainCurve result;
+    result.waveform = waveform;
+    result.ampModel = ampModel;
+    result.channel = channel;
+    result.alcLevel = settings.value("AlcLevel", 0.0).toDouble();
+    const QStringList points = settings.value("Points").toStringList();
+    for (const QString &entry : points) {
+        QStringList fields = entry.split(':');
+        if (fields.size() != 4)
+            continue;
+        GainPoint p;
+        p.gain = fields[0].toInt();
+        p.vvaPower = fields[1].toDouble();
+        p.alcPower = fields[2].toDouble();
+        p.alcSaturated = (fields[3] == "1");
+        result.points.append(p);
+    }
+    settings.endGroup();
+    std::sort(result.points.begin(), result.points.end(),
+              [](const GainPoint &a, const GainPoint &b) { return a.gain < b.gain; });
+    if (curve)
+        *curve = result;
+    return !result.points.isEmpty();
+}
+
+GainDerivation GainCurveStore::derive(const GainCurve &curve, double minPower, double maxPower,
+                                      const QString &critical)
+{
+    GainDerivation d;
+    if (curve.points.isEmpty()) {
+        d.reason = "No characterization points.";
+        return d;
+    }
+
+    // The sweep measures ALC at a low level, so alcPower is the lowest output the ALC can
+    // reach at that drive. At ALC level X the amp settles at max(X, floor), capped by the VVA output.
+    auto predictedAlc = [minPower](const GainPoint &p) {
+        return qMin(p.vvaPower, qMax(minPower, p.alcPower));
+    };
+
+    // Highest gain whose max does not exceed the target by more than 0.3 dB.
+    int maxIndex = -1;
+    for (int i = 0; i < curve.points.size(); ++i) {
+        if (curve.points[i].vvaPower - maxPower <= 0.3)
+            maxIndex = i;
+    }
+    if (maxIndex < 0) {
+        d.reason = QString("Max power exceeds %1 dBm at every swept gain.").arg(maxPower, 0, 'f', 1);
+        return d;
+    }
+    if (maxPower - curve.points[maxIndex].vvaPower > 0.1 && maxIndex == curve.points.size() - 1)
+        d.reason = "Sweep ended below the target max; result is the highest swept gain.";
+
+    int chosen = maxIndex;
+    if (critical.compare("LOW", Qt::CaseInsensitive) == 0) {
+        // Walk down until the ALC minimum is within 0.2 dB of target.
+        while (chosen >= 0 && (curve.points[chosen].alcSaturated ||
+                               predictedAlc(curve.points[chosen]) - minPower > 0.2))
+            --chosen;
+        if (chosen < 0) {
+            d.reason = QString("Min power cannot reach %1 dBm within the swept range.").arg(minPower, 0, 'f', 1);
+            return d;
+        }
+    }
+
+    const GainPoint &p = curve.points[chosen];
+    d.ok = true;
+    d.gain = p.gain;
+    d.predictedMax = p.vvaPower;
+    d.predictedMin = predictedAlc(p);
+    return d;
+}
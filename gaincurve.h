@@ -0,0 +1,47 @@
+#ifndef GAINCURVE_H
+#define GAINCURVE_H
+
+#include <QList>
+#include <QString>
+
+// One point of a characterization sweep: forward power at a given SDR gain,
+// measured with the amp in VVA (level 100) and in ALC mode.
+struct GainPoint {
+    int gain = 0;
+    double vvaPower = 0.0;
+    double alcPower = 0.0;
+    bool alcSaturated = false; // The amp reported "ALC Range" at this gain
+};
+
+struct GainCurve {
+    QString waveform;   // File name of the flowgraph
+    QString ampModel;   // "x300" or "N321"
+    int channel = 0;
+    double alcLevel = 0.0; // ALC_LEVEL used during the sweep
+    QList<GainPoint> points;
+};
+
+struct GainDerivation {
+    bool ok = false;
+    int gain = 0;
+    double predictedMax = 0.0;
+    double predictedMin = 0.0;
+    QString reason;
+};
+
+// Stores gain->power curves in waveCurves.ini next to the application and answers
+// "which gain meets min X / max Y" from them without touching hardware.
+class GainCurveStore
+{
+public:
+    static QString storePath();
+    static bool save(const GainCurve &curve);
+    static bool load(const QString &waveform, const QString &ampModel, int channel, GainCurve *curve);
+
+    // Mirrors WaveformTuner's acceptance rules: the max must land no more than 0.3 dB
+    // above target, and for LOW the ALC minimum must be within 0.2 dB of target.
+    static GainDerivation derive(const GainCurve &curve, double minPower, double maxPower,
+                                 const QString &critical);
+};
+
+#endif // GAINCURVE_H
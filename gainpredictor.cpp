@@ -0,0 +1,352 @@
+#include "gainpredictor.h"
+#include "tuneconfig.h"
+#include "simulatedrig.h"
+#include "storekey.h"
+#include "waveformdedup.h"
+#include <QCoreApplication>
+#include <QSettings>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QRegularExpression>
+#include <QDateTime>
+#include <QDebug>
+#include <cmath>
+
+namespace {
+
+struct HistoryRecord {
+    QString waveform;
+    QString ampModel;
+    int channel = 0;
+    double maxPower = 0.0;
+    double gain = 0.0;
+    QVector<double> features;
+};
+
+// History is keyed by the flowgraph's normalized content hash, so files that share a
+// name in different directories stay apart and a renamed or moved file keeps its history.
+QString historyKey(const QString &file)
+{
+    return QString::fromLatin1(WaveformDedup::contentHash(file));
+}
+
+QString historyGroup(const QString &key, const QString &ampModel, int channel)
+{
+    return QString("%1/%2/ch%3").arg(StoreKey::segment(key), ampModel.toLower()).arg(channel);
+}
+
+QList<HistoryRecord> loadHistory()
+{
+    QList<HistoryRecord> records;
+    QSettings settings(GainPredictor::storePath(), QSettings::IniFormat);
+    const int featureCount = FlowgraphFeatures::names().size();
+    const QStringList groups = settings.childGroups();
+    for (const QString &waveform : groups) {
+        settings.beginGroup(waveform);
+        const QStringList models = settings.childGroups();
+        for (const QString &model : models) {
+            settings.beginGroup(model);
+            const QStringList channels = settings.childGroups();
+            for (const QString &channel : channels) {
+                settings.beginGroup(channel);
+                HistoryRecord r;
+                r.waveform = waveform;
+                r.ampModel = model;
+                r.channel = channel.mid(2).toInt();
+                r.maxPower = settings.value("MaxPower").toDouble();
+                r.gain = settings.value("Gain").toDouble();
+                const QStringList values = settings.value("Features").toStringList();
+                for (const QString &v : values)
+                    r.features << v.toDouble();
+                settings.endGroup();
+                // Records from an older feature set are ignored until the file is tuned again.
+                if (r.features.size() == featureCount)
+                    records << r;
+            }
+            settings.endGroup();
+        }
+        settings.endGroup();
+    }
+    return records;
+}
+
+// Inverts the symmetric positive definite matrix a (n x n, row major) in place.
+bool invert(QVector<double> &a, int n)
+{
+    QVector<double> inv(n * n, 0.0);
+    for (int i = 0; i < n; ++i)
+        inv[i * n + i] = 1.0;
+    for (int col = 0; col < n; ++col) {
+        int pivot = col;
+        for (int row = col + 1; row < n; ++row) {
+            if (std::abs(a[row * n + col]) > std::abs(a[pivot * n + col]))
+                pivot = row;
+        }
+        if (std::abs(a[pivot * n + col]) < 1e-12)
+            return false;
+        if (pivot != col) {
+            for (int k = 0; k < n; ++k) {
+                std::swap(a[col * n + k], a[pivot * n + k]);
+                std::swap(inv[col * n + k], inv[pivot * n + k]);
+            }
+        }
+        const double d = a[col * n + col];
+        for (int k = 0; k < n; ++k) {
+            a[col * n + k] /= d;
+            inv[col * n + k] /= d;
+        }
+        for (int row = 0; row < n; ++row) {
+            if (row == col)
+                continue;
+            const double f = a[row * n + col];
+            if (f == 0.0)
+                continue;
+            for (int k = 0; k < n; ++k) {
+                a[row * n + k] -= f * a[col * n + k];
+                inv[row * n + k] -= f * inv[col * n + k];
+            }
+        }
+    }
+    a = inv;
+    return true;
+}
+
+// Product of the numeric literals matched by re (capture 1), in dB; 0 dB if none.
+double literalScaleDb(const QString &content, const QRegularExpression &re)
+{
+    double db = 0.0;
+    QRegularExpressionMatchIterator it = re.globalMatch(content);
+    while (it.hasNext()) {
+        bool ok = false;
+        const double value = std::abs(it.next().captured(1).toDouble(&ok));
+        if (ok && value > 0.0)
+            db += 20.0 * std::log10(value);
+    }
+    return db;
+}
+
+// Stored features are rounded to six significant digits.
+bool sameFeatures(const QVector<double> &a, const QVector<double> &b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (int i = 0; i < a.size(); ++i) {
+        if (std::abs(a.at(i) - b.at(i)) > 1e-4 * qMax(1.0, std::abs(b.at(i))))
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+QStringList FlowgraphFeatures::names()
+{
+    return QStringList() << "ScaleDb" << "SampRateLog" << "BlockCountLog" << "Ofdm" << "Digital"
+                         << "AnalogMod" << "Noise" << "Tone" << "TwoChannel" << "Channel" << "N321";
+}
+
+FlowgraphFeatures FlowgraphFeatures::extract(const QString &file, const QString &ampModel, int channel)
+{
+    FlowgraphFeatures f;
+    QFile fileObj(file);
+    if (!fileObj.open(QIODevice::ReadOnly | QIODevice::Text))
+        return f;
+    QTextStream in(&fileObj);
+    QString content = in.readAll();
+    fileObj.close();
+    static const QRegularExpression commentRe("#[^\\n]*");
+    content.remove(commentRe);
+
+    static const QRegularExpression multiplyRe("multiply_const_\\w+\\(\\s*([-+]?[0-9.]+(?:[eE][-+]?[0-9]+)?)\\s*[,)]");
+    static const QRegularExpression amplitudeRe("\\bamplitude\\s*=\\s*([-+]?[0-9.]+(?:[eE][-+]?[0-9]+)?)\\b");
+    // analog.sig_source_x(samp_rate, waveform, frequency, amplitude, ...)
+    static const QRegularExpression sigSourceRe("analog\\.sig_source_\\w+\\([^,()]*,[^,()]*,[^,()]*,\\s*([-+]?[0-9.]+(?:[eE][-+]?[0-9]+)?)\\s*[,)]");
+    double scaleDb = literalScaleDb(content, multiplyRe) + literalScaleDb(content, amplitudeRe)
+                     + literalScaleDb(content, sigSourceRe);
+
+    static const QRegularExpression sampRateRe("\\bsamp_rate\\s*=\\s*([0-9.]+(?:[eE][-+]?[0-9]+)?)");
+    const double sampRate = sampRateRe.match(content).captured(1).toDouble();
+
+    static const QRegularExpression blockRe("\\b(?:blocks|analog|digital|filter|fft|channels|uhd)\\.\\w+\\(");
+    int blocks = 0;
+    QRegularExpressionMatchIterator it = blockRe.globalMatch(content);
+    while (it.hasNext()) {
+        it.next();
+        ++blocks;
+    }
+
+    static const QRegularExpression ofdmRe("\\bdigital\\.ofdm_\\w*\\(|\\bofdm\\w*\\(", QRegularExpression::CaseInsensitiveOption);
+    static const QRegularExpression digitalRe("\\bdigital\\.(?:constellation\\w*|psk\\w*|qam\\w*|gmsk\\w*|cpm\\w*|"
+                                              "chunks_to_symbols\\w*|generic_mod|map_bb|gfsk\\w*)\\(");
+    static const QRegularExpression analogModRe("\\banalog\\.(?:frequency_modulator\\w*|phase_modulator\\w*|"
+                                                "wfm_tx|nbfm_tx)\\(");
+    static const QRegularExpression noiseRe("\\banalog\\.(?:noise_source|fastnoise_source)\\w*\\(");
+    static const QRegularExpression sigSourcePresentRe("\\banalog\\.sig_source_\\w+\\(");
+    const bool ofdm = content.contains(ofdmRe);
+    const bool digital = content.contains(digitalRe);
+    const bool analogMod = content.contains(analogModRe);
+    const bool noise = content.contains(noiseRe);
+    const bool tone = content.contains(sigSourcePresentRe) && !ofdm && !digital && !analogMod && !noise;
+
+    const QString fileName = QFileInfo(file).fileName();
+    f.values << qBound(-60.0, scaleDb, 20.0)
+             << (sampRate > 0.0 ? std::log10(sampRate / 1e6) : 0.0)
+             << std::log2(1.0 + blocks)
+             << (ofdm ? 1.0 : 0.0)
+             << (digital ? 1.0 : 0.0)
+             << (analogMod ? 1.0 : 0.0)
+             << (noise ? 1.0 : 0.0)
+             << (tone ? 1.0 : 0.0)
+             << (fileName.startsWith("L1_L2_") ? 1.0 : 0.0)
+             << double(channel)
+             << (ampModel.compare("N321", Qt::CaseInsensitive) == 0 ? 1.0 : 0.0);
+    f.ok = true;
+    return f;
+}
+
+QString GainPredictor::storePath()
+{
+    if (SimulatedRig::isEnabled())
+        return SimulatedRig::instance().sandboxPath("waveGainHistory.ini");
+    return QCoreApplication::applicationDirPath() + "/waveGainHistory.ini";
+}
+
+GainPrediction GainPredictor::predict(const QString &file, const QString &ampModel, int channel, double maxPower,
+                                      const TuneConfig &config)
+{
+    GainPrediction p;
+    const int minSamples = config.predictorMinSamples;
+    const double maxSigma = config.predictorMaxSigmaDb;
+    const double repeatSigma = config.predictorRepeatSigmaDb;
+    const double ridge = config.predictorRidge;
+    // Starting below the prediction keeps an unlucky guess from overdriving the amp.
+    const double backoff = config.predictorBackoffSigmas;
+    const int gainMin = config.gainMin;
+    const int gainMax = config.gainMax;
+
+    const FlowgraphFeatures features = FlowgraphFeatures::extract(file, ampModel, channel);
+    if (!features.ok) {
+        p.reason = "Cannot read the flowgraph.";
+        return p;
+    }
+    const QList<HistoryRecord> records = loadHistory();
+    p.samples = records.size();
+
+    // The same flowgraph tuned before on this amp model: its own result beats the model.
+    const QString key = StoreKey::segment(historyKey(file));
+    bool repeat = false;
+    for (const HistoryRecord &r : records) {
+        if (!key.isEmpty() && r.waveform == key && r.channel == channel
+            && r.ampModel.compare(ampModel, Qt::CaseInsensitive) == 0 && sameFeatures(r.features, features.values)) {
+            p.predicted = r.gain + (maxPower - r.maxPower);
+            p.sigmaDb = repeatSigma;
+            p.source = "history";
+            repeat = true;
+            break;
+        }
+    }
+
+    if (!repeat) {
+        // Ridge regression of (gain - max target) on centered features. With n <= k + 1 it
+        // all but interpolates the history and the residual says nothing about the error.
+        const int n = records.size();
+        const int k = features.values.size();
+        const int needed = qMax(minSamples, k + 2);
+        if (n < needed) {
+            p.reason = QString("Only %1 of %2 past tunes recorded.").arg(n).arg(needed);
+            return p;
+        }
+        QVector<double> mean(k, 0.0);
+        double yMean = 0.0;
+        for (const HistoryRecord &r : records) {
+            for (int j = 0; j < k; ++j)
+                mean[j] += r.features.at(j) / n;
+            yMean += (r.gain - r.maxPower) / n;
+        }
+        QVector<double> a(k * k, 0.0);
+        QVector<double> b(k, 0.0);
+        for (const HistoryRecord &r : records) {
+            const double y = r.gain - r.maxPower - yMean;
+            for (int i = 0; i < k; ++i) {
+                const double xi = r.features.at(i) - mean.at(i);
+                b[i] += xi * y;
+                for (int j = 0; j < k; ++j)
+                    a[i * k + j] += xi * (r.features.at(j) - mean.at(j));
+            }
+        }
+        for (int i = 0; i < k; ++i)
+            a[i * k + i] += ridge;
+        if (!invert(a, k)) {
+            p.reason = "History does not determine the model.";
+            return p;
+        }
+        QVector<double> w(k, 0.0);
+        for (int i = 0; i < k; ++i) {
+            for (int j = 0; j < k; ++j)
+                w[i] += a.at(i * k + j) * b.at(j);
+        }
+        auto fitted = [&](const QVector<double> &x) {
+            double y = yMean;
+            for (int j = 0; j < k; ++j)
+                y += w.at(j) * (x.at(j) - mean.at(j));
+            return y;
+        };
+        double sse = 0.0;
+        for (const HistoryRecord &r : records) {
+            const double e = (r.gain - r.maxPower) - fitted(r.features);
+            sse += e * e;
+        }
+        const double residual = std::sqrt(sse / (n - k - 1));
+        // Prediction interval: residual scatter plus the fit's uncertainty at this point.
+        double leverage = 1.0 / n;
+        for (int i = 0; i < k; ++i) {
+            for (int j = 0; j < k; ++j)
+                leverage += (features.values.at(i) - mean.at(i)) * a.at(i * k + j) * (features.values.at(j) - mean.at(j));
+        }
+        p.predicted = fitted(features.values) + maxPower;
+        p.sigmaDb = residual * std::sqrt(1.0 + qMax(0.0, leverage));
+        p.source = "model";
+        if (p.sigmaDb > maxSigma) {
+            p.reason = QString("Prediction %1 dBm is uncertain (+/- %2 dB).")
+                           .arg(p.predicted, 0, 'f', 1).arg(p.sigmaDb, 0, 'f', 1);
+            return p;
+        }
+    }
+
+    p.gain = qBound(gainMin, int(std::floor(p.predicted - backoff * p.sigmaDb + 0.5)), gainMax);
+    p.ok = true;
+    return p;
+}
+
+bool GainPredictor::record(const QString &file, const QString &ampModel, int channel, double maxPower,
+                           double gain, int runs)
+{
+    const FlowgraphFeatures features = FlowgraphFeatures::extract(file, ampModel, channel);
+    if (!features.ok)
+        return false;
+    QStringList values;
+    for (double v : features.values)
+        values << QString::number(v, 'g', 6);
+
+    const QString key = historyKey(file);
+    if (key.isEmpty())
+        return false;
+
+    QSettings settings(storePath(), QSettings::IniFormat);
+    settings.beginGroup(historyGroup(key, ampModel, channel));
+    settings.remove("");
+    settings.setValue("File", QFileInfo(file).absoluteFilePath());
+    settings.setValue("Features", values);
+    settings.setValue("MaxPower", maxPower);
+    settings.setValue("Gain", gain);
+    settings.setValue("Runs", runs);
+    settings.setValue("Recorded", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    settings.endGroup();
+    settings.sync();
+    if (settings.status() != QSettings::NoError) {
+        qWarning() << "Failed to write gain history:" << storePath();
+        return false;
+    }
+    return true;
+}
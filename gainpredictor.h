@@ -0,0 +1,52 @@
+#ifndef GAINPREDICTOR_H
+#define GAINPREDICTOR_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+struct TuneConfig;
+
+// Static features of a flowgraph that move the gain it needs: how hard the source is
+// scaled, what kind of modulation it carries, its sample rate and channel layout.
+struct FlowgraphFeatures {
+    bool ok = false;
+    QVector<double> values;     // One per names() entry
+
+    static QStringList names();
+    // Reads file and describes it as tuned on channel with ampModel.
+    static FlowgraphFeatures extract(const QString &file, const QString &ampModel, int channel);
+};
+
+struct GainPrediction {
+    bool ok = false;            // Confident enough to start from gain
+    int gain = 0;               // Starting gain (predicted, backed off by the uncertainty)
+    double predicted = 0.0;     // Expected tuned gain
+    double sigmaDb = 0.0;       // One standard deviation of the prediction
+    int samples = 0;            // Past tunes behind the prediction
+    QString source;             // "history" (same file tuned before) or "model"
+    QString reason;             // Why there is no prediction, when !ok
+};
+
+// Predicts a waveform's tuned SDR gain before the first run, so most files start close
+// enough to converge in one or two runs instead of climbing from the model's default.
+//
+// Every finished channel is recorded in waveGainHistory.ini next to the application.
+// The tuned gain less the max power target (the gain the file would need for 0 dBm) is
+// fitted by ridge regression on the flowgraph features of all recorded files; a flowgraph
+// tuned before (matched by WaveformDedup::contentHash, not by name) is predicted from its
+// own last result instead. See [Predictor] in waveTuneConfig.ini.
+class GainPredictor
+{
+public:
+    static QString storePath();
+
+    // The [Predictor] settings and gain range come from config.
+    static GainPrediction predict(const QString &file, const QString &ampModel, int channel, double maxPower,
+                                  const TuneConfig &config);
+    // Records a finished tune. gain may be fractional when the VVA trim finished the job.
+    static bool record(const QString &file, const QString &ampModel, int channel, double maxPower,
+                       double gain, int runs);
+};
+
+#endif // GAINPREDICTOR_H
@@ -0,0 +1,194 @@
+#include "linkstats.h"
+#include <QJsonArray>
+#include <QStringList>
+#include <cmath>
+
+// Values below 2^kSubBits get a bucket each; above that every power of two is split into
+// 2^kSubBits buckets.
+static const int kSubBits = 5;
+static const int kSubBuckets = 1 << kSubBits;
+static const qint64 kMaxUs = qint64(1) << 36; // About 19 hours; anything longer is clamped
+
+int LatencyHistogram::bucketFor(qint64 us)
+{
+    if (us < kSubBuckets)
+        return int(qMax<qint64>(0, us));
+    int exponent = 63;
+    while (!(us & (qint64(1) << exponent)))
+        --exponent;
+    const int shift = exponent - kSubBits;
+    const int mantissa = int((us >> shift) - kSubBuckets);
+    return kSubBuckets + shift * kSubBuckets + mantissa;
+}
+
+qint64 LatencyHistogram::bucketUpper(int bucket)
+{
+    if (bucket < kSubBuckets)
+        return bucket;
+    const int shift = (bucket - kSubBuckets) / kSubBuckets;
+    const int mantissa = (bucket - kSubBuckets) % kSubBuckets;
+    return ((qint64(kSubBuckets + mantissa + 1)) << shift) - 1;
+}
+
+void LatencyHistogram::record(qint64 us)
+{
+    us = qBound<qint64>(0, us, kMaxUs);
+    const int bucket = bucketFor(us);
+    if (bucket >= m_counts.size())
+        m_counts.resize(bucket + 1);
+    ++m_counts[bucket];
+    m_min = m_count ? qMin(m_min, us) : us;
+    m_max = m_count ? qMax(m_max, us) : us;
+    m_sum += us;
+    ++m_count;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    if (!other.m_count)
+        return;
+    if (other.m_counts.size() > m_counts.size())
+        m_counts.resize(other.m_counts.size());
+    for (int i = 0; i < other.m_counts.size(); ++i)
+        m_counts[i] += other.m_counts.at(i);
+    m_min = m_count ? qMin(m_min, other.m_min) : other.m_min;
+    m_max = m_count ? qMax(m_max, other.m_max) : other.m_max;
+    m_sum += other.m_sum;
+    m_count += other.m_count;
+}
+
+qint64 LatencyHistogram::percentile(double percent) const
+{
+    if (!m_count)
+        return 0;
+    const qint64 target = qMax<qint64>(1, qint64(std::ceil(percent / 100.0 * m_count)));
+    qint64 seen = 0;
+    for (int i = 0; i < m_counts.size(); ++i) {
+        seen += m_counts.at(i);
+        if (seen >= target)
+            return qBound(m_min, bucketUpper(i), m_max);
+    }
+    return m_max;
+}
+
+QString LinkStats::commandType(const QString &command)
+{
+    return command.trimmed().section(' ', 0, 0).toUpper();
+}
+
+void LinkStats::recordReply(const QString &device, const QString &command, qint64 us)
+{
+    m_devices[device].latency[commandType(command)].record(us);
+}
+
+void LinkStats::recordTimeout(const QString &device, const QString &command)
+{
+    ++m_devices[device].timeouts[commandType(command)];
+}
+
+void LinkStats::recordError(const QString &device, const QString &command)
+{
+    DeviceStats &stats = m_devices[device];
+    ++stats.errors[commandType(command)];
+    ++stats.errorLines;
+}
+
+void LinkStats::recordUnmatched(const QString &device, bool isError)
+{
+    DeviceStats &stats = m_devices[device];
+    ++stats.unmatched;
+    if (isError)
+        ++stats.errorLines;
+}
+
+void LinkStats::merge(const LinkStats &other)
+{
+    for (auto it = other.m_devices.cbegin(); it != other.m_devices.cend(); ++it) {
+        DeviceStats &stats = m_devices[it.key()];
+        for (auto h = it->latency.cbegin(); h != it->latency.cend(); ++h)
+            stats.latency[h.key()].merge(h.value());
+        for (auto t = it->timeouts.cbegin(); t != it->timeouts.cend(); ++t)
+            stats.timeouts[t.key()] += t.value();
+        for (auto e = it->errors.cbegin(); e != it->errors.cend(); ++e)
+            stats.errors[e.key()] += e.value();
+        stats.errorLines += it->errorLines;
+        stats.unmatched += it->unmatched;
+    }
+}
+
+void LinkStats::clear()
+{
+    m_devices.clear();
+}
+
+static QString formatUs(qint64 us)
+{
+    return QString::number(us / 1000.0, 'f', 1) + " ms";
+}
+
+QString LinkStats::summary() const
+{
+    QStringList lines;
+    for (auto it = m_devices.cbegin(); it != m_devices.cend(); ++it) {
+        const DeviceStats &stats = it.value();
+        qint64 replies = 0;
+        for (const LatencyHistogram &histogram : stats.latency)
+            replies += histogram.count();
+        int timeouts = 0;
+        for (int count : stats.timeouts)
+            timeouts += count;
+        lines << QString("Serial link %1: %2 replies, %3 timeouts, %4 unmatched, %5 ERROR: lines")
+                     .arg(it.key()).arg(replies).arg(timeouts).arg(stats.unmatched).arg(stats.errorLines);
+
+        QStringList types = stats.latency.keys();
+        for (const QString &type : stats.timeouts.keys() + stats.errors.keys()) {
+            if (!types.contains(type))
+                types << type;
+        }
+        for (const QString &type : qAsConst(types)) {
+            const LatencyHistogram histogram = stats.latency.value(type);
+            QString line = QString("  %1 n=%2").arg(type, -10).arg(histogram.count());
+            if (histogram.count())
+                line += QString("  p50 %1  p90 %2  p99 %3  max %4")
+                            .arg(formatUs(histogram.percentile(50)), formatUs(histogram.percentile(90)),
+                                 formatUs(histogram.percentile(99)), formatUs(histogram.max()));
+            if (stats.timeouts.value(type))
+                line += QString("  timeouts %1").arg(stats.timeouts.value(type));
+            if (stats.errors.value(type))
+                line += QString("  errors %1").arg(stats.errors.value(type));
+            lines << line;
+        }
+    }
+    return lines.join('\n');
+}
+
+QJsonObject LinkStats::toJson() const
+{
+    QJsonObject devices;
+    for (auto it = m_devices.cbegin(); it != m_devices.cend(); ++it) {
+        const DeviceStats &stats = it.value();
+        QJsonObject commands;
+        for (auto h = stats.latency.cbegin(); h != stats.latency.cend(); ++h) {
+            const LatencyHistogram &histogram = h.value();
+            commands.insert(h.key(), QJsonObject{{"count", histogram.count()},
+                                                 {"minUs", histogram.min()},
+                                                 {"meanUs", histogram.mean()},
+                                                 {"p50Us", histogram.percentile(50)},
+                                                 {"p90Us", histogram.percentile(90)},
+                                                 {"p99Us", histogram.percentile(99)},
+                                                 {"maxUs", histogram.max()}});
+        }
+        QJsonObject timeouts;
+        for (auto t = stats.timeouts.cbegin(); t != stats.timeouts.cend(); ++t)
+            timeouts.insert(t.key(), t.value());
+        QJsonObject errors;
+        for (auto e = stats.errors.cbegin(); e != stats.errors.cend(); ++e)
+            errors.insert(e.key(), e.value());
+        devices.insert(it.key(), QJsonObject{{"latency", commands},
+                                             {"timeouts", timeouts},
+                                             {"errors", errors},
+                                             {"errorLines", stats.errorLines},
+                                             {"unmatched", stats.unmatched}});
+    }
+    return devices;
+}
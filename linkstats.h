@@ -0,0 +1,68 @@
+#ifndef LINKSTATS_H
+#define LINKSTATS_H
+
+#include <QJsonObject>
+#include <QMap>
+#include <QString>
+#include <QVector>
+
+// Latency histogram in the style of HdrHistogram: microsecond values are counted in
+// log-linear buckets (32 per power of two, so about 3% resolution at any magnitude) and
+// percentiles come back as the upper edge of the bucket they fall in.
+class LatencyHistogram
+{
+public:
+    void record(qint64 us);
+    void merge(const LatencyHistogram &other);
+
+    qint64 count() const { return m_count; }
+    qint64 min() const { return m_min; }
+    qint64 max() const { return m_max; }
+    double mean() const { return m_count ? double(m_sum) / m_count : 0.0; }
+    qint64 percentile(double percent) const;
+
+private:
+    static int bucketFor(qint64 us);
+    static qint64 bucketUpper(int bucket);
+
+    QVector<qint64> m_counts;
+    qint64 m_count = 0;
+    qint64 m_sum = 0;
+    qint64 m_min = 0;
+    qint64 m_max = 0;
+};
+
+// Serial link health per amp: reply latency per command type (first word of the
+// command, e.g. FWD_PWR? or MODE?) measured from the write to the completed reply line,
+// plus replies lost to timeouts, lines that matched no outstanding command, and ERROR:
+// lines.
+class LinkStats
+{
+public:
+    void recordReply(const QString &device, const QString &command, qint64 us);
+    void recordTimeout(const QString &device, const QString &command);
+    void recordError(const QString &device, const QString &command);
+    void recordUnmatched(const QString &device, bool isError);
+    // Adds other's counts, e.g. one job's stats into a running total.
+    void merge(const LinkStats &other);
+    void clear();
+
+    bool isEmpty() const { return m_devices.isEmpty(); }
+    QString summary() const;
+    QJsonObject toJson() const;
+
+    static QString commandType(const QString &command);
+
+private:
+    struct DeviceStats {
+        QMap<QString, LatencyHistogram> latency;
+        QMap<QString, int> timeouts;
+        QMap<QString, int> errors;
+        int errorLines = 0;
+        int unmatched = 0;
+    };
+
+    QMap<QString, DeviceStats> m_devices;
+};
+
+#endif // LINKSTATS_H
@@ -0,0 +1,155 @@
+#include "loadwatchdog.h"
+#include "tuneconfig.h"
+#include "amplifierserial.h"
+#include <QDateTime>
+#include <QRegularExpression>
+#include <QTimer>
+#include <QDebug>
+#include <QtMath>
+
+LoadWatchdog::LoadWatchdog(AmplifierSerial *ampSerial, QObject *parent)
+    : QObject(parent),
+    m_ampSerial(ampSerial),
+    m_pollTimer(new QTimer(this))
+{
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    m_enabled = config->watchdogEnabled;
+    m_minReturnLoss = config->watchdogMinReturnLossDb;
+    m_minFwd = config->watchdogMinFwdDbm;
+    m_maxDrop = config->watchdogMaxDropDb;
+    m_consecutiveBad = config->watchdogConsecutiveBad;
+    m_windowMs = config->watchdogWindowMs;
+    m_pairWindowMs = config->watchdogPairWindowMs;
+    m_pollTimer->setInterval(config->watchdogPollMs);
+
+    connect(m_pollTimer, &QTimer::timeout, this, &LoadWatchdog::poll);
+    connect(m_ampSerial, &AmplifierSerial::commandReply, this, &LoadWatchdog::onCommandReply);
+}
+
+void LoadWatchdog::start(const QStringList &devices)
+{
+    if (!m_enabled)
+        return;
+    m_devices = devices;
+    m_samples.clear();
+    m_lastFwd.clear();
+    m_lastFwdTime.clear();
+    m_pollTimer->start();
+}
+
+void LoadWatchdog::stop()
+{
+    m_pollTimer->stop();
+    m_devices.clear();
+}
+
+bool LoadWatchdog::isActive() const
+{
+    return m_pollTimer->isActive();
+}
+
+double LoadWatchdog::vswrFromReturnLoss(double returnLossDb)
+{
+    double gamma = qPow(10.0, -qAbs(returnLossDb) / 20.0);
+    if (gamma >= 1.0)
+        return 999.0;
+    return (1.0 + gamma) / (1.0 - gamma);
+}
+
+void LoadWatchdog::poll()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (const QString &dev : qAsConst(m_devices)) {
+        // Only ask for forward power when the tuner has not just done so.
+        if (now - m_lastFwdTime.value(dev, 0) > m_pairWindowMs)
+            m_ampSerial->getFwdPwr(dev);
+        m_ampSerial->getRevPwr(dev);
+    }
+}
+
+void LoadWatchdog::onCommandReply(const QString &device, const QString &command, const QString &reply)
+{
+    if (!m_devices.contains(device))
+        return;
+    static const QRegularExpression rx("([-+]?\\d*\\.?\\d+)");
+    QRegularExpressionMatch match = rx.match(reply);
+    if (!match.hasMatch() || reply.contains("ALC Range"))
+        return;
+    const double value = match.captured(1).toDouble();
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    if (command == "FWD_PWR?") {
+        m_lastFwd.insert(device, value);
+        m_lastFwdTime.insert(device, now);
+        return;
+    }
+    if (command != "REV_PWR?" || !m_lastFwdTime.contains(device))
+        return;
+    if (now - m_lastFwdTime.value(device) > m_pairWindowMs)
+        return;
+    const double fwd = m_lastFwd.value(device);
+    // Too little drive for the reverse reading to mean anything.
+    if (fwd < m_minFwd)
+        return;
+
+    Sample sample;
+    sample.time = now;
+    sample.fwd = fwd;
+    sample.returnLoss = fwd - value;
+    QList<Sample> &samples = m_samples[device];
+    samples.append(sample);
+    while (!samples.isEmpty() && now - samples.first().time > m_windowMs)
+        samples.removeFirst();
+    evaluate(device);
+}
+
+void LoadWatchdog::evaluate(const QString &device)
+{
+    const QList<Sample> &samples = m_samples.value(device);
+    if (samples.isEmpty())
+        return;
+    const Sample &last = samples.last();
+
+    // Sustained mismatch: the last few pairs are all below the limit.
+    int bad = 0;
+    for (int i = samples.size() - 1; i >= 0 && samples.at(i).returnLoss < m_minReturnLoss; --i)
+        ++bad;
+    if (bad >= m_consecutiveBad) {
+        QString reason = QString("Load mismatch on %1: return loss %2 dB (VSWR %3:1) for %4 readings "
+                                 "at %5 dBm forward; limit %6 dB.")
+                             .arg(device)
+                             .arg(last.returnLoss, 0, 'f', 1)
+                             .arg(vswrFromReturnLoss(last.returnLoss), 0, 'f', 2)
+                             .arg(bad)
+                             .arg(last.fwd, 0, 'f', 1)
+                             .arg(m_minReturnLoss, 0, 'f', 1);
+        stop();
+        emit loadFault(device, reason);
+        return;
+    }
+
+    // Worsening match: return loss fell sharply within the window (e.g. a connector
+    // working loose) even if it has not reached the limit yet.
+    // The last few pairs must all be down, so one pair straddling a gain step does not count.
+    if (samples.size() <= m_consecutiveBad)
+        return;
+    const int recent = samples.size() - m_consecutiveBad;
+    double best = samples.first().returnLoss;
+    for (int i = 0; i < recent; ++i)
+        best = qMax(best, samples.at(i).returnLoss);
+    double recentBest = samples.at(recent).returnLoss;
+    for (int i = recent; i < samples.size(); ++i)
+        recentBest = qMax(recentBest, samples.at(i).returnLoss);
+    if (best - recentBest > m_maxDrop) {
+        QString reason = QString("Load degrading on %1: return loss fell from %2 to %3 dB "
+                                 "(VSWR %4:1 to %5:1) within %6 ms.")
+                             .arg(device)
+                             .arg(best, 0, 'f', 1)
+                             .arg(last.returnLoss, 0, 'f', 1)
+                             .arg(vswrFromReturnLoss(best), 0, 'f', 2)
+                             .arg(vswrFromReturnLoss(last.returnLoss), 0, 'f', 2)
+                             .arg(last.time - samples.first().time);
+        stop();
+        emit loadFault(device, reason);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef LOADWATCHDOG_H
+#define LOADWATCHDOG_H
+
+#include <QObject>
+#include <QMap>
+#include <QList>
+#include <QStringList>
+
+class AmplifierSerial;
+class QTimer;
+
+// Watches the load while a waveform is transmitting: polls REV_PWR? between the
+// tuner's FWD_PWR? queries, pairs each reverse reading with the latest forward one and
+// tracks return loss / VSWR per amp. Emits loadFault as soon as the match is clearly
+// bad (sustained below [Watchdog] MinReturnLossDb, or falling fast), so the tuner can
+// stop instead of chasing an unstable forward power.
+class LoadWatchdog : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LoadWatchdog(AmplifierSerial *ampSerial, QObject *parent = nullptr);
+
+    void start(const QStringList &devices);
+    void stop();
+    bool isActive() const;
+
+    static double vswrFromReturnLoss(double returnLossDb);
+
+signals:
+    void loadFault(const QString &device, const QString &reason);
+
+private slots:
+    void poll();
+    void onCommandReply(const QString &device, const QString &command, const QString &reply);
+
+private:
+    struct Sample {
+        qint64 time = 0;
+        double fwd = 0.0;
+        double returnLoss = 0.0;
+    };
+
+    void evaluate(const QString &device);
+
+    AmplifierSerial *m_ampSerial;
+    QTimer *m_pollTimer;
+    QStringList m_devices;
+    QMap<QString, double> m_lastFwd;
+    QMap<QString, qint64> m_lastFwdTime;
+    QMap<QString, QList<Sample>> m_samples;
+    bool m_enabled;
+    double m_minReturnLoss;
+    double m_minFwd;
+    double m_maxDrop;
+    int m_consecutiveBad;
+    int m_windowMs;
+    int m_pairWindowMs;
+};
+
+#endif // LOADWATCHDOG_H
@@ -1,88 +1,556 @@
 #include <QCoreApplication>
+#include <QCommandLineParser>
 #include <QTextStream>
 #include <QDir>
 #include <QStringList>
 #include <QTimer>
 #include <QSettings>
 #include <functional>
+#include <memory>
 #include "waveformtuner.h"
 #include "wavelogger.h"
+#include "pythoneditor.h"
+#include "gaincurve.h"
+#include "waveformpreparer.h"
+#include "waveformscanner.h"
+#include "tunejob.h"
+#include "tuningdaemon.h"
+#include "batchjournal.h"
+#include "batchplanner.h"
+#include "amplifierserial.h"
+#include "settlecalibrator.h"
+#include "simulatedrig.h"
+#include "tunecoordinator.h"
+#include "tuneworker.h"
+#include "soakrunner.h"
+#include "waveformdedup.h"
+#include "tuneconfig.h"
+#include "tuneduration.h"
+#include "batcheta.h"
 
-// Helper: Check if the filename should be excluded.
-bool isFileExcluded(const QString &fileName)
+// Shared by the lanes of a batch: the tuners running in any of them, and the lanes holding
+// at a file boundary until those finish so a staged config reload can be applied.
+struct LaneSync {
+    int active = 0;
+    QList<std::function<void()>> waiting;
+};
+
+// One sequence of jobs run by one tuner at a time. Two lanes restricted to different
+// amps run side by side.
+struct BatchLane {
+    QString name;               // Printed with progress when lanes run concurrently
+    QStringList devices;        // Amps the lane's tuners may use, empty for all
+    std::function<void()> done;
+    BatchEta *eta = nullptr;
+    // Files stopped at their budget; they are retried, without one, once the lane is through.
+    std::shared_ptr<QList<TuneJob>> parked;
+    bool retryPass = false;
+    std::shared_ptr<LaneSync> sync = std::make_shared<LaneSync>();
+};
+
+// A lane's tuner is done; once no lane is tuning, the held lanes carry on.
+void tunerEnded(const BatchLane &lane, QCoreApplication *app)
 {
-    // Build the path to waveTuneConfig.ini in the application's directory.
-    QString configFile = QCoreApplication::applicationDirPath() + "/waveTuneConfig.ini";
-    QSettings settings(configFile, QSettings::IniFormat);
-    settings.beginGroup("Exclusions");
-    // childKeys() returns the list of keys in the group.
-    QStringList exclusions = settings.childKeys();
-    settings.endGroup();
-
-    // Check each exclusion keyword (non-case sensitive).
-    for (const QString &exclusion : exclusions) {
-        if (fileName.contains(exclusion, Qt::CaseInsensitive))
-            return true;
-    }
-    return false;
+    if (--lane.sync->active > 0)
+        return;
+    const QList<std::function<void()>> waiting = lane.sync->waiting;
+    lane.sync->waiting.clear();
+    for (const std::function<void()> &resume : waiting)
+        QTimer::singleShot(0, app, resume);
 }
 
 // Helper function now accepts a WaveLogger* parameter.
-void processNextFile(const QStringList &selectedFiles,
+// While job N is being tuned, the preparer validates and pre-edits job N+1 so the
+// handover only waits for the rig to be released. Every transition is recorded in the
+// journal so an interrupted batch can be resumed.
+void processNextFile(const QList<TuneJob> &jobs,
                      int index,
                      QCoreApplication *app,
                      QTextStream *out,
-                     const QString &ampModel,
-                     double minPower,
-                     double maxPower,
-                     const QString &critical,
-                     WaveLogger *sharedLogger)
+                     WaveLogger *sharedLogger,
+                     WaveformPreparer *preparer,
+                     BatchJournal *journal,
+                     WaveformDedup *dedup,
+                     AmplifierSerial *amps,
+                     const BatchLane &lane,
+                     int changeoverMs)
 {
-    if (index >= selectedFiles.size()) {
-        *out << "All files processed. Exiting.\n";
-        app->quit();
+    if (index >= jobs.size()) {
+        if (lane.parked && !lane.parked->isEmpty()) {
+            const QList<TuneJob> retry = *lane.parked;
+            lane.parked->clear();
+            BatchLane retryLane = lane;
+            retryLane.retryPass = true;
+            *out << lane.name << "Retrying " << retry.size() << " parked file(s) without a budget.\n";
+            processNextFile(retry, 0, app, out, sharedLogger, preparer, journal, dedup, amps, retryLane, changeoverMs);
+            return;
+        }
+        lane.done();
         return;
     }
 
-    QString file = selectedFiles.at(index);
-    QFileInfo fi(file);
-    QString baseName = fi.fileName();
+    // A config edit staged during the previous file takes effect from here on, but only
+    // once no other lane is mid-tune; until then this lane holds.
+    if (TuneConfig::hasPending()) {
+        if (lane.sync->active > 0) {
+            lane.sync->waiting.append([=]() {
+                processNextFile(jobs, index, app, out, sharedLogger, preparer, journal, dedup, amps, lane, changeoverMs);
+            });
+            return;
+        }
+        if (TuneConfig::applyPending() && sharedLogger)
+            sharedLogger->debugAndLog(QString("Config reloaded (generation %1).").arg(TuneConfig::current()->generation));
+    }
+
+    const TuneJob job = jobs.at(index);
+    const QString file = job.file;
+    auto next = [=](int delayMs) {
+        QTimer::singleShot(delayMs, app, [=]() {
+            processNextFile(jobs, index + 1, app, out, sharedLogger, preparer, journal, dedup, amps, lane, changeoverMs);
+        });
+    };
+
+    // Wait for the preparer if this file was not prefetched (or is still warming up).
+    // The characterization sweep reads the file's own gain first, so it is never pre-edited.
+    if (!preparer->isPrepared(file)) {
+        auto connection = std::make_shared<QMetaObject::Connection>();
+        *connection = QObject::connect(preparer, &WaveformPreparer::prepared, app,
+                                       [=](const PreparedWaveform &waveform) {
+            if (waveform.file != file)
+                return;
+            QObject::disconnect(*connection);
+            processNextFile(jobs, index, app, out, sharedLogger, preparer, journal, dedup, amps, lane, changeoverMs);
+        });
+        preparer->prepare(file, job.ampModel, !job.characterize, job.maxPower);
+        return;
+    }
+    PreparedWaveform prepared = preparer->take(file);
+    QString baseName = prepared.baseName;
 
     // Check if the file should be skipped (based on the Exclusions list).
-    if (isFileExcluded(baseName)) {
+    if (prepared.excluded) {
         // Log the exclusion and immediately process the next file.
         QString logMsg = QString("Waveform %1 cannot be tuned.").arg(baseName);
         if (sharedLogger)
             sharedLogger->debugAndLog(logMsg);
         *out << logMsg << "\n";
-        QTimer::singleShot(3000, app, [=]() {
-            processNextFile(selectedFiles, index + 1, app, out, ampModel, minPower, maxPower, critical, sharedLogger);
-        });
+        journal->markFailed(job, "excluded");
+        if (lane.eta)
+            lane.eta->finished(job, false);
+        next(0);
+        return;
+    }
+    if (!prepared.valid) {
+        QString logMsg = QString("Waveform %1 cannot be tuned: %2").arg(baseName, prepared.problem);
+        if (sharedLogger)
+            sharedLogger->debugAndLog(logMsg);
+        *out << logMsg << "\n";
+        journal->markFailed(job, prepared.problem);
+        if (lane.eta)
+            lane.eta->finished(job, false);
+        next(0);
+        return;
+    }
+
+    *out << lane.name << "Processing file (" << (index + 1) << "/" << jobs.size() << "): " << file << "\n";
+
+    // Prefetch the next file while this one is on the bench.
+    if (index + 1 < jobs.size()) {
+        const TuneJob &nextJob = jobs.at(index + 1);
+        preparer->prepare(nextJob.file, nextJob.ampModel, !nextJob.characterize, nextJob.maxPower);
+    }
+
+    // An equivalent flowgraph was already tuned to the same targets on this rig: take its
+    // gains, or (verifying) start the tune from them.
+    const QMap<int, int> knownGains = dedup ? dedup->result(job) : QMap<int, int>();
+    const QString knownSource = dedup ? QFileInfo(dedup->resultSource(job)).fileName() : QString();
+    const bool trimmed = !knownGains.isEmpty() && dedup->usedTrim(job);
+    if (trimmed && !dedup->verify())
+        *out << lane.name << knownSource << " needed a VVA trim; verifying " << baseName << " instead of copying\n";
+    if (!knownGains.isEmpty() && !dedup->verify() && !trimmed) {
+        PythonEditor editor;
+        QStringList applied;
+        bool ok = true;
+        for (auto it = knownGains.cbegin(); it != knownGains.cend(); ++it) {
+            ok = editor.editGainValue(file, it.value(), it.key()) && ok;
+            applied << QString("ch%1 gain %2").arg(it.key()).arg(it.value());
+        }
+        QString logMsg = ok ? QString("%1 is equivalent to %2; copied %3").arg(baseName, knownSource, applied.join(", "))
+                            : QString("%1 is equivalent to %2 but its gains could not be written").arg(baseName, knownSource);
+        if (sharedLogger)
+            sharedLogger->debugAndLog(logMsg);
+        *out << lane.name << logMsg << "\n";
+        if (ok)
+            journal->markDone(job, "copied from " + knownSource + ": " + applied.join("; "));
+        else
+            journal->markFailed(job, "could not copy gains from " + knownSource);
+        if (lane.eta)
+            lane.eta->finished(job, ok);
+        next(0);
         return;
     }
 
-    *out << "Processing file (" << (index + 1) << "/" << selectedFiles.size() << "): " << file << "\n";
+    // Pass the shared logger to the WaveformTuner. The amp ports stay open across files
+    // so the tuner can skip setup the previous file already did.
+    WaveformTuner *tuner = new WaveformTuner(app, sharedLogger, amps);
+    tuner->setDevices(lane.devices);
+    tuner->setTier(job.tier, job.promoteTo);
 
-    // Pass the shared logger to the WaveformTuner.
-    WaveformTuner *tuner = new WaveformTuner(app, sharedLogger);
+    // A job journaled as running was interrupted; pick up from its last gain.
+    const JournalEntry entry = journal->entry(job);
+    if (!job.characterize && entry.state == "running") {
+        *out << "Resuming " << baseName << " on channel " << entry.channel
+             << " at gain " << entry.gain << "\n";
+        tuner->setResumePoint(entry.channel, entry.gain);
+    }
+    else if (!knownGains.isEmpty()) {
+        // An L1_L2 file verifies channel 0 from the copy; channel 1 starts as usual.
+        const int channel = prepared.isL1L2 ? 0 : prepared.channel;
+        if (knownGains.contains(channel)) {
+            *out << lane.name << "Verifying " << baseName << " from equivalent " << knownSource
+                 << " at gain " << knownGains.value(channel) << "\n";
+            tuner->setResumePoint(channel, knownGains.value(channel));
+        }
+    }
+
+    // Budgets: a file that runs too long (or too many times) is parked and retried at the
+    // end, so one pathological waveform cannot hold up the rest of the batch.
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    const bool budgeted = lane.parked && !lane.retryPass && !job.characterize;
+    const int predictedSeconds = lane.eta ? lane.eta->predictedSeconds(job) : 0;
+    int budgetSeconds = config->budgetFileSeconds;
+    if (budgetSeconds <= 0)
+        budgetSeconds = qMax(config->budgetMinSeconds, qRound(predictedSeconds * config->budgetFactor));
+    const int maxIterations = config->budgetMaxIterations;
+    auto parked = std::make_shared<bool>(false);
+    auto park = [=](const QString &why) {
+        if (*parked)
+            return;
+        *parked = true;
+        tuner->abort(why);
+    };
+    if (budgeted) {
+        QTimer::singleShot(budgetSeconds * 1000, tuner, [=]() {
+            park(QString("time budget of %1 used").arg(BatchPlanner::formatDuration(budgetSeconds)));
+        });
+    }
+    auto runs = std::make_shared<int>(0);
+    if (lane.eta)
+        lane.eta->started(job);
+
+    QObject::connect(tuner, &WaveformTuner::progress, app, [=](int channel, int gain, int iteration) {
+        journal->markRunning(job, channel, gain, iteration);
+        ++*runs;
+        if (lane.eta)
+            lane.eta->addRun(job);
+        if (budgeted && maxIterations > 0 && iteration > maxIterations)
+            park(QString("iteration budget of %1 runs used").arg(maxIterations));
+    });
+
+    // Channel 0 of an L1_L2 file is written before channel 1 starts, so a crash in
+    // between resumes on channel 1 from its initial gain.
+    auto results = std::make_shared<QStringList>();
+    auto gains = std::make_shared<QMap<int, int>>();
+    auto trims = std::make_shared<QMap<int, double>>();
+    QObject::connect(tuner, &WaveformTuner::channelTuned, app,
+                     [=](int channel, int gain, double minPower, double maxPower) {
+        results->append(QString("ch%1 gain %2 (%3 - %4)%5")
+                            .arg(channel).arg(gain).arg(minPower).arg(maxPower)
+                            .arg(tuner->trimLevel() < 100.0
+                                     ? QString(" VVA %1").arg(tuner->trimLevel(), 0, 'f', 1) : QString()));
+        gains->insert(channel, gain);
+        trims->insert(channel, tuner->trimLevel());
+        if (prepared.isL1L2 && channel == 0)
+            journal->markRunning(job, 1, tuner->initialGain(1), 0);
+    });
 
     QObject::connect(tuner, &WaveformTuner::tuningFinished, app, [=]() {
-        *out << "Tuning complete for file: " << file << "\n";
+        *out << lane.name << "Tuning complete for file: " << file << "\n";
+        journal->markDone(job, results->join("; "));
+        if (lane.eta) {
+            lane.eta->finished(job, true);
+            if (!SimulatedRig::isEnabled())
+                TuneDurationStore::record(job, lane.eta->category(job), lane.eta->elapsedSeconds(job),
+                                          lane.eta->runs(job));
+        }
+        if (dedup) {
+            for (auto it = gains->cbegin(); it != gains->cend(); ++it)
+                dedup->recordResult(job, it.key(), it.value(), trims->value(it.key(), 100.0));
+        }
         tuner->deleteLater();
-        QTimer::singleShot(3000, app, [=]() {
-            processNextFile(selectedFiles, index + 1, app, out, ampModel, minPower, maxPower, critical, sharedLogger);
-        });
+        tunerEnded(lane, app);
+        next(changeoverMs);
     });
 
     QObject::connect(tuner, &WaveformTuner::tuningFailed, app, [=](const QString &reason) {
-        *out << "Tuning failed for file: " << file << " Reason: " << reason << "\n";
+        if (*parked) {
+            // The journal keeps the file as running, so the retry resumes from its last gain.
+            QString logMsg = QString("Parked %1 after %2 and %3 run(s): %4; it will be retried at the end.")
+                                 .arg(baseName, BatchPlanner::formatDuration(lane.eta ? lane.eta->elapsedSeconds(job) : 0))
+                                 .arg(*runs).arg(reason);
+            if (sharedLogger)
+                sharedLogger->debugAndLog(logMsg);
+            *out << lane.name << logMsg << "\n";
+            lane.parked->append(job);
+            if (lane.eta)
+                lane.eta->parked(job);
+            tuner->deleteLater();
+            tunerEnded(lane, app);
+            next(changeoverMs);
+            return;
+        }
+        *out << lane.name << "Tuning failed for file: " << file << " Reason: " << reason << "\n";
+        journal->markFailed(job, reason);
+        if (lane.eta)
+            lane.eta->finished(job, false);
         tuner->deleteLater();
-        QTimer::singleShot(3000, app, [=]() {
-            processNextFile(selectedFiles, index + 1, app, out, ampModel, minPower, maxPower, critical, sharedLogger);
-        });
+        tunerEnded(lane, app);
+        next(changeoverMs);
     });
 
-    tuner->startTuning(file, ampModel, minPower, maxPower, critical);
+    ++lane.sync->active;
+    if (job.characterize)
+        tuner->startCharacterization(file, job.ampModel);
+    else
+        tuner->startTuning(prepared, job.ampModel, job.minPower, job.maxPower, job.critical);
+}
+
+// Validates every job's file in parallel before any amp is touched and returns the
+// jobs that can run.
+QList<TuneJob> validateJobs(const QList<TuneJob> &jobs, QTextStream &cout, WaveLogger *sharedLogger,
+                            WaveformDedup *dedup)
+{
+    cout << "Validating " << jobs.size() << " files...\n" << Qt::flush;
+    WaveformManifest manifest = WaveformScanner::scan(jobs);
+    QList<TuneJob> valid;
+    int excluded = 0;
+    int problems = 0;
+    for (int i = 0; i < manifest.entries.size(); ++i) {
+        const PreparedWaveform &w = manifest.entries.at(i);
+        if (w.valid) {
+            valid.append(jobs.at(i));
+            if (dedup)
+                dedup->add(jobs.at(i), w);
+        } else if (w.excluded) {
+            sharedLogger->debugAndLog(QString("Waveform %1 cannot be tuned.").arg(w.baseName));
+            ++excluded;
+        } else {
+            QString logMsg = QString("Waveform %1 cannot be tuned: %2").arg(w.baseName, w.problem);
+            sharedLogger->logToFile(logMsg);
+            cout << logMsg << "\n";
+            ++problems;
+        }
+    }
+    cout << valid.size() << " files ready, " << excluded << " excluded, "
+         << problems << " with problems.\n";
+    if (dedup && dedup->duplicateCount() > 0)
+        cout << dedup->duplicateCount() << " file(s) are equivalent to another in the batch; "
+             << dedup->classCount() << " distinct flowgraph/target combinations will be tuned"
+             << (dedup->verify() ? " and the duplicates verified from their results" : "") << ".\n";
+    return valid;
+}
+
+// Answers the requested targets from stored characterization curves, without hardware.
+// Returns the number of files that could not be derived.
+int deriveFromCurves(const QStringList &selectedFiles,
+                     QTextStream &cin,
+                     QTextStream &cout,
+                     const QString &ampModel,
+                     double minPower,
+                     double maxPower,
+                     const QString &critical,
+                     WaveLogger *sharedLogger)
+{
+    struct Derived {
+        QString file;
+        int channel;
+        int gain;
+    };
+    QList<Derived> derived;
+    int failures = 0;
+
+    for (const QString &file : selectedFiles) {
+        QString baseName = QFileInfo(file).fileName();
+        if (WaveformPreparer::isFileExcluded(baseName))
+            continue;
+        QList<int> channels;
+        if (baseName.startsWith("L1_L2_"))
+            channels << 0 << 1;
+        else if (baseName.startsWith("L2_"))
+            channels << WaveformTuner::extractChannelFromFile(file);
+        else
+            channels << 0;
+
+        for (int channel : channels) {
+            QString channelString = (channel == 0 ? "L1" : "L2");
+            GainCurve curve;
+            if (!GainCurveStore::load(baseName, ampModel, channel, &curve)) {
+                cout << baseName << " ch " << channelString << ": no stored curve for " << ampModel << "\n";
+                ++failures;
+                continue;
+            }
+            GainDerivation d = GainCurveStore::derive(curve, minPower, maxPower, critical);
+            if (!d.ok) {
+                cout << baseName << " ch " << channelString << ": " << d.reason << "\n";
+                ++failures;
+                continue;
+            }
+            QString msg = QString("%1 ch %2 derived SDR gain %3 dBm (predicted min %4 dBm, max %5 dBm)")
+                              .arg(baseName, channelString)
+                              .arg(d.gain)
+                              .arg(d.predictedMin, 0, 'f', 1)
+                              .arg(d.predictedMax, 0, 'f', 1);
+            if (!d.reason.isEmpty())
+                msg += " - " + d.reason;
+            cout << msg << "\n";
+            if (sharedLogger)
+                sharedLogger->logToFile(msg);
+            derived.append({file, channel, d.gain});
+        }
+    }
+
+    if (derived.isEmpty())
+        return failures;
+
+    cout << "Write the derived gains into the waveform files? (y/n) " << Qt::flush;
+    if (cin.readLine().trimmed().compare("y", Qt::CaseInsensitive) != 0)
+        return failures;
+
+    PythonEditor editor;
+    for (const Derived &d : derived) {
+        if (!editor.editGainValue(d.file, d.gain, d.channel)) {
+            cout << "Failed to write gain to " << d.file << "\n";
+            ++failures;
+        }
+    }
+    return failures;
+}
+
+// Opens the batch journal, drops jobs an interrupted run already finished and starts
+// processing the rest.
+void runBatch(QList<TuneJob> jobs,
+              QCoreApplication *app,
+              QTextStream *out,
+              WaveLogger *sharedLogger,
+              WaveformPreparer *preparer,
+              WaveformDedup *dedup,
+              int changeoverMs)
+{
+    BatchJournal *journal = new BatchJournal(BatchJournal::defaultPath(), app);
+    if (!journal->open())
+        *out << "Warning: batch journal unavailable; this batch cannot be resumed.\n";
+
+    // A file that failed gets [Batch] ResumeRetries more batches before it is left alone;
+    // excluded files are skipped for good.
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    const int resumeRetries = config->resumeRetries;
+
+    int finished = 0;
+    int resumed = 0;
+    int retried = 0;
+    for (int i = jobs.size() - 1; i >= 0; --i) {
+        const JournalEntry entry = journal->entry(jobs.at(i));
+        if (entry.state == "failed" && entry.detail != "excluded" && entry.failures <= resumeRetries) {
+            journal->markPending(jobs.at(i));
+            ++retried;
+        } else if (entry.state == "done" || entry.state == "failed") {
+            jobs.removeAt(i);
+            ++finished;
+        } else if (entry.state == "running") {
+            ++resumed;
+        }
+    }
+    if (finished > 0 || resumed > 0 || retried > 0) {
+        QString logMsg = QString("Resuming interrupted batch: %1 file(s) already processed, %2 in progress, %3 failed file(s) retried.")
+                             .arg(finished).arg(resumed).arg(retried);
+        if (sharedLogger)
+            sharedLogger->debugAndLog(logMsg);
+        *out << logMsg << "\n";
+    }
+
+    for (const TuneJob &job : qAsConst(jobs)) {
+        if (!journal->contains(job))
+            journal->markPending(job);
+    }
+
+    // Group the batch so consecutive files share amp setup.
+    const BatchPlan plan = BatchPlanner::plan(jobs);
+    QString planMsg = QString("Batch plan: %1 file(s), %2 amp setup(s), %3 reused; estimated duration %4.")
+                          .arg(plan.jobs.size()).arg(plan.setupGroups).arg(plan.setupsSkipped)
+                          .arg(BatchPlanner::formatDuration(plan.estimatedSeconds));
+    if (sharedLogger)
+        sharedLogger->debugAndLog(planMsg);
+    *out << planMsg << "\n";
+
+    // Live ETA against the predicted durations.
+    BatchEta *eta = new BatchEta(out, sharedLogger, app);
+    for (int i = 0; i < plan.jobs.size(); ++i)
+        eta->addJob(plan.jobs.at(i), plan.jobSeconds.at(i), plan.categories.at(i));
+
+    AmplifierSerial *amps = new AmplifierSerial(app);
+    auto finish = [=]() {
+        const QString stragglers = eta->summary();
+        if (!stragglers.isEmpty()) {
+            if (sharedLogger)
+                sharedLogger->debugAndLog(stragglers);
+            *out << stragglers << "\n";
+        }
+        if (!amps->linkStats().isEmpty()) {
+            const QString linkSummary = amps->linkStats().summary();
+            if (sharedLogger)
+                sharedLogger->debugAndLog(linkSummary);
+            *out << linkSummary << "\n";
+        }
+        *out << "All files processed. Exiting.\n";
+        journal->clear();
+        amps->disconnectAll();
+        app->quit();
+    };
+
+    // With two amps, single-channel files for each amp can run side by side.
+    QList<TuneJob> shared, lane0Jobs, lane1Jobs;
+    QString reason;
+    bool concurrent = false;
+    if (config->concurrentEnabled) {
+        amps->searchAndConnect();
+        const QStringList devices = amps->connectedDevices();
+        if (devices.size() < 2)
+            reason = "fewer than two amps connected";
+        else
+            concurrent = BatchPlanner::splitLanes(plan.jobs, &shared, &lane0Jobs, &lane1Jobs, &reason);
+        if (!concurrent) {
+            *out << "Running files one at a time: " << reason << ".\n";
+        } else {
+            const QString dev0 = WaveformTuner::deviceForChannel(devices, 0);
+            const QString dev1 = WaveformTuner::deviceForChannel(devices, 1);
+            if (dev0 == dev1) {
+                concurrent = false;
+                *out << "Running files one at a time: cannot tell the L1 and L2 amps apart.\n";
+            } else {
+                *out << "Running " << lane0Jobs.size() << " L1 file(s) on " << dev0 << " alongside "
+                     << lane1Jobs.size() << " L2 file(s) on " << dev1 << ".\n";
+                // Files that need both amps run first, then the two lanes together.
+                auto remaining = std::make_shared<int>(2);
+                auto laneDone = [=]() {
+                    if (--*remaining == 0)
+                        finish();
+                };
+                BatchLane lane0{"[L1] ", QStringList() << dev0, laneDone, eta, std::make_shared<QList<TuneJob>>()};
+                BatchLane lane1{"[L2] ", QStringList() << dev1, laneDone, eta, std::make_shared<QList<TuneJob>>()};
+                lane1.sync = lane0.sync;
+                BatchLane both{QString(), QStringList(), [=]() {
+                    eta->setLanes(2);
+                    processNextFile(lane0Jobs, 0, app, out, sharedLogger, preparer, journal, dedup, amps, lane0, changeoverMs);
+                    processNextFile(lane1Jobs, 0, app, out, sharedLogger, preparer, journal, dedup, amps, lane1, changeoverMs);
+                }, eta, std::make_shared<QList<TuneJob>>()};
+                processNextFile(shared, 0, app, out, sharedLogger, preparer, journal, dedup, amps, both, changeoverMs);
+                return;
+            }
+        }
+    }
+
+    BatchLane lane{QString(), QStringList(), finish, eta, std::make_shared<QList<TuneJob>>()};
+    processNextFile(plan.jobs, 0, app, out, sharedLogger, preparer, journal, dedup, amps, lane, changeoverMs);
 }
 
 int main(int argc, char *argv[])
@@ -91,6 +559,145 @@ int main(int argc, char *argv[])
     QTextStream cin(stdin);
     QTextStream cout(stdout);
 
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Tunes GNU Radio waveform gains against amplifier power targets.");
+    parser.addHelpOption();
+    QCommandLineOption jobOption(QStringList() << "j" << "job",
+                                 "Run headless from a job file (INI). May be given more than once; "
+                                 "job files run back to back.",
+                                 "file");
+    parser.addOption(jobOption);
+    QCommandLineOption daemonOption("daemon", "Run as a resident tuning daemon that accepts jobs on a local socket.");
+    parser.addOption(daemonOption);
+    QCommandLineOption clientOption("client", "Send a command to a running daemon: status, watch, cancel <id>, "
+                                              "submit-job <job.ini>, submit <file> <model> <min> <max> <critical>, "
+                                              "characterize <file> <model>.");
+    parser.addOption(clientOption);
+    QCommandLineOption calibrateOption("calibrate", "Measure settle times on the connected amps with a waveform "
+                                                    "and store them as settle profiles.",
+                                       "file");
+    parser.addOption(calibrateOption);
+    QCommandLineOption sdrOption("sdr", "SDR model for --calibrate (x300 or N321).", "model", "x300");
+    parser.addOption(sdrOption);
+    QCommandLineOption coordinatorOption("coordinator", "Hand the --job files out to worker hosts over TCP "
+                                                        "instead of tuning them here.");
+    parser.addOption(coordinatorOption);
+    QCommandLineOption workerOption("worker", "Tune jobs from a coordinator on the local rig.", "host[:port]");
+    parser.addOption(workerOption);
+    QCommandLineOption simulateOption("simulate", "Use simulated amps and flowgraphs instead of the bench hardware.");
+    parser.addOption(simulateOption);
+    QCommandLineOption soakOption("soak", "Tune the --job files round and round on the simulated rig for the given "
+                                          "number of tunes and fail if memory, fds, objects or child processes "
+                                          "keep growing.",
+                                  "tunes");
+    parser.addOption(soakOption);
+    parser.addPositionalArgument("command", "Client command and its arguments (with --client).");
+    parser.process(app);
+
+    if (parser.isSet(clientOption))
+        return TuningDaemon::runClient(parser.positionalArguments(), cout);
+
+    // Soak always runs on the simulated rig.
+    if (parser.isSet(simulateOption) || parser.isSet(soakOption))
+        SimulatedRig::setEnabled(true);
+
+    // Config edits are validated as they are saved and applied between files.
+    new TuneConfigWatcher(&app);
+
+    if (parser.isSet(workerOption)) {
+        const QStringList address = parser.value(workerOption).split(':');
+        const quint16 port = address.size() > 1 ? quint16(address.at(1).toUInt()) : TuneCoordinator::port();
+        TuneWorker *worker = new TuneWorker(address.at(0), port, &app);
+        QObject::connect(worker, &TuneWorker::finished, &app, [&](bool ok) { app.exit(ok ? 0 : 1); });
+        QTimer::singleShot(0, worker, &TuneWorker::start);
+        return app.exec();
+    }
+
+    if (parser.isSet(calibrateOption)) {
+        const QString sdrModel = parser.value(sdrOption);
+        if (!JobManifest::isValidAmpModel(sdrModel)) {
+            cout << "Invalid SDR model. Exiting.\n";
+            return -1;
+        }
+        SettleCalibrator *calibrator = new SettleCalibrator(parser.value(calibrateOption), sdrModel, &app);
+        QObject::connect(calibrator, &SettleCalibrator::finished, &app, [&](bool ok, const QString &report) {
+            cout << report << "\n";
+            cout << (ok ? "Settle profiles saved to " + SettleProfileStore::storePath()
+                        : QString("Calibration failed.")) << "\n" << Qt::flush;
+            app.exit(ok ? 0 : 1);
+        });
+        QTimer::singleShot(0, calibrator, &SettleCalibrator::start);
+        return app.exec();
+    }
+
+    if (parser.isSet(daemonOption)) {
+        TuningDaemon daemon;
+        if (!daemon.listen())
+            return -1;
+        return app.exec();
+    }
+
+    // Pause between files once the previous tuner has released the rig.
+    int changeoverMs = TuneConfig::current()->changeoverMs;
+
+    if (parser.isSet(jobOption)) {
+        QList<TuneJob> jobs;
+        QStringList errors;
+        const QStringList jobFiles = parser.values(jobOption);
+        for (const QString &jobFile : jobFiles)
+            JobManifest::load(jobFile, &jobs, &errors);
+        if (!errors.isEmpty()) {
+            for (const QString &error : qAsConst(errors))
+                cout << error << "\n";
+            cout << "Job file errors. Exiting.\n";
+            return -1;
+        }
+
+        if (SimulatedRig::isEnabled()) {
+            // Simulated runs tune copies, so the bench's flowgraphs keep their gains.
+            for (TuneJob &job : jobs) {
+                const QString copy = SimulatedRig::instance().sandboxCopy(job.file);
+                if (copy.isEmpty()) {
+                    cout << "Cannot copy " << job.file << " for simulation. Exiting.\n";
+                    return -1;
+                }
+                job.file = copy;
+            }
+            cout << "Simulating on copies in " << SimulatedRig::instance().sandboxPath("flowgraphs") << "\n";
+        }
+
+        WaveLogger *sharedLogger = new WaveLogger(&app);
+        WaveformDedup *dedup = new WaveformDedup(&app);
+        jobs = validateJobs(jobs, cout, sharedLogger, dedup);
+        if (jobs.isEmpty()) {
+            cout << "Nothing to do. Exiting.\n";
+            return -1;
+        }
+        if (parser.isSet(soakOption)) {
+            SoakRunner *soak = new SoakRunner(jobs, qMax(1, parser.value(soakOption).toInt()), &app);
+            QObject::connect(soak, &SoakRunner::finished, &app, [&](bool ok, const QString &report) {
+                cout << report << "\n" << Qt::flush;
+                app.exit(ok ? 0 : 1);
+            });
+            QTimer::singleShot(0, soak, &SoakRunner::start);
+            return app.exec();
+        }
+        if (parser.isSet(coordinatorOption)) {
+            const BatchPlan plan = BatchPlanner::plan(jobs);
+            TuneCoordinator *coordinator = new TuneCoordinator(plan.jobs, &app);
+            QObject::connect(coordinator, &TuneCoordinator::finished, &app, [&](int failures) {
+                cout << QString("Distributed batch complete, %1 job(s) failed.").arg(failures) << "\n" << Qt::flush;
+                app.exit(failures == 0 ? 0 : 1);
+            });
+            if (!coordinator->listen())
+                return -1;
+            return app.exec();
+        }
+        WaveformPreparer *preparer = new WaveformPreparer(&app);
+        runBatch(jobs, &app, &cout, sharedLogger, preparer, dedup, changeoverMs);
+        return app.exec();
+    }
+
     // Prompt for the directory containing waveform files.
     cout << "Enter the directory containing waveform files: " << Qt::flush;
     QString directory = cin.readLine().trimmed();
@@ -147,6 +754,14 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    // Prompt for what to do with the selected files.
+    cout << "Enter T to tune, C to characterize the gain range, or D to derive gains from stored curves: " << Qt::flush;
+    QString modeChoice = cin.readLine().trimmed().toUpper();
+    if (modeChoice != "T" && modeChoice != "C" && modeChoice != "D") {
+        cout << "Invalid mode. Exiting.\n";
+        return -1;
+    }
+
     // Prompt for amplifier model.
     cout << "Are you tuning for an x300 or N321? " << Qt::flush;
     QString ampModel = cin.readLine().trimmed();
@@ -156,6 +771,34 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    WaveformPreparer *preparer = new WaveformPreparer(&app);
+
+    // Create a single shared WaveLogger instance.
+    WaveLogger *sharedLogger = new WaveLogger(&app);
+
+    // Every selected file gets the same targets in interactive mode.
+    QList<TuneJob> jobs;
+    for (const QString &file : qAsConst(selectedFiles)) {
+        TuneJob job;
+        job.file = file;
+        job.ampModel = ampModel;
+        job.characterize = (modeChoice == "C");
+        jobs.append(job);
+    }
+
+    if (modeChoice == "C") {
+        // The sweep takes its range and levels from [Characterize] in waveTuneConfig.ini.
+        // Validate the whole batch in parallel before any amp is touched.
+        WaveformDedup *dedup = new WaveformDedup(&app);
+        jobs = validateJobs(jobs, cout, sharedLogger, dedup);
+        if (jobs.isEmpty()) {
+            cout << "Nothing to do. Exiting.\n";
+            return -1;
+        }
+        runBatch(jobs, &app, &cout, sharedLogger, preparer, dedup, changeoverMs);
+        return app.exec();
+    }
+
     // Prompt for minimum power.
     cout << "Enter the target minimum power: " << Qt::flush;
     QString minPowerStr = cin.readLine().trimmed();
@@ -184,10 +827,25 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    // Create a single shared WaveLogger instance.
-    WaveLogger *sharedLogger = new WaveLogger(&app);
+    if (modeChoice == "D") {
+        int failures = deriveFromCurves(selectedFiles, cin, cout, ampModel, minPower, maxPower, critical, sharedLogger);
+        return failures == 0 ? 0 : 1;
+    }
+
+    for (TuneJob &job : jobs) {
+        job.minPower = minPower;
+        job.maxPower = maxPower;
+        job.critical = critical;
+    }
+    // Validate the whole batch in parallel before any amp is touched.
+    WaveformDedup *dedup = new WaveformDedup(&app);
+    jobs = validateJobs(jobs, cout, sharedLogger, dedup);
+    if (jobs.isEmpty()) {
+        cout << "Nothing to do. Exiting.\n";
+        return -1;
+    }
 
     // Process each selected file sequentially, passing the shared logger.
-    processNextFile(selectedFiles, 0, &app, &cout, ampModel, minPower, maxPower, critical, sharedLogger);
+    runBatch(jobs, &app, &cout, sharedLogger, preparer, dedup, changeoverMs);
     return app.exec();
 }
@@ -1,50 +1,22 @@
 #include "pythoneditor.h"
+#include "tuneconfig.h"
+#include "simulatedrig.h"
 #include <QFile>
-#include <QTextStream>
 #include <QRegularExpression>
 #include <QDebug>
 #include <limits.h>
-#include <QCoreApplication>
-#include <QSettings>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <unistd.h>
 
 PythonEditor::PythonEditor(QObject *parent)
-    : QObject(parent)
+    : QObject(parent),
+    m_sandboxOnly(SimulatedRig::isEnabled())
 {
 }
 
-bool PythonEditor::editGainValue(const QString &filePath, int newGain, int targetChannel)
+int PythonEditor::findGainLine(const QStringList &lines, int targetChannel, const QString &filePath) const
 {
-    // Read the allowed gain range from waveTuneConfig.ini.
-    // The .ini file is assumed to be in the same directory as the application.
-    QString configFile = QCoreApplication::applicationDirPath() + "/waveTuneConfig.ini";
-    QSettings settings(configFile, QSettings::IniFormat);
-    int minGain = settings.value("Gain/Min", -10).toInt();
-    int maxGain = settings.value("Gain/Max", 60).toInt();
-
-    // Validate channel.
-    if (targetChannel != 0 && targetChannel != 1) {
-        qWarning() << "Invalid channel specified:" << targetChannel;
-        return false;
-    }
-    // Validate gain using values from config file.
-    if ((newGain < minGain) || (newGain > maxGain)) {
-        qWarning() << "Gain value out of allowed range:" << newGain
-                   << "(Allowed range:" << minGain << "to" << maxGain << ")";
-        return false;
-    }
-
-    // Read all lines from file.
-    QFile fileObj(filePath);
-    if (!fileObj.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        qWarning() << "Cannot open file for reading:" << filePath;
-        return false;
-    }
-    QStringList lines;
-    QTextStream in(&fileObj);
-    while (!in.atEnd())
-        lines.append(in.readLine());
-    fileObj.close();
-
     // Regular expression to capture:
     //   Group 1: SDR instance name (between "self." and ".set_gain")
     //   Group 2: the gain value (first argument)
@@ -81,7 +53,7 @@ bool PythonEditor::editGainValue(const QString &filePath, int newGain, int targe
     }
     if (candidates.isEmpty()) {
         qWarning() << "No .set_gain lines found in" << filePath;
-        return false;
+        return -1;
     }
 
     Candidate chosen;
@@ -156,26 +128,193 @@ bool PythonEditor::editGainValue(const QString &filePath, int newGain, int targe
 
     if (!candidateChosen) {
         qWarning() << "Failed to determine which .set_gain line to update.";
+        return -1;
+    }
+    return chosen.lineIndex;
+
+}
+
+bool PythonEditor::loadModel(const QString &filePath)
+{
+    QFileInfo info(filePath);
+    auto cached = m_models.constFind(filePath);
+    if (cached != m_models.constEnd() && info.exists() &&
+        cached->modified == info.lastModified() && cached->size == info.size())
+        return true;
+
+    QFile fileObj(filePath);
+    if (!fileObj.open(QIODevice::ReadOnly)) {
+        qWarning() << "Cannot open file for reading:" << filePath;
+        m_models.remove(filePath);
         return false;
     }
+    FileModel model;
+    model.content = fileObj.readAll();
+    fileObj.close();
+    model.modified = info.lastModified();
+    model.size = info.size();
+
+    // Split into lines, remembering where each one starts in the raw bytes.
+    QStringList lines;
+    QList<qint64> lineOffsets;
+    qint64 pos = 0;
+    while (pos <= model.content.size()) {
+        qint64 end = model.content.indexOf('\n', pos);
+        if (end < 0)
+            end = model.content.size();
+        QByteArray raw = model.content.mid(pos, end - pos);
+        if (raw.endsWith('\r'))
+            raw.chop(1);
+        lines.append(QString::fromUtf8(raw));
+        lineOffsets.append(pos);
+        pos = end + 1;
+    }
+
+    // Resolve each channel's call site once, with the same selection rules as before.
+    static const QRegularExpression gainRe("\\.set_gain\\(\\s*([-+]?\\d+)\\s*,");
+    for (int channel = 0; channel <= 1; ++channel) {
+        int lineIndex = findGainLine(lines, channel, filePath);
+        if (lineIndex < 0)
+            continue;
+        QRegularExpressionMatch match = gainRe.match(lines[lineIndex]);
+        if (!match.hasMatch())
+            continue;
+        const QString &line = lines[lineIndex];
+        GainSite site;
+        site.offset = lineOffsets[lineIndex] + line.left(match.capturedStart(1)).toUtf8().size();
+        site.length = match.captured(1).toUtf8().size();
+        site.value = match.captured(1).toInt();
+        model.sites.insert(channel, site);
+    }
+    m_models.insert(filePath, model);
+    return true;
+}
 
-    // Update the chosen candidate's line by replacing the gain value.
-    int lineToUpdate = chosen.lineIndex;
-    // Regex to capture the portion before the gain value and after, so that we only replace the gain.
-    QRegularExpression gainRe("(.set_gain\\(\\s*)[-+]?\\d+(\\s*,\\s*\\d+\\s*\\))");
-    QString newLine = lines[lineToUpdate];
-    newLine.replace(gainRe, QString("\\1%1\\2").arg(newGain));
-    lines[lineToUpdate] = newLine;
+bool PythonEditor::gainSite(const QString &filePath, int channel, GainSite *site)
+{
+    if (!loadModel(filePath))
+        return false;
+    const FileModel &model = m_models[filePath];
+    if (!model.sites.contains(channel))
+        return false;
+    if (site)
+        *site = model.sites.value(channel);
+    return true;
+}
 
-    // Write the updated content back to the file.
-    if (!fileObj.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate)) {
+bool PythonEditor::readGainValue(const QString &filePath, int targetChannel, int *gain)
+{
+    if (targetChannel != 0 && targetChannel != 1) {
+        qWarning() << "Invalid channel specified:" << targetChannel;
+        return false;
+    }
+    GainSite site;
+    if (!gainSite(filePath, targetChannel, &site))
+        return false;
+    if (gain)
+        *gain = site.value;
+    return true;
+}
+
+void PythonEditor::setConfig(std::shared_ptr<const TuneConfig> config)
+{
+    m_config = config;
+}
+
+bool PythonEditor::editGainValue(const QString &filePath, int newGain, int targetChannel)
+{
+    // The allowed gain range comes from the owner's snapshot, or the current one.
+    const std::shared_ptr<const TuneConfig> config = m_config ? m_config : TuneConfig::current();
+
+    // Validate channel.
+    if (targetChannel != 0 && targetChannel != 1) {
+        qWarning() << "Invalid channel specified:" << targetChannel;
+        return false;
+    }
+    // Validate gain using values from config file.
+    if ((newGain < config->gainMin) || (newGain > config->gainMax)) {
+        qWarning() << "Gain value out of allowed range:" << newGain
+                   << "(Allowed range:" << config->gainMin << "to" << config->gainMax << ")";
+        return false;
+    }
+
+    if (m_sandboxOnly && !SimulatedRig::instance().isSandboxed(filePath)) {
+        qWarning() << "Simulated runs tune sandbox copies; refusing to edit" << filePath;
+        return false;
+    }
+
+    GainSite site;
+    if (!gainSite(filePath, targetChannel, &site)) {
+        qWarning() << "Failed to determine which .set_gain line to update in" << filePath;
+        return false;
+    }
+
+    // A rewrite within the same second that keeps the size slips past the cache check,
+    // so compare the bytes on disk before patching them.
+    QFile current(filePath);
+    if (!current.open(QIODevice::ReadOnly)) {
+        qWarning() << "Cannot open file for reading:" << filePath;
+        return false;
+    }
+    const QByteArray onDisk = current.readAll();
+    current.close();
+    if (onDisk != m_models[filePath].content) {
+        qDebug() << filePath << "changed on disk since it was parsed; parsing it again.";
+        m_models.remove(filePath);
+        if (!gainSite(filePath, targetChannel, &site)) {
+            qWarning() << "Failed to determine which .set_gain line to update in" << filePath;
+            return false;
+        }
+    }
+    if (site.value == newGain)
+        return true;
+
+    // Patch only the gain literal; every other byte of the file is left as it was.
+    FileModel &model = m_models[filePath];
+    bool literalOk = false;
+    if (model.content.mid(site.offset, site.length).toInt(&literalOk) != site.value || !literalOk) {
+        qWarning() << "Gain literal for channel" << targetChannel << "is not where it was parsed in" << filePath;
+        m_models.remove(filePath);
+        return false;
+    }
+    QByteArray literal = QByteArray::number(newGain);
+    QByteArray content = model.content;
+    content.replace(site.offset, site.length, literal);
+
+    // Write to a temporary file in the same directory, sync it, then rename it over the
+    // original, so a crash never leaves a half-written waveform behind.
+    QSaveFile fileObj(filePath);
+    if (!fileObj.open(QIODevice::WriteOnly)) {
         qWarning() << "Cannot open file for writing:" << filePath;
         return false;
     }
-    QTextStream out(&fileObj);
-    for (const QString &line : lines)
-        out << line << "\n";
-    fileObj.close();
+    if (fileObj.write(content) != content.size() || !fileObj.flush() ||
+        ::fsync(fileObj.handle()) != 0) {
+        qWarning() << "Failed to write" << filePath << ":" << fileObj.errorString();
+        fileObj.cancelWriting();
+        fileObj.commit();
+        return false;
+    }
+    if (!fileObj.commit()) {
+        qWarning() << "Failed to replace" << filePath << ":" << fileObj.errorString();
+        return false;
+    }
 
+    // Keep the model in step with the file on disk.
+    qint64 shift = literal.size() - site.length;
+    for (GainSite &other : model.sites) {
+        if (other.offset > site.offset)
+            other.offset += shift;
+    }
+    for (GainSite &other : model.sites) {
+        if (other.offset == site.offset) {
+            other.length = literal.size();
+            other.value = newGain;
+        }
+    }
+    model.content = content;
+    QFileInfo info(filePath);
+    model.modified = info.lastModified();
+    model.size = info.size();
     return true;
 }
@@ -2,6 +2,21 @@
 #define PYTHONEDITOR_H
 
 #include <QObject>
+#include <QStringList>
+#include <QByteArray>
+#include <QDateTime>
+#include <QHash>
+#include <QMap>
+#include <memory>
+
+struct TuneConfig;
+
+// Location of a set_gain call's gain literal within a waveform file.
+struct GainSite {
+    qint64 offset = 0; // Byte offset of the gain literal
+    qint64 length = 0; // Byte length of the gain literal
+    int value = 0;
+};
 
 class PythonEditor : public QObject
 {
@@ -9,10 +24,31 @@ class PythonEditor : public QObject
 public:
     explicit PythonEditor(QObject *parent = nullptr);
 
+    // Edits are checked against config instead of the current snapshot, so a tuner's
+    // edits follow the configuration it started with.
+    void setConfig(std::shared_ptr<const TuneConfig> config);
+
+    // Files are parsed once and cached; a file changed on disk is re-parsed on next use.
     bool editGainValue(const QString &filePath, int newGain, int channel = -1);
+    bool readGainValue(const QString &filePath, int channel, int *gain);
+    bool gainSite(const QString &filePath, int channel, GainSite *site);
 
 signals:
 
+private:
+    struct FileModel {
+        QByteArray content;
+        QDateTime modified;
+        qint64 size = 0;
+        QMap<int, GainSite> sites; // Channel -> resolved set_gain call site
+    };
+
+    bool loadModel(const QString &filePath);
+    int findGainLine(const QStringList &lines, int targetChannel, const QString &filePath) const;
+
+    QHash<QString, FileModel> m_models;
+    std::shared_ptr<const TuneConfig> m_config;
+    bool m_sandboxOnly;         // Simulated run: only sandbox copies may be edited
 };
 
 #endif // PYTHONEDITOR_H
@@ -1,10 +1,37 @@
 #include "pythonrunner.h"
 #include <QDebug>
 #include <QDateTime>
+#include <QProcessEnvironment>
+#include <QFile>
+#include <QRegularExpression>
+#include <QTimer>
+#include "simulatedrig.h"
+#include "tuneconfig.h"
+#include <algorithm>
 
-PythonRunner::PythonRunner(const QString &scriptPath, QObject *parent)
+// Reads the flowgraph, replaces the gain literals listed in WAVETUNE_GAIN_PATCHES
+// ("offset:length:value;..." in bytes) and runs it as __main__.
+static const char *kGainInjectScript =
+    "import os, sys\n"
+    "path = sys.argv[1]\n"
+    "with open(path, 'rb') as f:\n"
+    "    src = f.read()\n"
+    "patches = []\n"
+    "for item in os.environ.get('WAVETUNE_GAIN_PATCHES', '').split(';'):\n"
+    "    if item:\n"
+    "        off, length, value = item.split(':')\n"
+    "        patches.append((int(off), int(length), value.encode()))\n"
+    "for off, length, value in sorted(patches, reverse=True):\n"
+    "    src = src[:off] + value + src[off + length:]\n"
+    "sys.argv = sys.argv[1:]\n"
+    "sys.path.insert(0, os.path.dirname(os.path.abspath(path)))\n"
+    "g = {'__name__': '__main__', '__file__': path, '__builtins__': __builtins__}\n"
+    "exec(compile(src, path, 'exec'), g)\n";
+
+PythonRunner::PythonRunner(const QString &scriptPath, std::shared_ptr<const TuneConfig> config, QObject *parent)
     : QObject(parent),
     m_scriptPath(scriptPath),
+    m_config(config),
     m_process(nullptr)
 {
 }
@@ -27,10 +54,31 @@ void PythonRunner::createProcess()
             this, &PythonRunner::handleFinished);
 }
 
+void PythonRunner::setGainOverrides(const QList<GainSite> &overrides)
+{
+    m_gainOverrides = overrides;
+}
+
 void PythonRunner::startScript()
 {
+    if (SimulatedRig::isEnabled()) {
+        startSimulated();
+        return;
+    }
     createProcess();
-    m_process->start(m_scriptPath, QStringList(), QIODevice::ReadWrite);
+    if (m_gainOverrides.isEmpty()) {
+        m_process->start(m_scriptPath, QStringList(), QIODevice::ReadWrite);
+    } else {
+        QStringList patches;
+        for (const GainSite &site : qAsConst(m_gainOverrides))
+            patches << QString("%1:%2:%3").arg(site.offset).arg(site.length).arg(site.value);
+        QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+        env.insert("WAVETUNE_GAIN_PATCHES", patches.join(';'));
+        m_process->setProcessEnvironment(env);
+
+        m_process->start(m_config->pythonInterpreter, QStringList() << "-c" << kGainInjectScript << m_scriptPath,
+                         QIODevice::ReadWrite);
+    }
     if (!m_process->waitForStarted(3000)) {
         qWarning() << "Failed to start python script:" << m_scriptPath;
     } else {
@@ -38,8 +86,66 @@ void PythonRunner::startScript()
     }
 }
 
+void PythonRunner::startSimulated()
+{
+    // Transmit on every channel the flowgraph sets a gain for, at that gain (with the
+    // launch overrides applied), then print the flowgraph's prompt.
+    QFile file(m_scriptPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed to start python script:" << m_scriptPath;
+        return;
+    }
+    QByteArray src = file.readAll();
+    QList<GainSite> patches = m_gainOverrides;
+    std::sort(patches.begin(), patches.end(),
+              [](const GainSite &a, const GainSite &b) { return a.offset > b.offset; });
+    for (const GainSite &site : qAsConst(patches))
+        src.replace(site.offset, site.length, QByteArray::number(site.value));
+
+    m_simChannels.clear();
+    static const QRegularExpression rx("\\.set_gain\\s*\\(\\s*([-+]?\\d+)\\s*(?:,\\s*([01]))?\\s*\\)");
+    QRegularExpressionMatchIterator it = rx.globalMatch(QString::fromUtf8(src));
+    while (it.hasNext()) {
+        QRegularExpressionMatch match = it.next();
+        int channel = match.captured(2).isEmpty() ? 0 : match.captured(2).toInt();
+        if (m_simChannels.contains(channel))
+            continue;
+        m_simChannels << channel;
+        SimulatedRig::instance().setTransmitting(channel, match.captured(1).toInt());
+    }
+
+    // A stand-in child process, so soak runs exercise the QProcess lifecycle as well.
+    const QString stub = SimulatedRig::instance().stubProcess();
+    if (!stub.isEmpty()) {
+        QStringList args = QProcess::splitCommand(stub);
+        createProcess();
+        m_process->start(args.takeFirst(), args, QIODevice::ReadWrite);
+        if (!m_process->waitForStarted(3000))
+            qWarning() << "Failed to start simulation stub process:" << stub;
+    }
+    m_simRunning = true;
+    emit scriptStarted();
+    QTimer::singleShot(SimulatedRig::instance().startupMs(), this, [this]() {
+        if (m_simRunning)
+            emit pythonOutput("Press Enter to quit: ");
+    });
+}
+
 void PythonRunner::stopScript()
 {
+    if (m_simRunning) {
+        for (int channel : qAsConst(m_simChannels))
+            SimulatedRig::instance().stopTransmitting(channel);
+        m_simChannels.clear();
+        m_simRunning = false;
+        if (m_process && m_process->state() != QProcess::NotRunning) {
+            m_process->terminate();
+            if (!m_process->waitForFinished(3000))
+                m_process->kill();
+        }
+        emit scriptStopped();
+        return;
+    }
     if (m_process && m_process->state() != QProcess::NotRunning) {
         m_process->terminate();
         if (!m_process->waitForFinished(3000))
@@ -48,6 +154,13 @@ void PythonRunner::stopScript()
     }
 }
 
+bool PythonRunner::isRunning() const
+{
+    if (m_simRunning)
+        return true;
+    return m_process && m_process->state() != QProcess::NotRunning;
+}
+
 void PythonRunner::handleReadyRead()
 {
     QByteArray data = m_process->readAllStandardOutput();
@@ -5,16 +5,26 @@
 #include <QProcess>
 #include <QElapsedTimer>
 #include <QList>
+#include <memory>
+#include "pythoneditor.h"
+
+struct TuneConfig;
 
 class PythonRunner : public QObject
 {
     Q_OBJECT
 public:
-    explicit PythonRunner(const QString &scriptPath, QObject *parent = nullptr);
+    // config supplies the interpreter for launch overrides.
+    PythonRunner(const QString &scriptPath, std::shared_ptr<const TuneConfig> config, QObject *parent = nullptr);
     ~PythonRunner();
 
     void startScript();
     void stopScript();
+    bool isRunning() const;
+
+    // When set, the flowgraph is launched through a small wrapper that substitutes these
+    // gain literals in memory, so the file on disk is not touched.
+    void setGainOverrides(const QList<GainSite> &overrides);
 
 signals:
     void pythonOutput(const QString &output);
@@ -29,11 +39,16 @@ private slots:
 
 private:
     void createProcess();
+    void startSimulated();
 
     QString m_scriptPath;
+    std::shared_ptr<const TuneConfig> m_config;
+    QList<GainSite> m_gainOverrides;
     QProcess *m_process;
     QList<qint64> m_uTimes;
     QList<qint64> m_nTimes;
+    bool m_simRunning = false;     // SimulatedRig stands in for the flowgraph
+    QList<int> m_simChannels;
 };
 
 #endif // PYTHONRUNNER_H
@@ -0,0 +1,237 @@
+#include "settlecalibrator.h"
+#include "amplifierserial.h"
+#include "pythonrunner.h"
+#include "tuneconfig.h"
+#include <QDebug>
+
+SettleCalibrator::SettleCalibrator(const QString &waveformFile, const QString &sdrModel, QObject *parent)
+    : QObject(parent),
+    m_waveformFile(waveformFile),
+    m_sdrModel(sdrModel),
+    m_ampSerial(new AmplifierSerial(this)),
+    m_pythonRunner(new PythonRunner(waveformFile, TuneConfig::current(), this))
+{
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    m_stable.pollMs = config->calibratePollMs;
+    m_stable.timeoutMs = config->calibrateTimeoutMs;
+    m_stable.toleranceDb = config->calibrateToleranceDb;
+    m_stable.holdMs = config->calibrateHoldMs;
+    m_rounds = config->calibrateRounds;
+    m_minSettled = config->calibrateMinSettledRounds;
+    m_promptTimeoutMs = config->calibratePromptTimeoutMs;
+    m_alcBelow = config->calibrateAlcBelowDb;
+}
+
+SettleCalibrator::~SettleCalibrator()
+{
+    m_pythonRunner->stopScript();
+    m_ampSerial->disconnectAll();
+}
+
+void SettleCalibrator::start()
+{
+    m_ampSerial->searchAndConnect();
+    m_devices = m_ampSerial->connectedDevices();
+    if (m_devices.isEmpty()) {
+        fail("No amplifier devices found.");
+        return;
+    }
+    qDebug() << "Calibrating settle times for" << m_sdrModel << "on" << m_devices
+             << "with" << m_waveformFile;
+    tuneSpawn(run());
+}
+
+TuneTask<void> SettleCalibrator::run()
+{
+    if (!co_await configure({"SERIAL?"}))
+        co_return;
+    for (int round = 0; round < m_rounds; ++round) {
+        m_round = round;
+        if (!co_await configure({"STANDBY", "MODE VVA", "VVA_LEVEL 100.0"})
+            || !co_await startWaveform(QString())
+            || !co_await measure({"ONLINE"}, "Online"))
+            co_return;
+        co_await stopWaveform();
+        if (!co_await startWaveform("WaveformStart")
+            || !co_await measure({"VVA_LEVEL 90.0"}, "VvaLevel")
+            || !co_await measure({"VVA_LEVEL 100.0"}, "VvaLevel"))
+            co_return;
+        // An ALC level just below the measured VVA power, so switching to ALC (and then
+        // lowering the level) visibly moves the output.
+        const QString alc = alcLevel(m_alcBelow);
+        const QString alcLower = alcLevel(m_alcBelow + 1.0);
+        if (!co_await configure({"ALC_LEVEL " + alc})
+            || !co_await measure({"MODE ALC"}, "ModeAlc")
+            || !co_await measure({"ALC_LEVEL " + alcLower}, "AlcLevel")
+            || !co_await measure({"MODE VVA"}, "ModeVva"))
+            co_return;
+        co_await stopWaveform();
+        if (!co_await configure({"STANDBY"}))
+            co_return;
+    }
+
+    const QStringList unsettled = unsettledEvents();
+    if (!unsettled.isEmpty()) {
+        fail(QString("Too few rounds settled (need %1 of %2); keeping the previous settle profiles.\n%3")
+                 .arg(m_minSettled).arg(m_rounds).arg(unsettled.join('\n')));
+        co_return;
+    }
+
+    m_done = true;
+    bool saved = true;
+    for (const SettleProfile &profile : qAsConst(m_profiles))
+        saved = SettleProfileStore::save(profile) && saved;
+    emit finished(saved, report());
+}
+
+TuneTask<bool> SettleCalibrator::configure(const QStringList &commands)
+{
+    if (m_done)
+        co_return false;
+    const TuneBatchResult result = co_await tuneAmpBatch(m_ampSerial, commands, m_devices);
+    if (!result.ok) {
+        fail("Amp rejected calibration command: " + result.errors.join("; "));
+        co_return false;
+    }
+    co_return !m_done;
+}
+
+TuneTask<bool> SettleCalibrator::measure(const QStringList &commands, const QString &event)
+{
+    if (!co_await configure(commands))
+        co_return false;
+    record(event, co_await tuneStableReading(m_ampSerial, m_devices, m_stable));
+    co_return !m_done;
+}
+
+TuneTask<bool> SettleCalibrator::startWaveform(const QString &event)
+{
+    if (m_done)
+        co_return false;
+    if (!co_await tuneWaveformPrompt(m_pythonRunner, m_promptTimeoutMs)) {
+        fail("Waveform did not reach its prompt.");
+        co_return false;
+    }
+    if (!event.isEmpty())
+        record(event, co_await tuneStableReading(m_ampSerial, m_devices, m_stable));
+    co_return !m_done;
+}
+
+TuneTask<void> SettleCalibrator::stopWaveform()
+{
+    m_pythonRunner->stopScript();
+    co_await tuneDelay(this, 1000);
+}
+
+void SettleCalibrator::record(const QString &event, const QMap<QString, TuneSettled> &settled)
+{
+    for (const QString &dev : qAsConst(m_devices)) {
+        const TuneSettled reading = settled.value(dev);
+        if (reading.haveReading)
+            m_lastPower.insert(dev, reading.dbm);
+        if (!reading.settled) {
+            // A timeout is not a settle time; the round is dropped for this event.
+            qWarning() << "Forward power on" << dev << "did not settle after" << event
+                       << "within" << m_stable.timeoutMs << "ms; dropping the round.";
+            m_unsettled[dev][event].insert(m_round);
+            continue;
+        }
+        const int settleMs = int(reading.settledAtMs);
+        SettleProfile &profile = m_profiles[dev];
+        profile.sdrModel = m_sdrModel;
+        profile.ampSerial = m_ampSerial->identity(dev);
+        profile.settleMs[event] = qMax(profile.settleMs.value(event, 0), settleMs);
+        profile.samples[event] = profile.samples.value(event, 0) + 1;
+        m_settledRounds[dev][event].insert(m_round);
+        qDebug() << "Settle" << event << "on" << dev << ":" << settleMs << "ms";
+    }
+}
+
+QString SettleCalibrator::alcLevel(double belowDb) const
+{
+    // The lowest VVA power across the amps sets a common ALC level.
+    double vvaPower = 0.0;
+    bool havePower = false;
+    for (const QString &dev : qAsConst(m_devices)) {
+        if (!m_lastPower.contains(dev))
+            continue;
+        vvaPower = havePower ? qMin(vvaPower, m_lastPower.value(dev)) : m_lastPower.value(dev);
+        havePower = true;
+    }
+    return QString::number(vvaPower - belowDb, 'f', 1);
+}
+
+int SettleCalibrator::settledRoundCount(const QString &dev, const QString &event) const
+{
+    QSet<int> rounds = m_settledRounds.value(dev).value(event);
+    rounds.subtract(m_unsettled.value(dev).value(event));
+    return rounds.size();
+}
+
+QStringList SettleCalibrator::unsettledEvents() const
+{
+    QStringList lines;
+    for (auto dev = m_unsettled.cbegin(); dev != m_unsettled.cend(); ++dev) {
+        for (auto it = dev->cbegin(); it != dev->cend(); ++it) {
+            const int settledRounds = settledRoundCount(dev.key(), it.key());
+            if (settledRounds < m_minSettled)
+                lines << QString("  %1 on %2: %3 rounds settled, %4 timed out")
+                             .arg(it.key(), m_ampSerial->identity(dev.key()))
+                             .arg(settledRounds).arg(it->size());
+        }
+    }
+    return lines;
+}
+
+void SettleCalibrator::fail(const QString &reason)
+{
+    if (m_done)
+        return;
+    m_done = true;
+    m_pythonRunner->stopScript();
+    for (const QString &dev : qAsConst(m_devices))
+        m_ampSerial->setStandby(dev);
+    emit finished(false, reason);
+}
+
+QString SettleCalibrator::report() const
+{
+    // Where WaveformTuner waited a fixed time before settle profiles existed.
+    struct OldDelay {
+        const char *site;
+        QStringList events;
+        int oldMs;
+    };
+    const QList<OldDelay> sites = {
+        {"After ONLINE (setup)", {"Online"}, 500},
+        {"After the waveform prompt", {"WaveformStart"}, 1000},
+        {"After MODE VVA / VVA_LEVEL", {"ModeVva", "VvaLevel"}, 1000},
+        {"After MODE ALC / ALC_LEVEL", {"ModeAlc", "AlcLevel"}, 1500},
+        {"FinalizeTuning recheck", {"ModeVva", "VvaLevel"}, 2500},
+    };
+
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    QStringList lines;
+    for (auto dev = m_profiles.cbegin(); dev != m_profiles.cend(); ++dev) {
+        const SettleProfile &profile = dev.value();
+        lines << QString("Amp %1 with %2:").arg(profile.ampSerial, m_sdrModel);
+        const QMap<QString, QSet<int>> unsettled = m_unsettled.value(dev.key());
+        for (auto it = profile.settleMs.cbegin(); it != profile.settleMs.cend(); ++it)
+            lines << QString("  %1 settles in %2 ms (%3 samples%4)")
+                         .arg(it.key()).arg(it.value()).arg(profile.samples.value(it.key()))
+                         .arg(!unsettled.value(it.key()).isEmpty()
+                                  ? QString(", %1 rounds timed out").arg(unsettled.value(it.key()).size())
+                                  : QString());
+        for (const OldDelay &site : sites) {
+            int settle = 0;
+            for (const QString &event : site.events)
+                settle = qMax(settle, profile.settleMs.value(event));
+            int delay = SettleProfileStore::withMargin(*config, settle);
+            lines << QString("  %1: was %2 ms, now %3 ms (%4 ms %5 per use)")
+                         .arg(site.site).arg(site.oldMs).arg(delay)
+                         .arg(qAbs(site.oldMs - delay))
+                         .arg(delay <= site.oldMs ? "saved" : "added");
+        }
+    }
+    return lines.join('\n');
+}
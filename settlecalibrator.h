@@ -0,0 +1,71 @@
+#ifndef SETTLECALIBRATOR_H
+#define SETTLECALIBRATOR_H
+
+#include <QObject>
+#include <QMap>
+#include <QSet>
+#include <QStringList>
+#include "settleprofile.h"
+#include "tunetask.h"
+
+class AmplifierSerial;
+class PythonRunner;
+
+// Calibration mode: runs one waveform on every connected amp and measures how long
+// forward power takes to settle after each command type and after the waveform starts.
+// The longest time seen over [Calibrate] Rounds is saved as the amp's settle profile
+// for the SDR model, and the report compares it with the tuner's old fixed delays.
+// Rounds that time out are dropped; if fewer than [Calibrate] MinSettledRounds settle
+// for any event, calibration fails and the previous profiles are kept.
+class SettleCalibrator : public QObject
+{
+    Q_OBJECT
+public:
+    SettleCalibrator(const QString &waveformFile, const QString &sdrModel, QObject *parent = nullptr);
+    ~SettleCalibrator();
+
+    void start();
+
+signals:
+    void finished(bool ok, const QString &report);
+
+private:
+    // The whole procedure, written sequentially on the TuneTask awaitables.
+    TuneTask<void> run();
+    TuneTask<bool> configure(const QStringList &commands);
+    // Sends commands and times forward power settling from their acks.
+    TuneTask<bool> measure(const QStringList &commands, const QString &event);
+    // Launches the flowgraph; with an event, also times settling from its prompt.
+    TuneTask<bool> startWaveform(const QString &event);
+    TuneTask<void> stopWaveform();
+    void record(const QString &event, const QMap<QString, TuneSettled> &settled);
+    QString alcLevel(double belowDb) const;
+    // Rounds in which every measurement of the event settled on the device.
+    int settledRoundCount(const QString &dev, const QString &event) const;
+    // Devices and events with too few settled rounds to trust, for the failure report.
+    QStringList unsettledEvents() const;
+    void fail(const QString &reason);
+    QString report() const;
+
+    QString m_waveformFile;
+    QString m_sdrModel;
+    AmplifierSerial *m_ampSerial;
+    PythonRunner *m_pythonRunner;
+    QStringList m_devices;
+
+    bool m_done = false;
+    QMap<QString, double> m_lastPower;          // Per device, from the latest measurement
+    QMap<QString, SettleProfile> m_profiles;    // Per device
+    // Device -> event -> round indices. An event measured twice in a round counts once,
+    // and only if every measurement in that round settled.
+    QMap<QString, QMap<QString, QSet<int>>> m_settledRounds;
+    QMap<QString, QMap<QString, QSet<int>>> m_unsettled;
+    int m_round = 0;
+    TuneStableOptions m_stable;
+    int m_rounds;
+    int m_minSettled;
+    int m_promptTimeoutMs;
+    double m_alcBelow;
+};
+
+#endif // SETTLECALIBRATOR_H
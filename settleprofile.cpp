@@ -0,0 +1,120 @@
+#include "settleprofile.h"
+#include "tuneconfig.h"
+#include "storekey.h"
+#include <QCoreApplication>
+#include <QSettings>
+#include <QDateTime>
+#include <QDebug>
+#include <cmath>
+
+static QString profileGroup(const QString &sdrModel, const QString &ampSerial)
+{
+    // Device paths stand in for the serial when none is known.
+    return QString("%1/%2").arg(sdrModel.toLower(), StoreKey::segment(ampSerial));
+}
+
+QString SettleProfileStore::storePath()
+{
+    return QCoreApplication::applicationDirPath() + "/waveSettle.ini";
+}
+
+QStringList SettleProfileStore::events()
+{
+    return QStringList() << "Online" << "ModeVva" << "VvaLevel" << "ModeAlc" << "AlcLevel" << "WaveformStart";
+}
+
+bool SettleProfileStore::save(const SettleProfile &profile)
+{
+    QSettings settings(storePath(), QSettings::IniFormat);
+    settings.beginGroup(profileGroup(profile.sdrModel, profile.ampSerial));
+    settings.remove("");
+    for (auto it = profile.settleMs.cbegin(); it != profile.settleMs.cend(); ++it) {
+        settings.setValue(it.key(), it.value());
+        settings.setValue(it.key() + "Samples", profile.samples.value(it.key()));
+    }
+    settings.setValue("Measured", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    settings.endGroup();
+    settings.sync();
+    if (settings.status() != QSettings::NoError) {
+        qWarning() << "Failed to write settle profile store:" << storePath();
+        return false;
+    }
+    return true;
+}
+
+bool SettleProfileStore::load(const QString &sdrModel, const QString &ampSerial, SettleProfile *profile)
+{
+    QSettings settings(storePath(), QSettings::IniFormat);
+    settings.beginGroup(profileGroup(sdrModel, ampSerial));
+    SettleProfile result;
+    result.sdrModel = sdrModel;
+    result.ampSerial = ampSerial;
+    for (const QString &event : events()) {
+        if (!settings.contains(event))
+            continue;
+        result.settleMs.insert(event, settings.value(event).toInt());
+        result.samples.insert(event, settings.value(event + "Samples", 0).toInt());
+    }
+    settings.endGroup();
+    if (profile)
+        *profile = result;
+    return !result.settleMs.isEmpty();
+}
+
+QString SettleProfileStore::key(const QString &sdrModel, const QString &ampSerial)
+{
+    return profileGroup(sdrModel, ampSerial);
+}
+
+QMap<QString, SettleProfile> SettleProfileStore::loadAll()
+{
+    QMap<QString, SettleProfile> profiles;
+    QSettings settings(storePath(), QSettings::IniFormat);
+    const QStringList models = settings.childGroups();
+    for (const QString &model : models) {
+        settings.beginGroup(model);
+        const QStringList amps = settings.childGroups();
+        for (const QString &amp : amps) {
+            settings.beginGroup(amp);
+            SettleProfile profile;
+            profile.sdrModel = model;
+            profile.ampSerial = amp;
+            for (const QString &event : events()) {
+                if (!settings.contains(event))
+                    continue;
+                profile.settleMs.insert(event, settings.value(event).toInt());
+                profile.samples.insert(event, settings.value(event + "Samples", 0).toInt());
+            }
+            settings.endGroup();
+            if (!profile.settleMs.isEmpty())
+                profiles.insert(model + "/" + amp, profile);
+        }
+        settings.endGroup();
+    }
+    return profiles;
+}
+
+int SettleProfileStore::withMargin(const TuneConfig &config, int settleMs)
+{
+    return int(std::ceil(settleMs * (1.0 + config.settleMarginPercent / 100.0))) + config.settleMarginMs;
+}
+
+int SettleProfileStore::delayMs(const TuneConfig &config, const QString &sdrModel, const QStringList &ampSerials,
+                                const QStringList &events, int fallbackMs)
+{
+    if (ampSerials.isEmpty() || !config.useSettleProfiles)
+        return fallbackMs;
+
+    int slowest = 0;
+    for (const QString &serial : ampSerials) {
+        const auto found = config.settleProfiles.constFind(key(sdrModel, serial));
+        if (found == config.settleProfiles.constEnd())
+            return fallbackMs;
+        for (const QString &event : events) {
+            if (!found->settleMs.contains(event))
+                return fallbackMs;
+            slowest = qMax(slowest, found->settleMs.value(event));
+        }
+    }
+    return withMargin(config, slowest);
+}
@@ -0,0 +1,40 @@
+#ifndef SETTLEPROFILE_H
+#define SETTLEPROFILE_H
+
+#include <QMap>
+#include <QString>
+#include <QStringList>
+
+struct TuneConfig;
+
+// How long forward power takes to settle after each kind of event on one amp driven by
+// one SDR model. Events: Online, ModeVva, VvaLevel, ModeAlc, AlcLevel, WaveformStart.
+struct SettleProfile {
+    QString sdrModel;       // "x300" or "N321"
+    QString ampSerial;      // Amp serial number, or its device name if unknown
+    QMap<QString, int> settleMs;  // Longest settle time measured per event
+    QMap<QString, int> samples;   // Measurements behind each figure
+};
+
+// Stores settle profiles in waveSettle.ini next to the application and turns them into
+// the delays WaveformTuner waits between states.
+class SettleProfileStore
+{
+public:
+    static QString storePath();
+    static bool save(const SettleProfile &profile);
+    static bool load(const QString &sdrModel, const QString &ampSerial, SettleProfile *profile);
+    static QStringList events();
+    // Every stored profile, keyed by key(); TuneConfig snapshots hold these.
+    static QMap<QString, SettleProfile> loadAll();
+    static QString key(const QString &sdrModel, const QString &ampSerial);
+
+    // Profiled settle time for the slowest of events on any of ampSerials plus the
+    // [Settle] safety margin, or fallbackMs when any of them has not been calibrated.
+    // Both come from config, the caller's snapshot.
+    static int delayMs(const TuneConfig &config, const QString &sdrModel, const QStringList &ampSerials,
+                       const QStringList &events, int fallbackMs);
+    static int withMargin(const TuneConfig &config, int settleMs);
+};
+
+#endif // SETTLEPROFILE_H
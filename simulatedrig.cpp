@@ -0,0 +1,190 @@
+#include "simulatedrig.h"
+#include "tuneconfig.h"
+#include <QRandomGenerator>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDebug>
+
+static bool s_forceEnabled = false;
+
+SimulatedRig &SimulatedRig::instance()
+{
+    static SimulatedRig rig;
+    return rig;
+}
+
+bool SimulatedRig::isEnabled()
+{
+    // Fixed for the life of the process: a reload must not move the stores mid-run.
+    static const bool configured = qEnvironmentVariableIntValue("WAVETUNE_SIMULATE") != 0
+                                   || TuneConfig::current()->simulationEnabled;
+    return s_forceEnabled || configured;
+}
+
+void SimulatedRig::setEnabled(bool enabled)
+{
+    s_forceEnabled = enabled;
+}
+
+SimulatedRig::SimulatedRig()
+{
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    m_offsetDbm = config->simOffsetDbm;
+    m_dbPerGain = config->simDbPerGain;
+    m_returnLossDb = config->simReturnLossDb;
+    m_alcRangeDb = config->simAlcRangeDb;
+    m_noiseDb = config->simNoiseDb;
+    m_latencyMs = config->simLatencyMs;
+    m_startupMs = config->simStartupMs;
+    m_stubProcess = config->simStubProcess;
+
+    // Named like the udev symlinks the serial discovery expects.
+    Amp l1;
+    l1.channel = 0;
+    l1.serial = "SIM-L1";
+    m_amps.insert("/dev/ttyUSB_L1_amp_sim", l1);
+    Amp l2;
+    l2.channel = 1;
+    l2.serial = "SIM-L2";
+    m_amps.insert("/dev/ttyUSB_L2_amp_sim", l2);
+}
+
+QString SimulatedRig::sandboxPath(const QString &name)
+{
+    if (!m_sandbox)
+        m_sandbox.reset(new QTemporaryDir(QDir::tempPath() + "/wavetune-sim-XXXXXX"));
+    return m_sandbox->filePath(name);
+}
+
+QString SimulatedRig::sandboxCopy(const QString &file)
+{
+    const QString original = QFileInfo(file).absoluteFilePath();
+    if (isSandboxed(original))
+        return original;
+    if (m_copies.contains(original))
+        return m_copies.value(original);
+    // One directory per original keeps same-named files from different folders apart,
+    // and the name itself (L1_L2_ and so on) picks the channels.
+    const QString dir = sandboxPath(QString("flowgraphs/%1").arg(m_copies.size()));
+    const QString copy = dir + "/" + QFileInfo(original).fileName();
+    if (!QDir().mkpath(dir) || !QFile::copy(original, copy)) {
+        qWarning() << "Cannot copy" << original << "into the simulation sandbox";
+        return QString();
+    }
+    m_copies.insert(original, copy);
+    return copy;
+}
+
+bool SimulatedRig::isSandboxed(const QString &file) const
+{
+    return m_sandbox && m_sandbox->isValid() &&
+           QFileInfo(file).absoluteFilePath().startsWith(m_sandbox->path() + "/");
+}
+
+QStringList SimulatedRig::devices() const
+{
+    return m_amps.keys();
+}
+
+int SimulatedRig::latencyMs() const
+{
+    return m_latencyMs;
+}
+
+int SimulatedRig::startupMs() const
+{
+    return m_startupMs;
+}
+
+QString SimulatedRig::stubProcess() const
+{
+    return m_stubProcess;
+}
+
+void SimulatedRig::setStubProcess(const QString &command)
+{
+    m_stubProcess = command;
+}
+
+void SimulatedRig::setTransmitting(int channel, int gain)
+{
+    m_transmitGain.insert(channel, gain);
+}
+
+void SimulatedRig::stopTransmitting(int channel)
+{
+    m_transmitGain.remove(channel);
+}
+
+double SimulatedRig::forwardPower(const Amp &amp, bool *alcRange) const
+{
+    *alcRange = false;
+    if (!amp.online || !m_transmitGain.contains(amp.channel))
+        return 0.0;
+    double power = m_offsetDbm + m_dbPerGain * m_transmitGain.value(amp.channel)
+                   - 0.1 * (100.0 - amp.vvaLevel);
+    if (amp.mode == "ALC") {
+        if (power - amp.alcLevel > m_alcRangeDb)
+            *alcRange = true;
+        power = qMin(power, amp.alcLevel);
+    }
+    return power + (QRandomGenerator::global()->generateDouble() * 2.0 - 1.0) * m_noiseDb;
+}
+
+QString SimulatedRig::handle(const QString &device, const QString &command)
+{
+    if (!m_amps.contains(device))
+        return "ERROR: no such device";
+    Amp &amp = m_amps[device];
+    const QStringList parts = command.trimmed().split(' ', Qt::SkipEmptyParts);
+    if (parts.isEmpty())
+        return "ERROR: empty command";
+    const QString verb = parts.first().toUpper();
+
+    if (verb == "MODE?")
+        return QString("%1, %2").arg(amp.online ? "ONLINE" : "STANDBY", amp.mode);
+    if (verb == "FWD_PWR?") {
+        bool alcRange = false;
+        double power = forwardPower(amp, &alcRange);
+        return alcRange ? QString("ALC Range") : QString::number(power, 'f', 2);
+    }
+    if (verb == "REV_PWR?") {
+        bool alcRange = false;
+        double power = forwardPower(amp, &alcRange);
+        return QString::number(amp.online ? power - m_returnLossDb : 0.0, 'f', 2);
+    }
+    if (verb == "VVA_LEVEL?")
+        return QString::number(amp.vvaLevel, 'f', 1);
+    if (verb == "ALC_LEVEL?")
+        return QString::number(amp.alcLevel, 'f', 1);
+    if (verb == "SERIAL?")
+        return amp.serial;
+    if (verb == "MODEL?")
+        return "SIMULATED";
+    if (verb == "FAULTS?")
+        return "NONE";
+    if (verb == "ONLINE") {
+        amp.online = true;
+        return QString();
+    }
+    if (verb == "STANDBY") {
+        amp.online = false;
+        return QString();
+    }
+    if (verb == "ACK_FAULTS")
+        return QString();
+    if (verb == "MODE" && parts.size() > 1 && (parts.at(1) == "VVA" || parts.at(1) == "ALC")) {
+        amp.mode = parts.at(1);
+        return QString();
+    }
+    if (verb == "VVA_LEVEL" && parts.size() > 1) {
+        amp.vvaLevel = qBound(0.0, parts.at(1).toDouble(), 100.0);
+        return QString();
+    }
+    if (verb == "ALC_LEVEL" && parts.size() > 1) {
+        amp.alcLevel = parts.at(1).toDouble();
+        return QString();
+    }
+    return QString("ERROR: unknown command %1").arg(command);
+}
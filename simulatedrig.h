@@ -0,0 +1,75 @@
+#ifndef SIMULATEDRIG_H
+#define SIMULATEDRIG_H
+
+#include <QMap>
+#include <QScopedPointer>
+#include <QTemporaryDir>
+#include <QString>
+#include <QStringList>
+
+// In-process stand-in for a two-amp bench, so the tuner, batch loop and distributed
+// mode can be exercised without hardware. When enabled, AmplifierSerial talks to these
+// amps instead of serial ports and PythonRunner "runs" a flowgraph by reading its gains.
+//
+// Forward power is [Simulation] OffsetDbm + DbPerGain * gain, shifted by the VVA level
+// (0.1 dB per level below 100) and held at the ALC level in ALC mode.
+class SimulatedRig
+{
+public:
+    static SimulatedRig &instance();
+    // setEnabled, WAVETUNE_SIMULATE or [Simulation] Enabled; the latter two are read once.
+    static bool isEnabled();
+    static void setEnabled(bool enabled);
+
+    QStringList devices() const;
+    int latencyMs() const;
+    int startupMs() const;
+    // Command PythonRunner also launches for each simulated flowgraph, empty for none.
+    QString stubProcess() const;
+    void setStubProcess(const QString &command);
+
+    // A simulated run never touches the bench's files. Flowgraphs are tuned as copies in
+    // a temporary directory, and the history stores live there too.
+    // Path of name in that directory.
+    QString sandboxPath(const QString &name);
+    // Copy of the flowgraph file to tune instead of it (file itself if it already is a
+    // copy), or an empty string if it cannot be copied.
+    QString sandboxCopy(const QString &file);
+    bool isSandboxed(const QString &file) const;
+
+    // Reply line for command on device, or an empty string for silent set commands.
+    QString handle(const QString &device, const QString &command);
+
+    // The flowgraph driving channel started (with gain) or stopped.
+    void setTransmitting(int channel, int gain);
+    void stopTransmitting(int channel);
+
+private:
+    SimulatedRig();
+
+    struct Amp {
+        int channel = 0;
+        bool online = false;
+        QString mode = "VVA";
+        double vvaLevel = 100.0;
+        double alcLevel = 0.0;
+        QString serial;
+    };
+
+    double forwardPower(const Amp &amp, bool *alcRange) const;
+
+    QMap<QString, Amp> m_amps;
+    QMap<int, int> m_transmitGain;  // Channel -> gain while its flowgraph runs
+    double m_offsetDbm;
+    double m_dbPerGain;
+    double m_returnLossDb;
+    double m_alcRangeDb;
+    double m_noiseDb;
+    int m_latencyMs;
+    int m_startupMs;
+    QString m_stubProcess;
+    QScopedPointer<QTemporaryDir> m_sandbox;
+    QMap<QString, QString> m_copies;    // Original file -> its copy in the sandbox
+};
+
+#endif // SIMULATEDRIG_H
@@ -0,0 +1,258 @@
+#include "soakrunner.h"
+#include "tuneconfig.h"
+#include "amplifierserial.h"
+#include "waveformtuner.h"
+#include "wavelogger.h"
+#include "simulatedrig.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+#include <QTimer>
+#include <QDebug>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace {
+
+double residentKb()
+{
+    // /proc/self/statm: size resident shared text lib data dt, in pages.
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QIODevice::ReadOnly))
+        return 0.0;
+    const QList<QByteArray> fields = statm.readAll().split(' ');
+    if (fields.size() < 2)
+        return 0.0;
+    return fields.at(1).toDouble() * sysconf(_SC_PAGESIZE) / 1024.0;
+}
+
+double heapKb()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks / 1024.0;
+#else
+    return -1.0;
+#endif
+}
+
+int openFds()
+{
+    return QDir("/proc/self/fd").entryList(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot).size();
+}
+
+int childProcesses()
+{
+    // Field 4 of /proc/<pid>/stat is the parent pid; the command name before it may
+    // contain spaces, so count from the closing parenthesis.
+    const QByteArray self = QByteArray::number(qint64(getpid()));
+    int count = 0;
+    const QStringList pids = QDir("/proc").entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const QString &pid : pids) {
+        if (!pid.at(0).isDigit())
+            continue;
+        QFile stat("/proc/" + pid + "/stat");
+        if (!stat.open(QIODevice::ReadOnly))
+            continue;
+        const QByteArray line = stat.readAll();
+        const QList<QByteArray> fields = line.mid(line.lastIndexOf(')') + 2).split(' ');
+        if (fields.size() > 1 && fields.at(1) == self)
+            ++count;
+    }
+    return count;
+}
+
+// Least-squares slope of y against x.
+double slope(const QList<QPair<double, double>> &points)
+{
+    const int n = points.size();
+    if (n < 2)
+        return 0.0;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (const auto &p : points) {
+        sx += p.first;
+        sy += p.second;
+        sxx += p.first * p.first;
+        sxy += p.first * p.second;
+    }
+    const double denom = n * sxx - sx * sx;
+    return denom == 0.0 ? 0.0 : (n * sxy - sx * sy) / denom;
+}
+
+} // namespace
+
+SoakRunner::SoakRunner(const QList<TuneJob> &jobs, int tunes, QObject *parent)
+    : QObject(parent),
+    m_jobs(jobs),
+    m_tunes(tunes),
+    m_amps(new AmplifierSerial(this)),
+    m_logger(new WaveLogger(this))
+{
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    m_sampleEvery = config->soakSampleEvery;
+    m_warmupPercent = config->soakWarmupPercent;
+    m_changeoverMs = config->changeoverMs;
+    m_samplesFile = config->soakSamplesFile;
+    m_maxRssKb = config->soakMaxRssKbPer1000;
+    m_maxHeapKb = config->soakMaxHeapKbPer1000;
+    m_maxFds = config->soakMaxFdsPer1000;
+    m_maxObjects = config->soakMaxObjectsPer1000;
+    m_maxChildren = config->soakMaxChildrenPer1000;
+
+    // Soak always runs on the simulated rig; the stub child keeps QProcess in the loop.
+    SimulatedRig::setEnabled(true);
+    SimulatedRig::instance().setStubProcess(config->soakStubProcess);
+
+    // Thousands of tunes must not land in the bench's flowgraphs; a job the caller has not
+    // moved into the sandbox yet is moved here.
+    for (int i = m_jobs.size() - 1; i >= 0; --i) {
+        const QString copy = SimulatedRig::instance().sandboxCopy(m_jobs.at(i).file);
+        if (copy.isEmpty())
+            m_jobs.removeAt(i);
+        else
+            m_jobs[i].file = copy;
+    }
+}
+
+SoakRunner::~SoakRunner()
+{
+    m_amps->disconnectAll();
+}
+
+void SoakRunner::start()
+{
+    m_amps->searchAndConnect();
+    m_clock.start();
+    m_logger->debugAndLog(QString("Soak: %1 tunes over %2 file(s), sampling every %3")
+                              .arg(m_tunes).arg(m_jobs.size()).arg(m_sampleEvery));
+    takeSample();
+    runNext();
+}
+
+void SoakRunner::runNext()
+{
+    if (m_done >= m_tunes || m_jobs.isEmpty()) {
+        finish();
+        return;
+    }
+    const TuneJob job = m_jobs.at(m_done % m_jobs.size());
+    WaveformTuner *tuner = new WaveformTuner(this, m_logger, m_amps);
+    tuner->setTier(job.tier, job.promoteTo);
+
+    // The tuner is released the way the batch loop releases it, and the next file starts
+    // after the changeover; sampling then sees the state between files.
+    auto next = [this, tuner](bool ok) {
+        tuner->deleteLater();
+        ++m_done;
+        if (!ok)
+            ++m_failed;
+        QTimer::singleShot(m_changeoverMs, this, [this]() {
+            if (m_done % m_sampleEvery == 0 || m_done >= m_tunes)
+                takeSample();
+            runNext();
+        });
+    };
+    connect(tuner, &WaveformTuner::tuningFinished, this, [next]() { next(true); });
+    connect(tuner, &WaveformTuner::tuningFailed, this, [next](const QString &) { next(false); });
+
+    if (job.characterize)
+        tuner->startCharacterization(job.file, job.ampModel);
+    else
+        tuner->startTuning(job.file, job.ampModel, job.minPower, job.maxPower, job.critical);
+}
+
+void SoakRunner::takeSample()
+{
+    Sample sample;
+    sample.tunes = m_done;
+    sample.elapsedMs = m_clock.elapsed();
+    sample.rssKb = residentKb();
+    sample.heapKb = heapKb();
+    sample.fds = openFds();
+    sample.objects = QCoreApplication::instance()->findChildren<QObject*>().size();
+    sample.children = childProcesses();
+    m_samples << sample;
+    qDebug().noquote() << QString("Soak sample at %1 tunes: RSS %2 KB, heap %3 KB, %4 fds, %5 objects, %6 children")
+                              .arg(sample.tunes).arg(sample.rssKb, 0, 'f', 0).arg(sample.heapKb, 0, 'f', 0)
+                              .arg(sample.fds).arg(sample.objects).arg(sample.children);
+}
+
+QList<SoakRunner::Metric> SoakRunner::metrics() const
+{
+    return {
+        {"RSS", "KB", [](const Sample &s) { return s.rssKb; }, m_maxRssKb},
+        {"Heap in use", "KB", [](const Sample &s) { return s.heapKb; }, m_maxHeapKb},
+        {"Open fds", "", [](const Sample &s) { return double(s.fds); }, m_maxFds},
+        {"QObjects", "", [](const Sample &s) { return double(s.objects); }, m_maxObjects},
+        {"Child processes", "", [](const Sample &s) { return double(s.children); }, m_maxChildren},
+    };
+}
+
+QString SoakRunner::analyse(bool *ok) const
+{
+    // Allocator pools, caches and the first serial buffers fill up early; only the
+    // samples after the warm-up count towards the trend.
+    const int warmupTunes = m_done * m_warmupPercent / 100;
+    QList<Sample> steady;
+    for (const Sample &sample : m_samples) {
+        if (sample.tunes >= warmupTunes)
+            steady << sample;
+    }
+
+    QStringList lines;
+    lines << QString("Soak finished: %1 tunes (%2 failed) in %3 s, %4 samples.")
+                 .arg(m_done).arg(m_failed).arg(m_clock.elapsed() / 1000).arg(m_samples.size());
+    *ok = true;
+    if (steady.size() < 4) {
+        lines << "Too few samples after the warm-up to judge trends; run more tunes.";
+        return lines.join('\n');
+    }
+    for (const Metric &metric : metrics()) {
+        if (metric.value(steady.first()) < 0)
+            continue;
+        QList<QPair<double, double>> points;
+        for (const Sample &sample : qAsConst(steady))
+            points << qMakePair(double(sample.tunes), metric.value(sample));
+        const double per1000 = slope(points) * 1000.0;
+        const bool leaking = per1000 > metric.limitPer1000;
+        *ok = *ok && !leaking;
+        lines << QString("  %1: %2 -> %3 %4, %5%6 per 1000 tunes (limit %7)%8")
+                     .arg(metric.name)
+                     .arg(metric.value(m_samples.first()), 0, 'f', 0)
+                     .arg(metric.value(m_samples.last()), 0, 'f', 0)
+                     .arg(metric.unit)
+                     .arg(per1000 >= 0 ? "+" : "")
+                     .arg(per1000, 0, 'f', 1)
+                     .arg(metric.limitPer1000)
+                     .arg(leaking ? "  GROWING" : "");
+    }
+    lines << (*ok ? QString("No resource grows with the number of tunes.")
+                  : QString("Resource growth detected; see %1 for the samples.").arg(m_samplesFile));
+    return lines.join('\n');
+}
+
+bool SoakRunner::writeSamples() const
+{
+    QFile file(m_samplesFile);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        qWarning() << "Cannot write soak samples:" << m_samplesFile;
+        return false;
+    }
+    QTextStream out(&file);
+    out << "tunes,elapsed_ms,rss_kb,heap_kb,fds,qobjects,children\n";
+    for (const Sample &s : m_samples)
+        out << s.tunes << ',' << s.elapsedMs << ',' << qint64(s.rssKb) << ',' << qint64(s.heapKb) << ','
+            << s.fds << ',' << s.objects << ',' << s.children << '\n';
+    return true;
+}
+
+void SoakRunner::finish()
+{
+    writeSamples();
+    bool ok = false;
+    const QString report = analyse(&ok);
+    m_logger->debugAndLog(report);
+    emit finished(ok, report);
+}
@@ -0,0 +1,73 @@
+#ifndef SOAKRUNNER_H
+#define SOAKRUNNER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QList>
+#include <QString>
+#include "tunejob.h"
+
+class AmplifierSerial;
+class WaveLogger;
+
+// Soak mode: tunes the job list round and round on the simulated rig, the same way the
+// batch loop does (a new WaveformTuner per file on shared amp ports), and samples the
+// process between files. Jobs run on the rig's sandbox copies of their flowgraphs and
+// nothing is written to the history stores. At the end the growth of each resource is fitted against the
+// number of tunes; any that rises faster than its [Soak] limit fails the run.
+class SoakRunner : public QObject
+{
+    Q_OBJECT
+public:
+    SoakRunner(const QList<TuneJob> &jobs, int tunes, QObject *parent = nullptr);
+    ~SoakRunner();
+
+    void start();
+
+signals:
+    void finished(bool ok, const QString &report);
+
+private:
+    struct Sample {
+        int tunes = 0;
+        qint64 elapsedMs = 0;
+        double rssKb = 0.0;
+        double heapKb = -1.0;   // Bytes in use by malloc, -1 where glibc cannot tell us
+        int fds = 0;
+        int objects = 0;        // QObjects in the application's tree
+        int children = 0;       // Live child processes
+    };
+    struct Metric {
+        const char *name;
+        const char *unit;
+        double (*value)(const Sample &);
+        double limitPer1000;
+    };
+
+    void runNext();
+    void takeSample();
+    void finish();
+    QList<Metric> metrics() const;
+    QString analyse(bool *ok) const;
+    bool writeSamples() const;
+
+    QList<TuneJob> m_jobs;
+    int m_tunes;
+    int m_done = 0;
+    int m_failed = 0;
+    AmplifierSerial *m_amps;
+    WaveLogger *m_logger;
+    QElapsedTimer m_clock;
+    QList<Sample> m_samples;
+    int m_sampleEvery;
+    int m_warmupPercent;
+    int m_changeoverMs;
+    QString m_samplesFile;
+    double m_maxRssKb;
+    double m_maxHeapKb;
+    double m_maxFds;
+    double m_maxObjects;
+    double m_maxChildren;
+};
+
+#endif // SOAKRUNNER_H
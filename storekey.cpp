@@ -0,0 +1,8 @@
+#include "storekey.h"
+
+QString StoreKey::segment(const QString &text)
+{
+    QString flat = text;
+    flat.replace('/', '_');
+    return flat;
+}
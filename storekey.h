@@ -0,0 +1,16 @@
+#ifndef STOREKEY_H
+#define STOREKEY_H
+
+#include <QString>
+
+// Group names for the INI stores kept next to the application (gain curves, gain
+// history, tune durations and settle profiles).
+class StoreKey
+{
+public:
+    // text as a single group name. QSettings treats '/' as a group separator, so file
+    // names and device paths are flattened with '_' in its place.
+    static QString segment(const QString &text);
+};
+
+#endif // STOREKEY_H
@@ -0,0 +1,383 @@
+#include "tuneconfig.h"
+#include <QCoreApplication>
+#include <QSettings>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QDebug>
+
+namespace {
+
+QMutex s_mutex;
+std::shared_ptr<const TuneConfig> s_current;
+std::shared_ptr<const TuneConfig> s_pending;
+int s_generation = 0;
+
+} // namespace
+
+QString TuneConfig::configPath()
+{
+    return QCoreApplication::applicationDirPath() + "/waveTuneConfig.ini";
+}
+
+bool TuneConfig::isExcluded(const QString &fileName) const
+{
+    return !exclusions.isEmpty() && exclusionMatcher.match(fileName).hasMatch();
+}
+
+QStringList TuneConfig::pinnedAmps() const
+{
+    QStringList amps;
+    if (!ampL1.isEmpty())
+        amps << ampL1;
+    if (!ampL2.isEmpty())
+        amps << ampL2;
+    return amps;
+}
+
+std::shared_ptr<TuneConfig> TuneConfig::load(QStringList *errors)
+{
+    auto config = std::make_shared<TuneConfig>();
+    QStringList problems;
+    QSettings settings(configPath(), QSettings::IniFormat);
+    if (settings.status() != QSettings::NoError)
+        problems << "Cannot parse " + configPath();
+
+    bool minOk = true;
+    bool maxOk = true;
+    const int gainMin = settings.value("Gain/Min", config->gainMin).toInt(&minOk);
+    const int gainMax = settings.value("Gain/Max", config->gainMax).toInt(&maxOk);
+    if (!minOk || !maxOk)
+        problems << "[Gain] Min and Max must be whole numbers.";
+    else if (gainMin >= gainMax)
+        problems << QString("[Gain] Min (%1) must be below Max (%2).").arg(gainMin).arg(gainMax);
+    else {
+        config->gainMin = gainMin;
+        config->gainMax = gainMax;
+    }
+
+    settings.beginGroup("Exclusions");
+    const QStringList keys = settings.childKeys();
+    settings.endGroup();
+    QStringList patterns;
+    for (const QString &key : keys) {
+        const QString keyword = key.trimmed();
+        if (keyword.isEmpty())
+            continue;
+        config->exclusions << keyword;
+        patterns << QRegularExpression::escape(keyword);
+    }
+    config->exclusionMatcher = QRegularExpression(patterns.join('|'), QRegularExpression::CaseInsensitiveOption);
+    config->exclusionMatcher.optimize();
+
+    const QString ampL1 = settings.value("Amplifiers/L1", "").toString().trimmed();
+    const QString ampL2 = settings.value("Amplifiers/L2", "").toString().trimmed();
+    if (!ampL1.isEmpty() && ampL1 == ampL2) {
+        problems << QString("[Amplifiers] L1 and L2 both name %1.").arg(ampL1);
+    } else {
+        config->ampL1 = ampL1;
+        config->ampL2 = ampL2;
+    }
+
+    config->useSettleProfiles = settings.value("Settle/UseProfiles", true).toBool();
+    const double marginPercent = settings.value("Settle/MarginPercent", config->settleMarginPercent).toDouble();
+    const int marginMs = settings.value("Settle/MarginMs", config->settleMarginMs).toInt();
+    if (marginPercent < 0.0 || marginMs < 0) {
+        problems << "[Settle] MarginPercent and MarginMs cannot be negative.";
+    } else {
+        config->settleMarginPercent = marginPercent;
+        config->settleMarginMs = marginMs;
+    }
+    config->settleProfiles = SettleProfileStore::loadAll();
+
+    config->pythonInterpreter = settings.value("Python/Interpreter", config->pythonInterpreter).toString().trimmed();
+    if (config->pythonInterpreter.isEmpty()) {
+        problems << "[Python] Interpreter cannot be empty.";
+        config->pythonInterpreter = "python3";
+    }
+    config->launchOverrides = settings.value("Injection/LaunchOverrides", config->launchOverrides).toBool();
+
+    config->sweepStart = settings.value("Characterize/GainStart", config->gainMin).toInt();
+    config->sweepStop = settings.value("Characterize/GainStop", config->gainMax).toInt();
+    config->sweepStep = qMax(1, settings.value("Characterize/GainStep", config->sweepStep).toInt());
+    config->sweepMaxPower = settings.value("Characterize/MaxPower", config->sweepMaxPower).toDouble();
+    config->sweepAlcLevel = settings.value("Characterize/AlcLevel", config->sweepAlcLevel).toDouble();
+    config->sweepMaxFaultRetries = qMax(0, settings.value("Characterize/MaxFaultRetries",
+                                                          config->sweepMaxFaultRetries).toInt());
+    if (config->sweepStart > config->sweepStop) {
+        problems << QString("[Characterize] GainStart (%1) is above GainStop (%2).")
+                        .arg(config->sweepStart).arg(config->sweepStop);
+        config->sweepStart = config->gainMin;
+        config->sweepStop = config->gainMax;
+    }
+
+    config->fineTrimEnabled = settings.value("FineTrim/Enabled", config->fineTrimEnabled).toBool();
+    const double dbPerLevel = settings.value("FineTrim/DbPerLevel", config->fineTrimDbPerLevel).toDouble();
+    const double minLevel = settings.value("FineTrim/MinLevel", config->fineTrimMinLevel).toDouble();
+    if (dbPerLevel <= 0.0 || minLevel < 0.0 || minLevel >= 100.0)
+        problems << "[FineTrim] DbPerLevel must be positive and MinLevel between 0 and 100.";
+    else {
+        config->fineTrimDbPerLevel = dbPerLevel;
+        config->fineTrimMinLevel = minLevel;
+    }
+    config->fineTrimMaxIterations = qMax(1, settings.value("FineTrim/MaxIterations", config->fineTrimMaxIterations).toInt());
+    config->fineTrimMaxRestarts = qMax(0, settings.value("FineTrim/MaxRestarts", config->fineTrimMaxRestarts).toInt());
+
+    config->predictorEnabled = settings.value("Predictor/Enabled", config->predictorEnabled).toBool();
+    config->predictorMinSamples = qMax(2, settings.value("Predictor/MinSamples", config->predictorMinSamples).toInt());
+    config->predictorMaxSigmaDb = settings.value("Predictor/MaxSigmaDb", config->predictorMaxSigmaDb).toDouble();
+    config->predictorRepeatSigmaDb = settings.value("Predictor/RepeatSigmaDb", config->predictorRepeatSigmaDb).toDouble();
+    config->predictorRidge = settings.value("Predictor/Ridge", config->predictorRidge).toDouble();
+    config->predictorBackoffSigmas = settings.value("Predictor/BackoffSigmas", config->predictorBackoffSigmas).toDouble();
+
+    const QString tier = settings.value("Tuning/Tier", config->defaultTier).toString().toLower();
+    if (TuningTier::isValid(tier))
+        config->defaultTier = tier;
+    else
+        problems << QString("[Tuning] Tier %1 is not one of %2.").arg(tier, TuningTier::names().join(", "));
+    const QStringList tierNames = TuningTier::names();
+    for (const QString &name : tierNames) {
+        TuningTier t = TuningTier::builtIn(name);
+        settings.beginGroup("Tiers/" + name);
+        t.windowBelowDb = settings.value("WindowBelowDb", t.windowBelowDb).toDouble();
+        t.windowAboveDb = settings.value("WindowAboveDb", t.windowAboveDb).toDouble();
+        t.stableToleranceDb = settings.value("StableToleranceDb", t.stableToleranceDb).toDouble();
+        t.alcToleranceDb = settings.value("AlcToleranceDb", t.alcToleranceDb).toDouble();
+        t.recheckToleranceDb = settings.value("RecheckToleranceDb", t.recheckToleranceDb).toDouble();
+        t.samples = qMax(2, settings.value("Samples", t.samples).toInt());
+        t.maxAdjustDown = qMax(1, settings.value("MaxAdjustDown", t.maxAdjustDown).toInt());
+        t.recheckMaxPolls = qMax(0, settings.value("RecheckMaxPolls", t.recheckMaxPolls).toInt());
+        settings.endGroup();
+        config->tiers.insert(name, t);
+    }
+
+    config->reuseAmpSetup = settings.value("Batch/ReuseAmpSetup", config->reuseAmpSetup).toBool();
+
+    config->budgetFileSeconds = settings.value("Budget/FileSeconds", config->budgetFileSeconds).toInt();
+    config->budgetMinSeconds = settings.value("Budget/MinSeconds", config->budgetMinSeconds).toInt();
+    config->budgetFactor = settings.value("Budget/Factor", config->budgetFactor).toDouble();
+    config->budgetMaxIterations = settings.value("Budget/MaxIterations", config->budgetMaxIterations).toInt();
+    if (config->budgetMinSeconds <= 0 || config->budgetFactor <= 0.0) {
+        problems << "[Budget] MinSeconds and Factor must be positive.";
+        config->budgetMinSeconds = 600;
+        config->budgetFactor = 3.0;
+    }
+
+    config->stragglerFactor = settings.value("Batch/StragglerFactor", config->stragglerFactor).toDouble();
+    config->statusFile = settings.value("Batch/StatusFile", "waveBatchStatus.json").toString();
+    if (QFileInfo(config->statusFile).isRelative())
+        config->statusFile = QCoreApplication::applicationDirPath() + "/" + config->statusFile;
+    config->etaSeconds = qMax(1, settings.value("Batch/EtaSeconds", config->etaSeconds).toInt());
+    config->characterizeSeconds = settings.value("Batch/CharacterizeSeconds", config->characterizeSeconds).toInt();
+    config->channelSeconds = settings.value("Batch/ChannelSeconds", config->channelSeconds).toInt();
+    config->durationWeight = qBound(0.05, settings.value("Batch/DurationWeight", config->durationWeight).toDouble(), 1.0);
+
+    const QString appDir = QCoreApplication::applicationDirPath();
+    config->journalPath = settings.value("Batch/Journal", appDir + "/waveJournal.jsonl").toString();
+    config->resumeRetries = qMax(0, settings.value("Batch/ResumeRetries", config->resumeRetries).toInt());
+    config->changeoverMs = settings.value("Batch/ChangeoverMs", config->changeoverMs).toInt();
+    config->fullSetupMs = settings.value("Batch/FullSetupMs", config->fullSetupMs).toInt();
+    config->reusedSetupMs = settings.value("Batch/ReusedSetupMs", config->reusedSetupMs).toInt();
+    if (config->changeoverMs < 0 || config->fullSetupMs < 0 || config->reusedSetupMs < 0) {
+        problems << "[Batch] ChangeoverMs, FullSetupMs and ReusedSetupMs cannot be negative.";
+        config->changeoverMs = 500;
+        config->fullSetupMs = 6200;
+        config->reusedSetupMs = 1500;
+    }
+    config->shortestFirst = settings.value("Batch/Order", "shortest").toString()
+                                .compare("shortest", Qt::CaseInsensitive) == 0;
+    config->durationBucketSeconds = qMax(1, settings.value("Batch/DurationBucketSeconds", config->durationBucketSeconds).toInt());
+
+    config->concurrentEnabled = settings.value("Concurrent/Enabled", config->concurrentEnabled).toBool();
+    config->assumeSeparateSdrs = settings.value("Concurrent/AssumeSeparateSdrs", config->assumeSeparateSdrs).toBool();
+
+    config->dedupEnabled = settings.value("Dedup/Enabled", config->dedupEnabled).toBool();
+    config->dedupVerify = settings.value("Dedup/Verify", config->dedupVerify).toBool();
+
+    config->ampSetCommandsReply = settings.value("Amp/SetCommandsReply", config->ampSetCommandsReply).toBool();
+    const int ackWindowMs = settings.value("Amp/AckWindowMs", config->ampAckWindowMs).toInt();
+    const int replyTimeoutMs = settings.value("Amp/ReplyTimeoutMs", config->ampReplyTimeoutMs).toInt();
+    if (ackWindowMs <= 0 || replyTimeoutMs <= 0) {
+        problems << "[Amp] AckWindowMs and ReplyTimeoutMs must be positive.";
+    } else {
+        config->ampAckWindowMs = ackWindowMs;
+        config->ampReplyTimeoutMs = replyTimeoutMs;
+    }
+
+    config->watchdogEnabled = settings.value("Watchdog/Enabled", config->watchdogEnabled).toBool();
+    config->watchdogMinReturnLossDb = settings.value("Watchdog/MinReturnLossDb", config->watchdogMinReturnLossDb).toDouble();
+    config->watchdogMinFwdDbm = settings.value("Watchdog/MinFwdDbm", config->watchdogMinFwdDbm).toDouble();
+    config->watchdogMaxDropDb = settings.value("Watchdog/MaxDropDb", config->watchdogMaxDropDb).toDouble();
+    config->watchdogConsecutiveBad = qMax(1, settings.value("Watchdog/ConsecutiveBad", config->watchdogConsecutiveBad).toInt());
+    config->watchdogWindowMs = settings.value("Watchdog/WindowMs", config->watchdogWindowMs).toInt();
+    config->watchdogPairWindowMs = settings.value("Watchdog/PairWindowMs", config->watchdogPairWindowMs).toInt();
+    const int pollMs = settings.value("Watchdog/PollMs", config->watchdogPollMs).toInt();
+    if (pollMs <= 0)
+        problems << "[Watchdog] PollMs must be positive.";
+    else
+        config->watchdogPollMs = pollMs;
+
+    config->calibratePollMs = qMax(1, settings.value("Calibrate/PollMs", config->calibratePollMs).toInt());
+    config->calibrateTimeoutMs = settings.value("Calibrate/TimeoutMs", config->calibrateTimeoutMs).toInt();
+    config->calibrateToleranceDb = settings.value("Calibrate/ToleranceDb", config->calibrateToleranceDb).toDouble();
+    config->calibrateHoldMs = settings.value("Calibrate/HoldMs", config->calibrateHoldMs).toInt();
+    config->calibrateRounds = qMax(1, settings.value("Calibrate/Rounds", config->calibrateRounds).toInt());
+    config->calibrateMinSettledRounds = qBound(1, settings.value("Calibrate/MinSettledRounds",
+                                                                 config->calibrateMinSettledRounds).toInt(),
+                                               config->calibrateRounds);
+    config->calibratePromptTimeoutMs = settings.value("Calibrate/PromptTimeoutMs", config->calibratePromptTimeoutMs).toInt();
+    config->calibrateAlcBelowDb = settings.value("Calibrate/AlcBelowDb", config->calibrateAlcBelowDb).toDouble();
+
+    config->simulationEnabled = settings.value("Simulation/Enabled", config->simulationEnabled).toBool();
+    config->simOffsetDbm = settings.value("Simulation/OffsetDbm", config->simOffsetDbm).toDouble();
+    config->simDbPerGain = settings.value("Simulation/DbPerGain", config->simDbPerGain).toDouble();
+    config->simReturnLossDb = settings.value("Simulation/ReturnLossDb", config->simReturnLossDb).toDouble();
+    config->simAlcRangeDb = settings.value("Simulation/AlcRangeDb", config->simAlcRangeDb).toDouble();
+    config->simNoiseDb = qMax(0.0, settings.value("Simulation/NoiseDb", config->simNoiseDb).toDouble());
+    config->simLatencyMs = qMax(0, settings.value("Simulation/LatencyMs", config->simLatencyMs).toInt());
+    config->simStartupMs = qMax(0, settings.value("Simulation/StartupMs", config->simStartupMs).toInt());
+    config->simStubProcess = settings.value("Simulation/StubProcess", config->simStubProcess).toString();
+
+    config->soakSampleEvery = qMax(1, settings.value("Soak/SampleEvery", config->soakSampleEvery).toInt());
+    config->soakWarmupPercent = qBound(0, settings.value("Soak/WarmupPercent", config->soakWarmupPercent).toInt(), 80);
+    config->soakSamplesFile = settings.value("Soak/SamplesFile", appDir + "/waveSoak.csv").toString();
+    config->soakMaxRssKbPer1000 = settings.value("Soak/MaxRssKbPer1000", config->soakMaxRssKbPer1000).toDouble();
+    config->soakMaxHeapKbPer1000 = settings.value("Soak/MaxHeapKbPer1000", config->soakMaxHeapKbPer1000).toDouble();
+    config->soakMaxFdsPer1000 = settings.value("Soak/MaxFdsPer1000", config->soakMaxFdsPer1000).toDouble();
+    config->soakMaxObjectsPer1000 = settings.value("Soak/MaxObjectsPer1000", config->soakMaxObjectsPer1000).toDouble();
+    config->soakMaxChildrenPer1000 = settings.value("Soak/MaxChildrenPer1000", config->soakMaxChildrenPer1000).toDouble();
+    config->soakStubProcess = settings.value("Soak/StubProcess", config->soakStubProcess).toString();
+
+    bool portOk = false;
+    const uint port = settings.value("Distributed/Port", config->distributedPort).toUInt(&portOk);
+    if (!portOk || port == 0 || port > 65535)
+        problems << "[Distributed] Port must be between 1 and 65535.";
+    else
+        config->distributedPort = quint16(port);
+    config->distributedBind = settings.value("Distributed/Bind", config->distributedBind).toString().trimmed();
+    config->distributedToken = settings.value("Distributed/Token").toString();
+    const int leaseMs = settings.value("Distributed/LeaseMs", config->leaseMs).toInt();
+    const int heartbeatMs = settings.value("Distributed/HeartbeatMs", config->heartbeatMs).toInt();
+    if (heartbeatMs <= 0 || leaseMs <= heartbeatMs) {
+        problems << "[Distributed] HeartbeatMs must be positive and LeaseMs longer than it.";
+    } else {
+        config->leaseMs = leaseMs;
+        config->heartbeatMs = heartbeatMs;
+    }
+    config->maxAttempts = qMax(1, settings.value("Distributed/MaxAttempts", config->maxAttempts).toInt());
+    config->resultsPath = settings.value("Distributed/Results", appDir + "/waveResults.jsonl").toString();
+    config->maxReconnects = qMax(0, settings.value("Distributed/MaxReconnects", config->maxReconnects).toInt());
+    config->workerName = settings.value("Distributed/WorkerName").toString().trimmed();
+
+    config->daemonSocket = settings.value("Daemon/Socket", config->daemonSocket).toString().trimmed();
+    if (config->daemonSocket.isEmpty()) {
+        problems << "[Daemon] Socket cannot be empty.";
+        config->daemonSocket = "gnuwavegaintuner";
+    }
+    config->daemonKeepFinished = qMax(0, settings.value("Daemon/KeepFinished", config->daemonKeepFinished).toInt());
+
+    if (errors)
+        *errors = problems;
+    return config;
+}
+
+std::shared_ptr<const TuneConfig> TuneConfig::current()
+{
+    QMutexLocker locker(&s_mutex);
+    if (!s_current) {
+        QStringList errors;
+        std::shared_ptr<TuneConfig> config = load(&errors);
+        for (const QString &error : qAsConst(errors))
+            qWarning() << "Config:" << error << "Using the default.";
+        config->generation = ++s_generation;
+        s_current = config;
+    }
+    return s_current;
+}
+
+bool TuneConfig::hasPending()
+{
+    QMutexLocker locker(&s_mutex);
+    return bool(s_pending);
+}
+
+bool TuneConfig::applyPending()
+{
+    QMutexLocker locker(&s_mutex);
+    if (!s_pending)
+        return false;
+    s_current = s_pending;
+    s_pending.reset();
+    return true;
+}
+
+TuneConfigWatcher::TuneConfigWatcher(QObject *parent)
+    : QObject(parent),
+    m_watcher(new QFileSystemWatcher(this)),
+    m_debounce(new QTimer(this))
+{
+    // Load the first snapshot before anything reads it from a worker thread.
+    TuneConfig::current();
+
+    m_debounce->setSingleShot(true);
+    m_debounce->setInterval(500);
+    connect(m_debounce, &QTimer::timeout, this, &TuneConfigWatcher::stage);
+    connect(m_watcher, &QFileSystemWatcher::fileChanged, this, &TuneConfigWatcher::onFileChanged);
+    // The directory catches files that are created, or replaced by an editor's rename.
+    connect(m_watcher, &QFileSystemWatcher::directoryChanged, this, &TuneConfigWatcher::onFileChanged);
+    m_stamp = stamp();
+    m_watcher->addPath(QCoreApplication::applicationDirPath());
+    for (const QString &path : {TuneConfig::configPath(), SettleProfileStore::storePath()}) {
+        if (QFileInfo::exists(path))
+            m_watcher->addPath(path);
+    }
+}
+
+QString TuneConfigWatcher::stamp()
+{
+    QStringList parts;
+    for (const QString &file : {TuneConfig::configPath(), SettleProfileStore::storePath()}) {
+        QFileInfo info(file);
+        parts << (info.exists() ? QString("%1:%2").arg(info.lastModified().toMSecsSinceEpoch()).arg(info.size())
+                                : QString("-"));
+    }
+    return parts.join(';');
+}
+
+void TuneConfigWatcher::onFileChanged(const QString &path)
+{
+    Q_UNUSED(path);
+    // A replaced file drops out of the watch list; pick it up again.
+    for (const QString &file : {TuneConfig::configPath(), SettleProfileStore::storePath()}) {
+        if (QFileInfo::exists(file) && !m_watcher->files().contains(file))
+            m_watcher->addPath(file);
+    }
+    // Logs and journals in the same directory change all the time.
+    const QString now = stamp();
+    if (now == m_stamp)
+        return;
+    m_stamp = now;
+    m_debounce->start();
+}
+
+void TuneConfigWatcher::stage()
+{
+    QStringList errors;
+    std::shared_ptr<TuneConfig> config = TuneConfig::load(&errors);
+    if (!errors.isEmpty()) {
+        qWarning() << "Config change ignored:" << errors.join(" ");
+        emit reloadRejected(errors);
+        return;
+    }
+    int generation = 0;
+    {
+        QMutexLocker locker(&s_mutex);
+        config->generation = generation = ++s_generation;
+        s_pending = config;
+    }
+    qDebug() << "Config change staged as generation" << generation << "; it applies from the next file.";
+    emit reloadStaged(generation);
+}
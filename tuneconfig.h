@@ -0,0 +1,208 @@
+#ifndef TUNECONFIG_H
+#define TUNECONFIG_H
+
+#include <QObject>
+#include <QMap>
+#include <QRegularExpression>
+#include <QString>
+#include <QStringList>
+#include <memory>
+#include "settleprofile.h"
+#include "tuningtier.h"
+
+class QFileSystemWatcher;
+class QTimer;
+
+// One validated, read-only view of waveTuneConfig.ini (and the settle profiles in
+// waveSettle.ini); nothing else reads the config file. Snapshots are shared
+// between threads and never change; a reload produces a new one.
+struct TuneConfig {
+    int generation = 0;         // Increases with every applied reload
+
+    // [Gain] range accepted for set_gain edits and searches.
+    int gainMin = -10;
+    int gainMax = 60;
+
+    // [Exclusions] keys, compiled into one case-insensitive matcher.
+    QStringList exclusions;
+    QRegularExpression exclusionMatcher;
+
+    // [Amplifiers] device names for L1 and L2, empty when not pinned.
+    QString ampL1;
+    QString ampL2;
+
+    // [Settle] margins and the calibrated settle profiles, keyed by SettleProfileStore::key().
+    bool useSettleProfiles = true;
+    double settleMarginPercent = 25.0;
+    int settleMarginMs = 100;
+    QMap<QString, SettleProfile> settleProfiles;
+
+    // [Python] Interpreter and [Injection] LaunchOverrides.
+    QString pythonInterpreter = "python3";
+    bool launchOverrides = false;
+
+    // [Characterize] gain sweep.
+    int sweepStart = 0;             // Defaults to gainMin
+    int sweepStop = 60;             // Defaults to gainMax
+    int sweepStep = 1;
+    double sweepMaxPower = 50.0;
+    double sweepAlcLevel = 0.0;
+    int sweepMaxFaultRetries = 2;   // Per point, before the sweep ends at the last good one
+
+    // [FineTrim] VVA trim of the max power.
+    bool fineTrimEnabled = false;
+    double fineTrimDbPerLevel = 0.1;
+    double fineTrimMinLevel = 50.0;
+    int fineTrimMaxIterations = 6;
+    int fineTrimMaxRestarts = 2;
+
+    // [Predictor] starting gain model.
+    bool predictorEnabled = true;
+    int predictorMinSamples = 13;   // Never fewer than the feature count + 2
+    double predictorMaxSigmaDb = 2.0;
+    double predictorRepeatSigmaDb = 0.5;
+    double predictorRidge = 1.0;
+    double predictorBackoffSigmas = 1.0;
+
+    // [Tuning] Tier and every tier with its [Tiers] overrides applied, keyed by name.
+    QString defaultTier = "production";
+    QMap<QString, TuningTier> tiers;
+
+    // [Batch] ReuseAmpSetup.
+    bool reuseAmpSetup = true;
+
+    // [Budget] limits before a file is parked; fileSeconds 0 scales the predicted duration.
+    int budgetFileSeconds = 0;
+    int budgetMinSeconds = 600;
+    double budgetFactor = 3.0;
+    int budgetMaxIterations = 40;
+
+    // [Batch] ETA reporting and the duration defaults it falls back on.
+    double stragglerFactor = 2.0;
+    QString statusFile;             // Absolute path of waveBatchStatus.json
+    int etaSeconds = 30;
+    int characterizeSeconds = 300;  // Per channel
+    int channelSeconds = 90;
+    double durationWeight = 0.3;    // Weight of the newest run in the moving averages
+
+    // [Batch] planning, journal and pacing.
+    QString journalPath;            // Defaults to waveJournal.jsonl next to the application
+    int resumeRetries = 1;
+    int changeoverMs = 500;
+    int fullSetupMs = 6200;
+    int reusedSetupMs = 1500;
+    bool shortestFirst = true;      // Order=shortest
+    int durationBucketSeconds = 120;
+
+    // [Concurrent] lanes.
+    bool concurrentEnabled = false;
+    bool assumeSeparateSdrs = false;
+
+    // [Dedup] equivalent flowgraphs.
+    bool dedupEnabled = true;
+    bool dedupVerify = true;
+
+    // [Amp] serial protocol.
+    bool ampSetCommandsReply = false;
+    int ampAckWindowMs = 300;
+    int ampReplyTimeoutMs = 1000;
+
+    // [Watchdog] load monitoring while transmitting.
+    bool watchdogEnabled = true;
+    double watchdogMinReturnLossDb = 9.5;   // About 2:1 VSWR
+    double watchdogMinFwdDbm = 10.0;
+    double watchdogMaxDropDb = 3.0;
+    int watchdogConsecutiveBad = 3;
+    int watchdogWindowMs = 5000;
+    int watchdogPairWindowMs = 1000;
+    int watchdogPollMs = 500;
+
+    // [Calibrate] settle measurements.
+    int calibratePollMs = 100;
+    int calibrateTimeoutMs = 15000;
+    double calibrateToleranceDb = 0.1;
+    int calibrateHoldMs = 1500;
+    int calibrateRounds = 3;
+    int calibrateMinSettledRounds = 2;
+    int calibratePromptTimeoutMs = 60000;
+    double calibrateAlcBelowDb = 2.0;
+
+    // [Simulation] rig model.
+    bool simulationEnabled = false;
+    double simOffsetDbm = 20.0;
+    double simDbPerGain = 0.5;
+    double simReturnLossDb = 20.0;
+    double simAlcRangeDb = 15.0;
+    double simNoiseDb = 0.02;
+    int simLatencyMs = 20;
+    int simStartupMs = 300;
+    QString simStubProcess;
+
+    // [Soak] leak checks.
+    int soakSampleEvery = 20;
+    int soakWarmupPercent = 20;
+    QString soakSamplesFile;        // Defaults to waveSoak.csv next to the application
+    double soakMaxRssKbPer1000 = 2048.0;
+    double soakMaxHeapKbPer1000 = 1024.0;
+    double soakMaxFdsPer1000 = 1.0;
+    double soakMaxObjectsPer1000 = 5.0;
+    double soakMaxChildrenPer1000 = 1.0;
+    QString soakStubProcess = "cat";
+
+    // [Distributed] coordinator and workers.
+    quint16 distributedPort = 47800;
+    QString distributedBind = "127.0.0.1";
+    QString distributedToken;
+    int leaseMs = 120000;
+    int maxAttempts = 3;
+    QString resultsPath;            // Defaults to waveResults.jsonl next to the application
+    int heartbeatMs = 10000;
+    int maxReconnects = 10;
+    QString workerName;             // Empty for host:pid
+
+    // [Daemon] local socket.
+    QString daemonSocket = "gnuwavegaintuner";
+    int daemonKeepFinished = 200;   // Finished jobs kept for status
+
+    bool isExcluded(const QString &fileName) const;
+    // The configured amps (L1 first), empty if neither is pinned.
+    QStringList pinnedAmps() const;
+
+    // The snapshot in effect; loads one on first use. Safe to call from any thread.
+    static std::shared_ptr<const TuneConfig> current();
+    static QString configPath();
+
+    // Reads the files; problems are listed in errors, and the affected settings keep
+    // their defaults.
+    static std::shared_ptr<TuneConfig> load(QStringList *errors);
+
+    // Makes a reload staged by TuneConfigWatcher current, if there is one. Call only while
+    // no tune is running; returns true if one was applied. Tuners keep the snapshot they
+    // started with, so a tune never sees two configurations.
+    static bool applyPending();
+    static bool hasPending();
+};
+
+// Watches the config files and stages a validated snapshot whenever they change. An edit
+// that fails validation is reported and ignored, and the current snapshot stays in effect.
+class TuneConfigWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TuneConfigWatcher(QObject *parent = nullptr);
+
+signals:
+    void reloadStaged(int generation);
+    void reloadRejected(const QStringList &errors);
+
+private:
+    static QString stamp();
+    void onFileChanged(const QString &path);
+    void stage();
+
+    QFileSystemWatcher *m_watcher;
+    QTimer *m_debounce;         // Editors write in several steps
+    QString m_stamp;            // Modification times and sizes of the watched files
+};
+
+#endif // TUNECONFIG_H
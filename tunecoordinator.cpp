@@ -0,0 +1,259 @@
+#include "tunecoordinator.h"
+#include "tuneconfig.h"
+#include "batchjournal.h"
+#include "wavelogger.h"
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QJsonDocument>
+#include <QDateTime>
+#include <QTimer>
+#include <QDebug>
+
+TuneCoordinator::TuneCoordinator(const QList<TuneJob> &jobs, QObject *parent)
+    : QObject(parent),
+    m_server(new QTcpServer(this)),
+    m_leaseTimer(new QTimer(this)),
+    m_journal(new BatchJournal(BatchJournal::defaultPath(), this)),
+    m_logger(new WaveLogger(this))
+{
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    m_leaseMs = config->leaseMs;
+    m_maxAttempts = config->maxAttempts;
+    m_bind = config->distributedBind;
+    m_token = config->distributedToken;
+    m_results.setFileName(config->resultsPath);
+
+    // The journal doubles as the coordinator's crash-safe job state.
+    if (!m_journal->open())
+        qWarning() << "Coordinator journal unavailable; an interrupted run cannot be resumed.";
+    for (const TuneJob &job : jobs) {
+        const QString state = m_journal->entry(job).state;
+        if (state == "done" || state == "failed")
+            continue;
+        if (!m_journal->contains(job))
+            m_journal->markPending(job);
+        m_queue << job;
+    }
+    if (!m_results.open(QIODevice::WriteOnly | QIODevice::Append))
+        qWarning() << "Cannot open results store:" << m_results.fileName();
+
+    m_leaseTimer->setInterval(1000);
+    connect(m_leaseTimer, &QTimer::timeout, this, &TuneCoordinator::checkLeases);
+    connect(m_server, &QTcpServer::newConnection, this, &TuneCoordinator::onNewConnection);
+}
+
+TuneCoordinator::~TuneCoordinator()
+{
+    if (m_results.isOpen())
+        m_results.close();
+}
+
+quint16 TuneCoordinator::port()
+{
+    return TuneConfig::current()->distributedPort;
+}
+
+bool TuneCoordinator::listen()
+{
+    // Workers get to edit waveform files on shared storage, so none is taken on trust.
+    if (m_token.isEmpty()) {
+        qWarning() << "Set [Distributed] Token on the coordinator and every worker before listening.";
+        return false;
+    }
+    QHostAddress address;
+    if (!address.setAddress(m_bind)) {
+        qWarning() << "Invalid [Distributed] Bind address:" << m_bind;
+        return false;
+    }
+    if (!m_server->listen(address, port())) {
+        qWarning() << "Cannot listen on" << m_bind << "port" << port() << ":" << m_server->errorString();
+        return false;
+    }
+    m_logger->debugAndLog(QString("Coordinator listening on %1 port %2 with %3 job(s)")
+                              .arg(m_bind).arg(m_server->serverPort()).arg(m_queue.size()));
+    m_leaseTimer->start();
+    // Nothing left from a previous run: finish as soon as the event loop starts.
+    QTimer::singleShot(0, this, &TuneCoordinator::finishIfDone);
+    return true;
+}
+
+void TuneCoordinator::onNewConnection()
+{
+    while (QTcpSocket *worker = m_server->nextPendingConnection()) {
+        connect(worker, &QTcpSocket::disconnected, this, [this, worker]() {
+            // Whatever it held goes back to the queue right away.
+            const QList<Lease> leases = m_leases.values();
+            for (const Lease &lease : leases) {
+                if (lease.worker == worker)
+                    requeue(lease, QString("worker %1 disconnected").arg(m_workers.value(worker)));
+            }
+            m_workers.remove(worker);
+            worker->deleteLater();
+        });
+        connect(worker, &QTcpSocket::readyRead, this, [this, worker]() {
+            while (worker->canReadLine()) {
+                QByteArray line = worker->readLine().trimmed();
+                if (line.isEmpty())
+                    continue;
+                QJsonDocument doc = QJsonDocument::fromJson(line);
+                if (!doc.isObject()) {
+                    qWarning() << "Malformed message from worker:" << line;
+                    continue;
+                }
+                handleMessage(worker, doc.object());
+            }
+        });
+    }
+}
+
+void TuneCoordinator::handleMessage(QTcpSocket *worker, const QJsonObject &message)
+{
+    const QString cmd = message.value("cmd").toString();
+    if (cmd == "hello") {
+        if (message.value("token").toString() != m_token) {
+            m_logger->debugAndLog(QString("Rejected worker %1 from %2: bad token")
+                                      .arg(message.value("worker").toString(), worker->peerAddress().toString()));
+            send(worker, QJsonObject{{"event", "rejected"}, {"error", "Bad token."}});
+            worker->disconnectFromHost();
+            return;
+        }
+        m_workers.insert(worker, message.value("worker").toString());
+        m_logger->debugAndLog(QString("Worker %1 connected").arg(m_workers.value(worker)));
+        return;
+    }
+    if (!m_workers.contains(worker)) {
+        qWarning() << "Ignoring" << cmd << "from" << worker->peerAddress().toString() << "before hello";
+        return;
+    }
+    if (cmd == "request") {
+        assign(worker);
+    } else if (cmd == "heartbeat") {
+        renew(worker);
+    } else if (cmd == "progress") {
+        const int id = message.value("lease").toInt();
+        // Progress from a revoked lease must not move the resume point of its new holder.
+        if (!m_leases.contains(id) || m_leases.value(id).worker != worker)
+            return;
+        m_journal->markRunning(m_leases.value(id).job, message.value("channel").toInt(),
+                               message.value("gain").toInt(), message.value("iteration").toInt());
+        renew(worker);
+    } else if (cmd == "result") {
+        const int id = message.value("lease").toInt();
+        // A result for a lease that was revoked is ignored; the job's new holder reports.
+        if (!m_leases.contains(id) || m_leases.value(id).worker != worker) {
+            m_logger->debugAndLog(QString("Ignoring result for revoked lease %1 from %2")
+                                      .arg(id).arg(m_workers.value(worker)));
+            return;
+        }
+        const Lease lease = m_leases.take(id);
+        complete(lease, message.value("ok").toBool(), message.value("detail").toString(), message);
+        finishIfDone();
+    }
+}
+
+void TuneCoordinator::assign(QTcpSocket *worker)
+{
+    if (m_queue.isEmpty()) {
+        if (m_leases.isEmpty())
+            send(worker, QJsonObject{{"event", "done"}});
+        else
+            send(worker, QJsonObject{{"event", "idle"}, {"retryMs", 5000}});
+        return;
+    }
+
+    Lease lease;
+    lease.id = m_nextLease++;
+    lease.job = m_queue.takeFirst();
+    lease.worker = worker;
+    lease.expires = QDateTime::currentMSecsSinceEpoch() + m_leaseMs;
+    m_leases.insert(lease.id, lease);
+
+    QJsonObject message{{"event", "job"}, {"lease", lease.id}, {"job", JobManifest::toJson(lease.job)},
+                        {"leaseMs", m_leaseMs}};
+    const JournalEntry entry = m_journal->entry(lease.job);
+    if (entry.state == "running" && !lease.job.characterize)
+        message.insert("resume", QJsonObject{{"channel", entry.channel}, {"gain", entry.gain}});
+    send(worker, message);
+    m_logger->debugAndLog(QString("Lease %1: %2 -> %3").arg(lease.id).arg(lease.job.file, m_workers.value(worker)));
+}
+
+void TuneCoordinator::renew(QTcpSocket *worker)
+{
+    const qint64 expires = QDateTime::currentMSecsSinceEpoch() + m_leaseMs;
+    for (Lease &lease : m_leases) {
+        if (lease.worker == worker)
+            lease.expires = expires;
+    }
+}
+
+void TuneCoordinator::checkLeases()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const QList<Lease> leases = m_leases.values();
+    for (const Lease &lease : leases) {
+        if (now <= lease.expires)
+            continue;
+        // The worker may still be driving its rig; tell it to stop before the job moves on.
+        if (m_workers.contains(lease.worker))
+            send(lease.worker, QJsonObject{{"event", "revoke"}, {"lease", lease.id}});
+        requeue(lease, QString("lease held by %1 expired").arg(m_workers.value(lease.worker)));
+    }
+}
+
+void TuneCoordinator::requeue(const Lease &lease, const QString &why)
+{
+    m_leases.remove(lease.id);
+    const QString key = BatchJournal::keyFor(lease.job);
+    const int attempts = ++m_attempts[key];
+    if (attempts >= m_maxAttempts) {
+        complete(lease, false, QString("gave up after %1 attempts: %2").arg(attempts).arg(why), QJsonObject());
+        finishIfDone();
+        return;
+    }
+    m_logger->debugAndLog(QString("Lease %1 for %2 returned to the queue: %3").arg(lease.id).arg(lease.job.file, why));
+    m_queue.prepend(lease.job);
+}
+
+void TuneCoordinator::complete(const Lease &lease, bool ok, const QString &detail, const QJsonObject &message)
+{
+    if (ok) {
+        m_journal->markDone(lease.job, detail);
+    } else {
+        m_journal->markFailed(lease.job, detail);
+        ++m_failures;
+    }
+    QJsonObject record = JobManifest::toJson(lease.job);
+    record.insert("ok", ok);
+    record.insert("worker", m_workers.value(lease.worker));
+    record.insert("detail", detail);
+    if (message.contains("channels"))
+        record.insert("channels", message.value("channels"));
+    if (message.contains("link"))
+        record.insert("link", message.value("link"));
+    record.insert("time", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    if (m_results.isOpen()) {
+        m_results.write(QJsonDocument(record).toJson(QJsonDocument::Compact) + "\n");
+        m_results.flush();
+    }
+    m_logger->debugAndLog(QString("%1 %2 on %3%4").arg(lease.job.file, ok ? "done" : "failed",
+                                                       m_workers.value(lease.worker),
+                                                       detail.isEmpty() ? QString() : ": " + detail));
+}
+
+void TuneCoordinator::finishIfDone()
+{
+    if (m_finished || !m_queue.isEmpty() || !m_leases.isEmpty())
+        return;
+    m_finished = true;
+    for (auto it = m_workers.cbegin(); it != m_workers.cend(); ++it)
+        send(it.key(), QJsonObject{{"event", "done"}});
+    m_journal->clear();
+    m_logger->debugAndLog(QString("All jobs finished, %1 failed").arg(m_failures));
+    emit finished(m_failures);
+}
+
+void TuneCoordinator::send(QTcpSocket *worker, const QJsonObject &message)
+{
+    worker->write(QJsonDocument(message).toJson(QJsonDocument::Compact) + "\n");
+    worker->flush();
+}
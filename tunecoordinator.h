@@ -0,0 +1,86 @@
+#ifndef TUNECOORDINATOR_H
+#define TUNECOORDINATOR_H
+
+#include <QObject>
+#include <QFile>
+#include <QList>
+#include <QMap>
+#include <QJsonObject>
+#include "tunejob.h"
+
+class BatchJournal;
+class QTcpServer;
+class QTcpSocket;
+class QTimer;
+class WaveLogger;
+
+// Distributed mode, coordinator side. Owns the job list and the results store and hands
+// jobs to TuneWorker processes on the bench hosts over TCP, one JSON object per line:
+//   worker -> {"cmd":"hello","worker":name,"token":...}
+//             {"cmd":"request"}
+//             {"cmd":"progress","lease":N,"channel":c,"gain":g,"iteration":i}
+//             {"cmd":"result","lease":N,"ok":bool,"detail":...,"channels":[...]}
+//             {"cmd":"heartbeat"}
+//   coord  -> {"event":"job","lease":N,"job":{...},"resume":{"channel":c,"gain":g}}
+//             {"event":"idle","retryMs":ms}    (nothing free now, other jobs still leased)
+//             {"event":"revoke","lease":N}  (the lease expired; stop tuning it)
+//             {"event":"rejected","error":...}
+//             {"event":"done"}
+// The coordinator listens on [Distributed] Bind (localhost unless set) and drops any
+// connection whose hello does not carry [Distributed] Token; nothing else is accepted
+// before it. Every assignment is a lease renewed by the worker's progress and
+// heartbeats; a lease that expires is revoked from its worker, and it or one whose
+// worker disconnects puts the job back at the head of the queue, resuming from the last
+// progress the coordinator saw. Progress and results count only from the lease holder.
+class TuneCoordinator : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TuneCoordinator(const QList<TuneJob> &jobs, QObject *parent = nullptr);
+    ~TuneCoordinator();
+
+    bool listen();
+    static quint16 port();
+
+signals:
+    void finished(int failures);
+
+private slots:
+    void onNewConnection();
+    void checkLeases();
+
+private:
+    struct Lease {
+        int id = 0;
+        TuneJob job;
+        QTcpSocket *worker = nullptr;
+        qint64 expires = 0;
+    };
+
+    void handleMessage(QTcpSocket *worker, const QJsonObject &message);
+    void assign(QTcpSocket *worker);
+    void requeue(const Lease &lease, const QString &why);
+    void complete(const Lease &lease, bool ok, const QString &detail, const QJsonObject &message);
+    void renew(QTcpSocket *worker);
+    void send(QTcpSocket *worker, const QJsonObject &message);
+    void finishIfDone();
+
+    QTcpServer *m_server;
+    QTimer *m_leaseTimer;
+    BatchJournal *m_journal;
+    WaveLogger *m_logger;
+    QFile m_results;
+    QList<TuneJob> m_queue;
+    QMap<int, Lease> m_leases;
+    QMap<QTcpSocket*, QString> m_workers;   // Connections that sent a valid hello
+    QMap<QString, int> m_attempts;      // Per journal key
+    QString m_bind;
+    QString m_token;
+    int m_nextLease = 1;
+    int m_failures = 0;
+    int m_leaseMs;
+    int m_maxAttempts;
+    bool m_finished = false;
+};
+
+#endif // TUNECOORDINATOR_H
@@ -0,0 +1,116 @@
+#include "tuneduration.h"
+#include "gainpredictor.h"
+#include "tuningtier.h"
+#include "storekey.h"
+#include "waveformdedup.h"
+#include "simulatedrig.h"
+#include "tuneconfig.h"
+#include <QCoreApplication>
+#include <QSettings>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDebug>
+
+// Keyed by the flowgraph's content hash like the gain history, so same-named files in
+// different directories keep separate durations; the absolute path if it cannot be read.
+static QString fileGroup(const TuneJob &job)
+{
+    QString key = QString::fromLatin1(WaveformDedup::contentHash(job.file));
+    if (key.isEmpty())
+        key = QFileInfo(job.file).absoluteFilePath();
+    return QString("Files/%1/%2/%3").arg(StoreKey::segment(key),
+                                         job.ampModel.toLower(), TuningTier::named(job.tier).name);
+}
+
+static QString categoryGroup(const TuneJob &job, const QString &category)
+{
+    return QString("Categories/%1/%2").arg(category, TuningTier::named(job.tier).name);
+}
+
+QString TuneDurationStore::storePath()
+{
+    if (SimulatedRig::isEnabled())
+        return SimulatedRig::instance().sandboxPath("waveDurations.ini");
+    return QCoreApplication::applicationDirPath() + "/waveDurations.ini";
+}
+
+QString TuneDurationStore::category(const QString &file)
+{
+    const FlowgraphFeatures features = FlowgraphFeatures::extract(file, QString(), 0);
+    if (!features.ok)
+        return "unknown";
+    const QStringList names = FlowgraphFeatures::names();
+    auto has = [&](const char *name) {
+        const int i = names.indexOf(name);
+        return i >= 0 && features.values.at(i) > 0.5;
+    };
+    QString family = "other";
+    if (has("Ofdm"))
+        family = "ofdm";
+    else if (has("Digital"))
+        family = "digital";
+    else if (has("AnalogMod"))
+        family = "analog";
+    else if (has("Noise"))
+        family = "noise";
+    else if (has("Tone"))
+        family = "tone";
+    return family + (has("TwoChannel") ? "-2ch" : "-1ch");
+}
+
+DurationEstimate TuneDurationStore::predict(const TuneJob &job, const QString &category, int channels)
+{
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    DurationEstimate estimate;
+    if (job.characterize) {
+        estimate.seconds = channels * config->characterizeSeconds;
+        estimate.source = "default";
+        return estimate;
+    }
+
+    QSettings settings(storePath(), QSettings::IniFormat);
+    for (const QString &group : {fileGroup(job), categoryGroup(job, category)}) {
+        settings.beginGroup(group);
+        if (settings.contains("Seconds")) {
+            estimate.seconds = qRound(settings.value("Seconds").toDouble());
+            estimate.runs = qRound(settings.value("Runs", 0.0).toDouble());
+            estimate.source = group.startsWith("Files/") ? "history" : "category";
+            settings.endGroup();
+            return estimate;
+        }
+        settings.endGroup();
+    }
+    estimate.seconds = channels * config->channelSeconds;
+    estimate.source = "default";
+    return estimate;
+}
+
+bool TuneDurationStore::record(const TuneJob &job, const QString &category, int seconds, int runs)
+{
+    if (job.characterize)
+        return true;
+    const double weight = TuneConfig::current()->durationWeight;
+
+    QSettings settings(storePath(), QSettings::IniFormat);
+    for (const QString &group : {fileGroup(job), categoryGroup(job, category)}) {
+        settings.beginGroup(group);
+        const int count = settings.value("Count", 0).toInt();
+        // The first few runs of a category are averaged evenly.
+        const double w = count == 0 ? 1.0 : qMax(weight, 1.0 / (count + 1));
+        const double oldSeconds = settings.value("Seconds", double(seconds)).toDouble();
+        const double oldRuns = settings.value("Runs", double(runs)).toDouble();
+        settings.setValue("Seconds", oldSeconds + w * (seconds - oldSeconds));
+        settings.setValue("Runs", oldRuns + w * (runs - oldRuns));
+        settings.setValue("Count", count + 1);
+        settings.setValue("Last", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+        if (group.startsWith("Files/"))
+            settings.setValue("File", QFileInfo(job.file).absoluteFilePath());
+        settings.endGroup();
+    }
+    settings.sync();
+    if (settings.status() != QSettings::NoError) {
+        qWarning() << "Failed to write tune durations:" << storePath();
+        return false;
+    }
+    return true;
+}
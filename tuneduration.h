@@ -0,0 +1,30 @@
+#ifndef TUNEDURATION_H
+#define TUNEDURATION_H
+
+#include <QString>
+#include "tunejob.h"
+
+struct DurationEstimate {
+    int seconds = 0;        // Expected wall time for the whole file
+    int runs = 0;           // Expected waveform runs, 0 if unknown
+    QString source;         // "history", "category" or "default"
+};
+
+// Remembers how long files took to tune in waveDurations.ini next to the application,
+// per file content (and amp model and tier) and per flowgraph category, and predicts the next
+// run from them. A file never tuned before is predicted from its category's average,
+// and a category never seen from the [Batch] ChannelSeconds default.
+class TuneDurationStore
+{
+public:
+    static QString storePath();
+
+    // Modulation family and channel count of a flowgraph, such as "ofdm-2ch".
+    static QString category(const QString &file);
+
+    static DurationEstimate predict(const TuneJob &job, const QString &category, int channels);
+    // Records a finished file once; seconds and runs include any parked attempts.
+    static bool record(const TuneJob &job, const QString &category, int seconds, int runs);
+};
+
+#endif // TUNEDURATION_H
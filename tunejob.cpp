@@ -0,0 +1,151 @@
+#include "tunejob.h"
+#include "tuningtier.h"
+#include <QSettings>
+#include <QDir>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <algorithm>
+
+bool JobManifest::isValidAmpModel(const QString &ampModel)
+{
+    return ampModel.compare("x300", Qt::CaseInsensitive) == 0 ||
+           ampModel.compare("N321", Qt::CaseInsensitive) == 0;
+}
+
+bool JobManifest::isValidCritical(const QString &critical)
+{
+    return critical.compare("HIGH", Qt::CaseInsensitive) == 0 ||
+           critical.compare("LOW", Qt::CaseInsensitive) == 0;
+}
+
+bool JobManifest::load(const QString &path, QList<TuneJob> *jobs, QStringList *errors)
+{
+    if (!QFileInfo::exists(path)) {
+        errors->append(QString("Job file %1 does not exist.").arg(path));
+        return false;
+    }
+    QSettings settings(path, QSettings::IniFormat);
+    if (settings.status() != QSettings::NoError) {
+        errors->append(QString("Job file %1 cannot be parsed.").arg(path));
+        return false;
+    }
+
+    // QSettings maps the [General] section to top-level keys.
+    auto value = [&settings](const QString &group, const QString &key, const QVariant &fallback) {
+        QVariant general = settings.value(key, fallback);
+        return settings.value(group + "/" + key, general);
+    };
+
+    QList<TuneJob> loaded;
+    const int errorCount = errors->size();
+    const QStringList groups = settings.childGroups();
+    for (const QString &group : groups) {
+        if (group == "General")
+            continue;
+
+        QString directory = value(group, "Directory", QString()).toString();
+        QDir dir(directory);
+        if (directory.isEmpty() || !dir.exists()) {
+            errors->append(QString("[%1] Directory '%2' does not exist.").arg(group, directory));
+            continue;
+        }
+
+        TuneJob proto;
+        proto.group = group;
+        proto.ampModel = value(group, "AmpModel", QString()).toString();
+        proto.characterize = value(group, "Mode", "tune").toString().compare("characterize", Qt::CaseInsensitive) == 0;
+        proto.priority = value(group, "Priority", 0).toInt();
+        proto.tier = value(group, "Tier", QString()).toString().toLower();
+        proto.promoteTo = value(group, "PromoteTo", QString()).toString().toLower();
+        if ((!proto.tier.isEmpty() && !TuningTier::isValid(proto.tier)) ||
+            (!proto.promoteTo.isEmpty() && !TuningTier::isValid(proto.promoteTo))) {
+            errors->append(QString("[%1] Tier and PromoteTo must be one of %2.")
+                               .arg(group, TuningTier::names().join(", ")));
+            continue;
+        }
+        if (!isValidAmpModel(proto.ampModel)) {
+            errors->append(QString("[%1] Invalid amplifier model '%2'.").arg(group, proto.ampModel));
+            continue;
+        }
+        if (!proto.characterize) {
+            bool okMin = false, okMax = false;
+            proto.minPower = value(group, "Min", QString()).toDouble(&okMin);
+            proto.maxPower = value(group, "Max", QString()).toDouble(&okMax);
+            proto.critical = value(group, "Critical", QString()).toString().toUpper();
+            if (!okMin || !okMax || !isValidCritical(proto.critical)) {
+                errors->append(QString("[%1] Min, Max and Critical (HIGH/LOW) are required.").arg(group));
+                continue;
+            }
+        }
+
+        // QSettings returns a comma separated value as a string list.
+        QStringList include = value(group, "Include", QStringList() << "*.py").toStringList();
+        for (QString &pattern : include)
+            pattern = pattern.trimmed();
+        // An unquoted comma, as in {1,3} or (a,b), splits the value the same way; join it
+        // back. Whitespace around the commas is lost, so such patterns are best quoted.
+        const QVariant regexValue = value(group, "Regex", QString());
+        const QStringList regexParts = regexValue.toStringList();
+        QString regexText = regexParts.join(",");
+        QRegularExpression regex(regexText);
+        if (!regex.isValid()) {
+            errors->append(QString("[%1] Invalid Regex '%2': %3%4")
+                               .arg(group, regexText, regex.errorString(),
+                                    regexParts.size() > 1 ? " (quote a Regex that contains commas)" : ""));
+            continue;
+        }
+
+        const QStringList names = dir.entryList(include, QDir::Files, QDir::Name);
+        for (const QString &name : names) {
+            if (!name.endsWith(".py"))
+                continue;
+            if (!regexText.isEmpty() && !regex.match(name).hasMatch())
+                continue;
+            TuneJob job = proto;
+            job.file = dir.absoluteFilePath(name);
+            loaded.append(job);
+        }
+    }
+
+    // Higher priority first; file order is kept within a priority.
+    std::stable_sort(loaded.begin(), loaded.end(),
+                     [](const TuneJob &a, const TuneJob &b) { return a.priority > b.priority; });
+    jobs->append(loaded);
+    return errors->size() == errorCount;
+}
+
+QJsonObject JobManifest::toJson(const TuneJob &job)
+{
+    QJsonObject obj{{"file", job.file},
+                    {"ampModel", job.ampModel},
+                    {"mode", job.characterize ? "characterize" : "tune"},
+                    {"priority", job.priority}};
+    if (!job.characterize) {
+        obj.insert("min", job.minPower);
+        obj.insert("max", job.maxPower);
+        obj.insert("critical", job.critical);
+    }
+    if (!job.group.isEmpty())
+        obj.insert("group", job.group);
+    if (!job.tier.isEmpty())
+        obj.insert("tier", job.tier);
+    if (!job.promoteTo.isEmpty())
+        obj.insert("promoteTo", job.promoteTo);
+    return obj;
+}
+
+TuneJob JobManifest::fromJson(const QJsonObject &obj)
+{
+    TuneJob job;
+    job.file = obj.value("file").toString();
+    job.ampModel = obj.value("ampModel").toString();
+    job.characterize = obj.value("mode").toString().compare("characterize", Qt::CaseInsensitive) == 0;
+    job.minPower = obj.value("min").toDouble();
+    job.maxPower = obj.value("max").toDouble();
+    job.critical = obj.value("critical").toString().toUpper();
+    job.priority = obj.value("priority").toInt();
+    job.group = obj.value("group").toString();
+    job.tier = obj.value("tier").toString().toLower();
+    job.promoteTo = obj.value("promoteTo").toString().toLower();
+    return job;
+}
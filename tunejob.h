@@ -0,0 +1,58 @@
+#ifndef TUNEJOB_H
+#define TUNEJOB_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QJsonObject>
+
+// One waveform file together with the targets it is to be tuned (or characterized) for.
+struct TuneJob {
+    QString file;
+    QString ampModel;       // "x300" or "N321"
+    double minPower = 0.0;
+    double maxPower = 0.0;
+    QString critical;       // "HIGH" or "LOW"
+    bool characterize = false;
+    int priority = 0;       // Higher runs first
+    QString group;          // Job file group the entry came from
+    QString tier;           // TuningTier name, empty for the configured default
+    QString promoteTo;      // Finer tier to continue at if the result misses its windows
+};
+
+// Loads a headless job file (INI). Every group other than [General] selects files and
+// gives them targets; keys missing from a group fall back to [General]:
+//
+//   [General]
+//   AmpModel=x300
+//
+//   [QpskL1]
+//   Directory=/data/waveforms
+//   Include=L1_*QPSK*.py, L1_*BPSK*.py   ; globs, default *.py
+//   Regex=_(10|20)MHz_                    ; optional, matched against the file name;
+//                                         ; quote it if it contains ", "
+//   Min=30.0
+//   Max=40.0
+//   Critical=HIGH
+//   Mode=tune                             ; or characterize
+//   Priority=10
+//   Tier=survey                           ; survey, production or precision
+//   PromoteTo=production                  ; optional, finer tier used only when needed
+//
+// Priority, like every other key, applies to all the files a group selects. To run one
+// file ahead of its neighbours, give it a group of its own.
+class JobManifest
+{
+public:
+    static bool load(const QString &path, QList<TuneJob> *jobs, QStringList *errors);
+    static bool isValidAmpModel(const QString &ampModel);
+    static bool isValidCritical(const QString &critical);
+
+    // Wire form used by the daemon and distributed mode:
+    //   {"file":...,"ampModel":...,"min":...,"max":...,"critical":...,"mode":"tune","priority":0,
+    //    "tier":"survey","promoteTo":"production"}
+    static QJsonObject toJson(const TuneJob &job);
+    static TuneJob fromJson(const QJsonObject &obj);
+};
+
+#endif // TUNEJOB_H
@@ -0,0 +1,180 @@
+#include "tunetask.h"
+#include "amplifierserial.h"
+#include "pythonrunner.h"
+#include <QElapsedTimer>
+#include <QList>
+#include <QPair>
+#include <QRegularExpression>
+#include <QTimer>
+
+namespace {
+
+// Fire-and-forget coroutine that owns itself; only tuneSpawn() makes these.
+struct TuneDetached {
+    struct promise_type {
+        TuneDetached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+TuneDetached runDetached(TuneTask<void> task, std::function<void()> done)
+{
+    co_await task;
+    if (done)
+        done();
+}
+
+} // namespace
+
+// One outstanding wait on Qt signals. Resumes its coroutine once, from the event loop,
+// on whichever comes first: finish() from a signal handler or the timeout. Deleted with
+// its context, in which case the coroutine is left suspended.
+class TuneWait : public QObject
+{
+public:
+    TuneWait(QObject *context, std::coroutine_handle<> handle, int timeoutMs)
+        : QObject(context), m_handle(handle)
+    {
+        if (timeoutMs > 0) {
+            m_timer.setSingleShot(true);
+            QObject::connect(&m_timer, &QTimer::timeout, this, [this]() { finish(); });
+            m_timer.start(timeoutMs);
+        }
+    }
+
+    void watch(const QMetaObject::Connection &connection) { m_connections << connection; }
+
+    void finish()
+    {
+        if (m_finished)
+            return;
+        m_finished = true;
+        m_timer.stop();
+        for (const QMetaObject::Connection &connection : qAsConst(m_connections))
+            QObject::disconnect(connection);
+        // Resume from the event loop rather than inside the emitting object's signal.
+        QMetaObject::invokeMethod(this, [this]() {
+            std::coroutine_handle<> handle = m_handle;
+            deleteLater();
+            handle.resume();
+        }, Qt::QueuedConnection);
+    }
+
+private:
+    std::coroutine_handle<> m_handle;
+    QTimer m_timer;
+    QList<QMetaObject::Connection> m_connections;
+    bool m_finished = false;
+};
+
+void tuneSpawn(TuneTask<void> task, std::function<void()> done)
+{
+    runDetached(std::move(task), std::move(done));
+}
+
+void TuneDelay::await_suspend(std::coroutine_handle<> h)
+{
+    QTimer::singleShot(qMax(0, m_ms), m_context, [h]() { h.resume(); });
+}
+
+void TuneAmpReply::await_suspend(std::coroutine_handle<> h)
+{
+    // Other callers query the same port (the tuner and watchdog poll FWD_PWR? too), so
+    // only the reply to this query's own tag counts.
+    const int tag = m_amps->nextTag();
+    TuneWait *wait = new TuneWait(m_amps, h, m_timeoutMs);
+    wait->watch(QObject::connect(m_amps, &AmplifierSerial::commandReply, wait,
+                                 [this, wait, tag](const QString &device, const QString &, const QString &reply,
+                                                   int replyTag) {
+        if (replyTag != tag || device != m_device)
+            return;
+        m_reply = reply;
+        wait->finish();
+    }));
+    m_amps->sendCommand(m_command, m_device, tag);
+}
+
+void TuneAmpBatch::await_suspend(std::coroutine_handle<> h)
+{
+    // No timeout of its own: AmplifierSerial fails commands that go unanswered.
+    TuneWait *wait = new TuneWait(m_amps, h, 0);
+    // batchFinished is always queued, so the id is known before it can arrive.
+    wait->watch(QObject::connect(m_amps, &AmplifierSerial::batchFinished, wait,
+                                 [this, wait](int id, bool ok, const QStringList &errors) {
+        if (id != m_batchId)
+            return;
+        m_result.ok = ok;
+        m_result.errors = errors;
+        wait->finish();
+    }));
+    m_batchId = m_amps->sendBatch(m_commands, m_devices);
+}
+
+void TuneWaveformPrompt::await_suspend(std::coroutine_handle<> h)
+{
+    TuneWait *wait = new TuneWait(m_runner, h, m_timeoutMs);
+    wait->watch(QObject::connect(m_runner, &PythonRunner::pythonOutput, wait, [this, wait](const QString &output) {
+        if (!output.contains("Press Enter to quit"))
+            return;
+        m_ok = true;
+        wait->finish();
+    }));
+    wait->watch(QObject::connect(m_runner, &PythonRunner::scriptFinished, wait, [wait]() { wait->finish(); }));
+    if (!m_runner->isRunning())
+        m_runner->startScript();
+}
+
+TuneTask<QMap<QString, TuneSettled>> tuneStableReading(AmplifierSerial *amps, const QStringList &devices,
+                                                       TuneStableOptions options)
+{
+    static const QRegularExpression rx("([-+]?\\d*\\.?\\d+)");
+    QMap<QString, TuneSettled> result;
+    QMap<QString, QList<QPair<qint64, double>>> readings; // Per device: (ms since start, dBm)
+    QElapsedTimer clock;
+    clock.start();
+
+    int remaining = devices.size();
+    while (remaining > 0 && clock.elapsed() <= options.timeoutMs) {
+        const qint64 roundStart = clock.elapsed();
+        for (const QString &device : devices) {
+            TuneSettled &settled = result[device];
+            if (settled.settled)
+                continue;
+            const QString reply = co_await tuneAmpReply(amps, device, "FWD_PWR?", options.replyTimeoutMs);
+            QRegularExpressionMatch match = rx.match(reply);
+            if (!match.hasMatch() || reply.contains("ALC Range"))
+                continue;
+            QList<QPair<qint64, double>> &series = readings[device];
+            series.append(qMakePair(clock.elapsed(), match.captured(1).toDouble()));
+            settled.dbm = series.last().second;
+            settled.haveReading = true;
+
+            // Settled once the final run of readings within the tolerance has held for the
+            // hold time; the settle time is when that run began. The hold keeps a reading
+            // taken before the amp reacted from counting as settled.
+            double low = series.last().second;
+            double high = low;
+            int start = series.size() - 1;
+            while (start > 0) {
+                double v = series.at(start - 1).second;
+                if (qMax(high, v) - qMin(low, v) > options.toleranceDb)
+                    break;
+                low = qMin(low, v);
+                high = qMax(high, v);
+                --start;
+            }
+            if (series.last().first - series.at(start).first < options.holdMs)
+                continue;
+            settled.settled = true;
+            settled.settledAtMs = series.at(start).first;
+            --remaining;
+        }
+        const qint64 spent = clock.elapsed() - roundStart;
+        if (remaining > 0 && spent < options.pollMs)
+            co_await tuneDelay(amps, int(options.pollMs - spent));
+    }
+    co_return result;
+}
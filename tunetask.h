@@ -0,0 +1,220 @@
+#ifndef TUNETASK_H
+#define TUNETASK_H
+
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <utility>
+
+class AmplifierSerial;
+class PythonRunner;
+class QObject;
+
+// C++20 coroutines over the Qt event loop, so a bench procedure can be written as
+// straight-line code:
+//
+//     TuneTask<bool> Procedure::run()
+//     {
+//         TuneBatchResult setup = co_await tuneAmpBatch(m_amps, {"MODE VVA"}, m_devices);
+//         if (!setup.ok)
+//             co_return false;
+//         co_await tuneDelay(this, 500);
+//         QString reply = co_await tuneAmpReply(m_amps, device, "FWD_PWR?", 1000);
+//         ...
+//     }
+//
+// Everything resumes from the event loop on the calling thread, so any number of
+// procedures can be in flight at once without threads or locks. A task starts when it
+// is awaited or handed to tuneSpawn(). Each awaitable takes a context object; if that
+// object is destroyed while a coroutine waits on it, the coroutine is never resumed, so
+// use an object that outlives the procedure (normally the one running it).
+struct TunePromiseBase {
+    std::coroutine_handle<> continuation;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+        {
+            std::coroutine_handle<> next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    // The tree is built without relying on exceptions; one escaping a procedure is a bug.
+    void unhandled_exception() { std::terminate(); }
+};
+
+template <typename T>
+struct TunePromiseValue {
+    std::optional<T> value;
+    void return_value(T v) { value = std::move(v); }
+    T take() { return std::move(*value); }
+};
+
+template <>
+struct TunePromiseValue<void> {
+    void return_void() {}
+    void take() {}
+};
+
+template <typename T = void>
+class TuneTask
+{
+public:
+    struct promise_type : TunePromiseBase, TunePromiseValue<T> {
+        TuneTask get_return_object()
+        {
+            return TuneTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+
+    TuneTask(TuneTask &&other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+    TuneTask &operator=(TuneTask &&other) noexcept
+    {
+        if (this != &other) {
+            if (m_handle)
+                m_handle.destroy();
+            m_handle = std::exchange(other.m_handle, {});
+        }
+        return *this;
+    }
+    TuneTask(const TuneTask &) = delete;
+    TuneTask &operator=(const TuneTask &) = delete;
+    ~TuneTask()
+    {
+        if (m_handle)
+            m_handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return !m_handle || m_handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_handle.promise().continuation = awaiting;
+        return m_handle;
+    }
+    T await_resume() { return m_handle.promise().take(); }
+
+private:
+    explicit TuneTask(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+// Runs task to completion in the background and calls done (if given) at the end.
+void tuneSpawn(TuneTask<void> task, std::function<void()> done = nullptr);
+
+// Resumes after ms on the event loop.
+class TuneDelay
+{
+public:
+    TuneDelay(QObject *context, int ms) : m_context(context), m_ms(ms) {}
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h);
+    void await_resume() const noexcept {}
+
+private:
+    QObject *m_context;
+    int m_ms;
+};
+
+// Sends command to device and resumes with its reply line, or an empty string if none
+// arrives within timeoutMs. Only for query commands; set commands are silent.
+class TuneAmpReply
+{
+public:
+    TuneAmpReply(AmplifierSerial *amps, const QString &device, const QString &command, int timeoutMs)
+        : m_amps(amps), m_device(device), m_command(command), m_timeoutMs(timeoutMs) {}
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h);
+    QString await_resume() const { return m_reply; }
+
+private:
+    AmplifierSerial *m_amps;
+    QString m_device;
+    QString m_command;
+    int m_timeoutMs;
+    QString m_reply;
+};
+
+struct TuneBatchResult {
+    bool ok = false;
+    QStringList errors;
+};
+
+// Sends commands to every device as one AmplifierSerial batch and resumes once all of
+// them are acknowledged (or one fails).
+class TuneAmpBatch
+{
+public:
+    TuneAmpBatch(AmplifierSerial *amps, const QStringList &commands, const QStringList &devices)
+        : m_amps(amps), m_commands(commands), m_devices(devices) {}
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h);
+    TuneBatchResult await_resume() const { return m_result; }
+
+private:
+    AmplifierSerial *m_amps;
+    QStringList m_commands;
+    QStringList m_devices;
+    int m_batchId = 0;
+    TuneBatchResult m_result;
+};
+
+// Starts the flowgraph (if it is not running) and resumes true at its "Press Enter to
+// quit" prompt, or false after timeoutMs or if the script exits first.
+class TuneWaveformPrompt
+{
+public:
+    TuneWaveformPrompt(PythonRunner *runner, int timeoutMs) : m_runner(runner), m_timeoutMs(timeoutMs) {}
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h);
+    bool await_resume() const noexcept { return m_ok; }
+
+private:
+    PythonRunner *m_runner;
+    int m_timeoutMs;
+    bool m_ok = false;
+};
+
+// Forward power on one amp once it has settled.
+struct TuneSettled {
+    bool settled = false;
+    qint64 settledAtMs = -1;  // When the final stable run began, from the start of polling
+    double dbm = 0.0;         // Last reading, 0 if none
+    bool haveReading = false;
+};
+
+struct TuneStableOptions {
+    int pollMs = 100;
+    double toleranceDb = 0.1;
+    int holdMs = 1500;        // A run of readings within toleranceDb must last this long
+    int timeoutMs = 15000;
+    int replyTimeoutMs = 1000;
+};
+
+// Polls FWD_PWR? on devices until each one's readings have stayed within the tolerance
+// for the hold time, or until the timeout. ALC Range replies are not readings.
+TuneTask<QMap<QString, TuneSettled>> tuneStableReading(AmplifierSerial *amps, const QStringList &devices,
+                                                       TuneStableOptions options);
+
+inline TuneDelay tuneDelay(QObject *context, int ms) { return TuneDelay(context, ms); }
+inline TuneAmpReply tuneAmpReply(AmplifierSerial *amps, const QString &device, const QString &command, int timeoutMs)
+{
+    return TuneAmpReply(amps, device, command, timeoutMs);
+}
+inline TuneAmpBatch tuneAmpBatch(AmplifierSerial *amps, const QStringList &commands, const QStringList &devices)
+{
+    return TuneAmpBatch(amps, commands, devices);
+}
+inline TuneWaveformPrompt tuneWaveformPrompt(PythonRunner *runner, int timeoutMs)
+{
+    return TuneWaveformPrompt(runner, timeoutMs);
+}
+
+#endif // TUNETASK_H
@@ -0,0 +1,215 @@
+#include "tuneworker.h"
+#include "tuneconfig.h"
+#include "amplifierserial.h"
+#include "waveformtuner.h"
+#include "wavelogger.h"
+#include "simulatedrig.h"
+#include <QCoreApplication>
+#include <QTcpSocket>
+#include <QHostInfo>
+#include <QJsonDocument>
+#include <QTimer>
+#include <QDebug>
+
+TuneWorker::TuneWorker(const QString &host, quint16 port, QObject *parent)
+    : QObject(parent),
+    m_host(host),
+    m_port(port),
+    m_socket(new QTcpSocket(this)),
+    m_heartbeat(new QTimer(this)),
+    m_amps(new AmplifierSerial(this)),
+    m_logger(new WaveLogger(this))
+{
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    m_heartbeat->setInterval(config->heartbeatMs);
+    m_maxReconnects = config->maxReconnects;
+    m_token = config->distributedToken;
+    m_name = config->workerName;
+    if (m_name.isEmpty())
+        m_name = QString("%1:%2").arg(QHostInfo::localHostName()).arg(QCoreApplication::applicationPid());
+
+    connect(m_heartbeat, &QTimer::timeout, this, [this]() {
+        send(QJsonObject{{"cmd", "heartbeat"}});
+    });
+    connect(m_socket, &QTcpSocket::connected, this, [this]() {
+        m_reconnects = 0;
+        m_logger->debugAndLog(QString("Worker %1 connected to %2:%3").arg(m_name, m_host).arg(m_port));
+        send(QJsonObject{{"cmd", "hello"}, {"worker", m_name}, {"token", m_token}});
+        send(QJsonObject{{"cmd", "request"}});
+        m_heartbeat->start();
+    });
+    connect(m_socket, &QTcpSocket::readyRead, this, [this]() {
+        while (m_socket->canReadLine()) {
+            QByteArray line = m_socket->readLine().trimmed();
+            if (line.isEmpty())
+                continue;
+            QJsonDocument doc = QJsonDocument::fromJson(line);
+            if (!doc.isObject()) {
+                qWarning() << "Malformed message from coordinator:" << line;
+                continue;
+            }
+            handleMessage(doc.object());
+        }
+    });
+    connect(m_socket, &QTcpSocket::disconnected, this, [this]() {
+        m_heartbeat->stop();
+        if (m_done)
+            return;
+        // The coordinator requeues our lease when we drop, so don't keep driving the amps.
+        if (m_tuner)
+            m_tuner->abort("Lost connection to the coordinator.");
+        connectToCoordinator();
+    });
+    connect(m_socket, &QAbstractSocket::errorOccurred, this, [this](QAbstractSocket::SocketError) {
+        if (m_done || m_socket->state() != QAbstractSocket::UnconnectedState)
+            return;
+        qWarning() << "Coordinator connection error:" << m_socket->errorString();
+        connectToCoordinator();
+    });
+}
+
+TuneWorker::~TuneWorker()
+{
+    m_amps->disconnectAll();
+}
+
+void TuneWorker::start()
+{
+    // Discover the amps once; tuners reuse the open ports.
+    m_amps->searchAndConnect();
+    if (m_amps->connectedDevices().isEmpty()) {
+        qWarning() << "No amplifier devices found; not joining the coordinator.";
+        m_done = true;
+        emit finished(false);
+        return;
+    }
+    qDebug() << "Worker amp devices:" << m_amps->connectedDevices();
+    m_socket->connectToHost(m_host, m_port);
+}
+
+void TuneWorker::connectToCoordinator()
+{
+    if (m_reconnects++ >= m_maxReconnects) {
+        qWarning() << "Giving up on coordinator" << m_host << "after" << m_maxReconnects << "attempts.";
+        m_done = true;
+        emit finished(false);
+        return;
+    }
+    QTimer::singleShot(2000 * qMin(m_reconnects, 5), this, [this]() {
+        if (!m_done && m_socket->state() == QAbstractSocket::UnconnectedState)
+            m_socket->connectToHost(m_host, m_port);
+    });
+}
+
+void TuneWorker::handleMessage(const QJsonObject &message)
+{
+    const QString event = message.value("event").toString();
+    if (event == "job") {
+        if (m_tuner) {
+            qWarning() << "Coordinator sent a job while one is running; ignoring.";
+            return;
+        }
+        runJob(message);
+    } else if (event == "revoke") {
+        // The lease expired and the job is going to another worker; stop driving the rig.
+        if (!m_tuner || message.value("lease").toInt() != m_lease)
+            return;
+        m_logger->debugAndLog(QString("Lease %1 revoked by the coordinator").arg(m_lease));
+        m_revoked = true;
+        m_tuner->abort("Lease revoked by the coordinator.");
+    } else if (event == "rejected") {
+        qWarning() << "Coordinator rejected this worker:" << message.value("error").toString();
+        m_done = true;
+        m_heartbeat->stop();
+        if (m_tuner)
+            m_tuner->abort("Rejected by the coordinator.");
+        m_socket->disconnectFromHost();
+        emit finished(false);
+    } else if (event == "idle") {
+        QTimer::singleShot(message.value("retryMs").toInt(5000), this, [this]() {
+            if (!m_tuner)
+                send(QJsonObject{{"cmd", "request"}});
+        });
+    } else if (event == "done") {
+        if (m_tuner)
+            return;
+        m_done = true;
+        m_heartbeat->stop();
+        m_socket->disconnectFromHost();
+        m_logger->debugAndLog(QString("Worker %1: coordinator has no more jobs").arg(m_name));
+        m_linkTotal.merge(m_amps->linkStats());
+        m_amps->resetLinkStats();
+        if (!m_linkTotal.isEmpty())
+            m_logger->debugAndLog(m_linkTotal.summary());
+        emit finished(true);
+    }
+}
+
+void TuneWorker::runJob(const QJsonObject &message)
+{
+    TuneJob job = JobManifest::fromJson(message.value("job").toObject());
+    // A simulated worker tunes a copy and leaves the shared flowgraph alone.
+    if (SimulatedRig::isEnabled()) {
+        const QString copy = SimulatedRig::instance().sandboxCopy(job.file);
+        if (!copy.isEmpty())
+            job.file = copy;
+    }
+    m_lease = message.value("lease").toInt();
+    m_revoked = false;
+    m_channels = QJsonArray();
+    // Each result carries only its own job's link stats; the worker keeps the total.
+    m_linkTotal.merge(m_amps->linkStats());
+    m_amps->resetLinkStats();
+    if (TuneConfig::applyPending())
+        m_logger->debugAndLog(QString("Config reloaded (generation %1).").arg(TuneConfig::current()->generation));
+    m_logger->debugAndLog(QString("Lease %1: tuning %2").arg(m_lease).arg(job.file));
+
+    m_tuner = new WaveformTuner(this, m_logger, m_amps);
+    m_tuner->setTier(job.tier, job.promoteTo);
+    connect(m_tuner, &WaveformTuner::progress, this, [this](int channel, int gain, int iteration) {
+        send(QJsonObject{{"cmd", "progress"}, {"lease", m_lease}, {"channel", channel},
+                         {"gain", gain}, {"iteration", iteration}});
+    });
+    connect(m_tuner, &WaveformTuner::channelTuned, this, [this](int channel, int gain, double minPower, double maxPower) {
+        m_channels.append(QJsonObject{{"channel", channel}, {"gain", gain}, {"min", minPower}, {"max", maxPower}});
+    });
+    connect(m_tuner, &WaveformTuner::tuningFinished, this, [this]() {
+        finishJob(true, QString());
+    });
+    connect(m_tuner, &WaveformTuner::tuningFailed, this, [this](const QString &reason) {
+        finishJob(false, reason);
+    });
+
+    if (message.contains("resume")) {
+        const QJsonObject resume = message.value("resume").toObject();
+        m_tuner->setResumePoint(resume.value("channel").toInt(), resume.value("gain").toInt());
+    }
+    if (job.characterize)
+        m_tuner->startCharacterization(job.file, job.ampModel);
+    else
+        m_tuner->startTuning(job.file, job.ampModel, job.minPower, job.maxPower, job.critical);
+}
+
+void TuneWorker::finishJob(bool ok, const QString &detail)
+{
+    // Nothing to report if the connection dropped or the lease was revoked; the
+    // coordinator has already requeued the job.
+    if (!m_revoked && m_socket->state() == QAbstractSocket::ConnectedState)
+        send(QJsonObject{{"cmd", "result"}, {"lease", m_lease}, {"ok", ok},
+                         {"detail", detail}, {"channels", m_channels},
+                         {"link", m_amps->linkStats().toJson()}});
+    m_tuner->deleteLater();
+    m_tuner = nullptr;
+    m_lease = 0;
+    m_revoked = false;
+    if (!m_done && m_socket->state() == QAbstractSocket::ConnectedState)
+        send(QJsonObject{{"cmd", "request"}});
+}
+
+void TuneWorker::send(const QJsonObject &message)
+{
+    if (m_socket->state() != QAbstractSocket::ConnectedState)
+        return;
+    m_socket->write(QJsonDocument(message).toJson(QJsonDocument::Compact) + "\n");
+    m_socket->flush();
+}
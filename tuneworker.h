@@ -0,0 +1,58 @@
+#ifndef TUNEWORKER_H
+#define TUNEWORKER_H
+
+#include <QObject>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QString>
+#include "linkstats.h"
+#include "tunejob.h"
+
+class AmplifierSerial;
+class QTcpSocket;
+class QTimer;
+class WaveformTuner;
+class WaveLogger;
+
+// Distributed mode, bench side: connects to a TuneCoordinator, asks for a job, tunes it
+// on the local rig, reports progress and the result, and repeats until the coordinator
+// says there is nothing left. Waveform paths in the job are used as given, so every host
+// must see the waveform directory at the same path (shared storage).
+class TuneWorker : public QObject
+{
+    Q_OBJECT
+public:
+    TuneWorker(const QString &host, quint16 port, QObject *parent = nullptr);
+    ~TuneWorker();
+
+    void start();
+
+signals:
+    void finished(bool ok);
+
+private:
+    void connectToCoordinator();
+    void handleMessage(const QJsonObject &message);
+    void runJob(const QJsonObject &message);
+    void finishJob(bool ok, const QString &detail);
+    void send(const QJsonObject &message);
+
+    QString m_host;
+    quint16 m_port;
+    QString m_name;
+    QString m_token;            // [Distributed] Token, sent in the hello
+    QTcpSocket *m_socket;
+    QTimer *m_heartbeat;
+    AmplifierSerial *m_amps;
+    WaveLogger *m_logger;
+    WaveformTuner *m_tuner = nullptr;
+    int m_lease = 0;            // Lease of the job being tuned, 0 if idle
+    bool m_revoked = false;     // The coordinator took the current lease back
+    QJsonArray m_channels;      // Per-channel results of the current job
+    LinkStats m_linkTotal;      // Serial link stats of the jobs already reported
+    int m_reconnects = 0;
+    int m_maxReconnects;
+    bool m_done = false;
+};
+
+#endif // TUNEWORKER_H
@@ -0,0 +1,388 @@
+#include "tuningdaemon.h"
+#include "tuneconfig.h"
+#include "amplifierserial.h"
+#include "waveformtuner.h"
+#include "wavelogger.h"
+#include "simulatedrig.h"
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QTextStream>
+#include <QFileInfo>
+#include <QTimer>
+#include <QDebug>
+
+TuningDaemon::TuningDaemon(QObject *parent)
+    : QObject(parent),
+    m_server(new QLocalServer(this)),
+    m_amps(new AmplifierSerial(this)),
+    m_preparer(new WaveformPreparer(this)),
+    m_logger(new WaveLogger(this))
+{
+    m_changeoverMs = TuneConfig::current()->changeoverMs;
+
+    connect(m_server, &QLocalServer::newConnection, this, &TuningDaemon::onNewConnection);
+    connect(m_preparer, &WaveformPreparer::prepared, this, &TuningDaemon::onPrepared);
+
+    // Discover the amps once; tuners reuse the open ports.
+    m_amps->searchAndConnect();
+    qDebug() << "Daemon amp devices:" << m_amps->connectedDevices();
+}
+
+TuningDaemon::~TuningDaemon()
+{
+    m_amps->disconnectAll();
+}
+
+QString TuningDaemon::socketName()
+{
+    return TuneConfig::current()->daemonSocket;
+}
+
+bool TuningDaemon::listen()
+{
+    // A socket that still answers belongs to a running daemon; only a dead one is cleared.
+    QLocalSocket probe;
+    probe.connectToServer(socketName());
+    if (probe.waitForConnected(1000)) {
+        probe.disconnectFromServer();
+        qWarning() << "Another tuning daemon is already listening on" << socketName();
+        return false;
+    }
+    QLocalServer::removeServer(socketName());
+    // Jobs edit waveform files as this user, so only this user may submit them.
+    m_server->setSocketOptions(QLocalServer::UserAccessOption);
+    if (!m_server->listen(socketName())) {
+        qWarning() << "Cannot listen on" << socketName() << ":" << m_server->errorString();
+        return false;
+    }
+    m_logger->debugAndLog(QString("Tuning daemon listening on %1").arg(m_server->fullServerName()));
+    return true;
+}
+
+void TuningDaemon::onNewConnection()
+{
+    while (QLocalSocket *client = m_server->nextPendingConnection()) {
+        connect(client, &QLocalSocket::disconnected, this, [this, client]() {
+            m_watchers.remove(client);
+            client->deleteLater();
+        });
+        connect(client, &QLocalSocket::readyRead, this, [this, client]() {
+            while (client->canReadLine()) {
+                QByteArray line = client->readLine().trimmed();
+                if (line.isEmpty())
+                    continue;
+                QJsonParseError error;
+                QJsonDocument doc = QJsonDocument::fromJson(line, &error);
+                if (error.error != QJsonParseError::NoError || !doc.isObject()) {
+                    send(client, QJsonObject{{"ok", false}, {"error", "Malformed request."}});
+                    continue;
+                }
+                handleRequest(client, doc.object());
+            }
+        });
+    }
+}
+
+void TuningDaemon::handleRequest(QLocalSocket *client, const QJsonObject &request)
+{
+    const QString cmd = request.value("cmd").toString();
+    if (cmd == "submit") {
+        QList<TuneJob> jobs;
+        QStringList errors;
+        if (request.contains("jobFile")) {
+            JobManifest::load(request.value("jobFile").toString(), &jobs, &errors);
+        } else {
+            TuneJob job = JobManifest::fromJson(request);
+            if (job.file.isEmpty() || !JobManifest::isValidAmpModel(job.ampModel) ||
+                (!job.characterize && !JobManifest::isValidCritical(job.critical)))
+                errors << "submit needs file, ampModel and, for tuning, min, max and critical.";
+            else
+                jobs << job;
+        }
+        if (!errors.isEmpty()) {
+            send(client, QJsonObject{{"ok", false}, {"error", errors.join(' ')}});
+            return;
+        }
+        QJsonArray ids;
+        for (const TuneJob &job : qAsConst(jobs))
+            ids.append(submit(job));
+        send(client, QJsonObject{{"ok", true}, {"ids", ids}});
+        startNext();
+    } else if (cmd == "cancel") {
+        Job *job = findJob(request.value("id").toInt());
+        if (!job || isFinished(*job)) {
+            send(client, QJsonObject{{"ok", false}, {"error", "No such pending job."}});
+            return;
+        }
+        if (job->id == m_activeId && m_tuner) {
+            send(client, QJsonObject{{"ok", true}});
+            job->cancelRequested = true;
+            m_tuner->abort("Cancelled by client.");
+            return;
+        }
+        if (job->id == m_activeId)
+            m_activeId = -1;
+        job->state = "cancelled";
+        discardPrepared(*job);
+        broadcast(jobToJson(*job));
+        send(client, QJsonObject{{"ok", true}});
+        pruneFinished();
+        startNext();
+    } else if (cmd == "status") {
+        QJsonArray jobs;
+        for (const Job &job : qAsConst(m_jobs))
+            jobs.append(jobToJson(job));
+        send(client, QJsonObject{{"ok", true},
+                                 {"amps", QJsonArray::fromStringList(m_amps->connectedDevices())},
+                                 {"link", m_amps->linkStats().toJson()},
+                                 {"jobs", jobs}});
+    } else if (cmd == "watch") {
+        m_watchers.insert(client);
+        send(client, QJsonObject{{"ok", true}});
+    } else {
+        send(client, QJsonObject{{"ok", false}, {"error", QString("Unknown command '%1'.").arg(cmd)}});
+    }
+}
+
+void TuningDaemon::send(QLocalSocket *client, const QJsonObject &message)
+{
+    client->write(QJsonDocument(message).toJson(QJsonDocument::Compact) + "\n");
+    client->flush();
+}
+
+void TuningDaemon::broadcast(const QJsonObject &event)
+{
+    for (QLocalSocket *client : qAsConst(m_watchers))
+        send(client, event);
+}
+
+int TuningDaemon::submit(const TuneJob &tuneJob)
+{
+    Job job;
+    job.id = m_nextId++;
+    job.job = tuneJob;
+    // A simulated daemon tunes a copy and leaves the client's flowgraph alone.
+    if (SimulatedRig::isEnabled()) {
+        const QString copy = SimulatedRig::instance().sandboxCopy(tuneJob.file);
+        if (!copy.isEmpty())
+            job.job.file = copy;
+    }
+    job.state = "queued";
+    m_jobs.append(job);
+    m_logger->debugAndLog(QString("Job %1 queued: %2").arg(job.id).arg(tuneJob.file));
+    broadcast(jobToJson(job));
+    return job.id;
+}
+
+void TuningDaemon::startNext()
+{
+    if (m_activeId >= 0)
+        return;
+
+    Job *next = nextQueued();
+    if (!next)
+        return;
+
+    m_activeId = next->id;
+    if (m_preparer->isPrepared(next->job.file)) {
+        launch(next, m_preparer->take(next->job.file));
+        return;
+    }
+    next->state = "preparing";
+    broadcast(jobToJson(*next));
+    // The job can still be cancelled, so its starting gain is left to the tuner.
+    m_preparer->prepare(next->job.file, next->job.ampModel, false, next->job.maxPower);
+}
+
+void TuningDaemon::onPrepared(const PreparedWaveform &waveform)
+{
+    Job *job = findJob(m_activeId);
+    if (!job || job->state != "preparing" || job->job.file != waveform.file)
+        return;
+    launch(job, m_preparer->take(waveform.file));
+}
+
+void TuningDaemon::launch(Job *job, const PreparedWaveform &prepared)
+{
+    if (!prepared.valid) {
+        finishRunning("failed", prepared.excluded ? QString("Excluded by configuration.") : prepared.problem);
+        return;
+    }
+
+    if (TuneConfig::applyPending() && m_logger)
+        m_logger->debugAndLog(QString("Config reloaded (generation %1).").arg(TuneConfig::current()->generation));
+
+    job->state = "running";
+    broadcast(jobToJson(*job));
+    const TuneJob tuneJob = job->job;
+    const int id = job->id;
+
+    m_tuner = new WaveformTuner(this, m_logger, m_amps);
+    m_tuner->setTier(tuneJob.tier, tuneJob.promoteTo);
+    connect(m_tuner, &WaveformTuner::channelTuned, this, [this, id](int channel, int gain, double minPower, double maxPower) {
+        broadcast(QJsonObject{{"event", "result"}, {"id", id}, {"channel", channel}, {"gain", gain},
+                              {"min", minPower}, {"max", maxPower}});
+    });
+    connect(m_tuner, &WaveformTuner::tuningFinished, this, [this]() {
+        finishRunning("done", QString());
+    });
+    connect(m_tuner, &WaveformTuner::tuningFailed, this, [this, id](const QString &reason) {
+        const Job *job = findJob(id);
+        finishRunning(job && job->cancelRequested ? "cancelled" : "failed", reason);
+    });
+
+    // Prefetch the job startNext will pick while this one is on the bench, without
+    // touching its file: it is still queued and may be cancelled.
+    if (const Job *other = nextQueued())
+        m_preparer->prepare(other->job.file, other->job.ampModel, false, other->job.maxPower);
+
+    if (tuneJob.characterize)
+        m_tuner->startCharacterization(tuneJob.file, tuneJob.ampModel);
+    else
+        m_tuner->startTuning(prepared, tuneJob.ampModel, tuneJob.minPower, tuneJob.maxPower, tuneJob.critical);
+}
+
+void TuningDaemon::finishRunning(const QString &state, const QString &detail)
+{
+    Job *job = findJob(m_activeId);
+    if (job) {
+        job->state = state;
+        job->detail = detail;
+        m_logger->debugAndLog(QString("Job %1 %2%3").arg(job->id).arg(state)
+                                  .arg(detail.isEmpty() ? QString() : ": " + detail));
+        broadcast(jobToJson(*job));
+    }
+    if (m_tuner) {
+        m_tuner->deleteLater();
+        m_tuner = nullptr;
+    }
+    m_activeId = -1;
+    pruneFinished();
+    QTimer::singleShot(m_changeoverMs, this, [this]() { startNext(); });
+}
+
+bool TuningDaemon::isFinished(const Job &job)
+{
+    return job.state == "done" || job.state == "failed" || job.state == "cancelled";
+}
+
+void TuningDaemon::pruneFinished()
+{
+    int finished = 0;
+    for (const Job &job : qAsConst(m_jobs))
+        finished += isFinished(job) ? 1 : 0;
+    const int keep = TuneConfig::current()->daemonKeepFinished;
+    for (int i = 0; i < m_jobs.size() && finished > keep;) {
+        if (isFinished(m_jobs.at(i))) {
+            m_jobs.removeAt(i);
+            --finished;
+        } else {
+            ++i;
+        }
+    }
+}
+
+void TuningDaemon::discardPrepared(const Job &job)
+{
+    for (const Job &other : qAsConst(m_jobs)) {
+        if (other.id != job.id && !isFinished(other) && other.job.file == job.job.file)
+            return;
+    }
+    m_preparer->discard(job.job.file);
+}
+
+TuningDaemon::Job *TuningDaemon::nextQueued()
+{
+    // Highest priority first, oldest first within a priority.
+    Job *next = nullptr;
+    for (Job &job : m_jobs) {
+        if (job.state == "queued" && (!next || job.job.priority > next->job.priority))
+            next = &job;
+    }
+    return next;
+}
+
+TuningDaemon::Job *TuningDaemon::findJob(int id)
+{
+    for (Job &job : m_jobs) {
+        if (job.id == id)
+            return &job;
+    }
+    return nullptr;
+}
+
+QJsonObject TuningDaemon::jobToJson(const Job &job) const
+{
+    QJsonObject obj{{"id", job.id},
+                    {"file", job.job.file},
+                    {"ampModel", job.job.ampModel},
+                    {"mode", job.job.characterize ? "characterize" : "tune"},
+                    {"priority", job.job.priority},
+                    {"state", job.state}};
+    if (!job.job.characterize) {
+        obj.insert("min", job.job.minPower);
+        obj.insert("max", job.job.maxPower);
+        obj.insert("critical", job.job.critical);
+    }
+    if (!job.detail.isEmpty())
+        obj.insert("detail", job.detail);
+    return obj;
+}
+
+int TuningDaemon::runClient(const QStringList &args, QTextStream &out)
+{
+    QJsonObject request;
+    const QString cmd = args.value(0);
+    if (cmd == "status" || cmd == "watch") {
+        request.insert("cmd", cmd);
+    } else if (cmd == "cancel" && args.size() == 2) {
+        request.insert("cmd", "cancel");
+        request.insert("id", args.at(1).toInt());
+    } else if (cmd == "submit-job" && args.size() == 2) {
+        request.insert("cmd", "submit");
+        request.insert("jobFile", QFileInfo(args.at(1)).absoluteFilePath());
+    } else if (cmd == "submit" && args.size() == 6) {
+        request.insert("cmd", "submit");
+        request.insert("file", QFileInfo(args.at(1)).absoluteFilePath());
+        request.insert("ampModel", args.at(2));
+        request.insert("min", args.at(3).toDouble());
+        request.insert("max", args.at(4).toDouble());
+        request.insert("critical", args.at(5));
+    } else if (cmd == "characterize" && args.size() == 3) {
+        request.insert("cmd", "submit");
+        request.insert("mode", "characterize");
+        request.insert("file", QFileInfo(args.at(1)).absoluteFilePath());
+        request.insert("ampModel", args.at(2));
+    } else {
+        out << "Usage: --client status | watch | cancel <id> | submit-job <job.ini>\n"
+               "                | submit <file> <x300|N321> <min> <max> <HIGH|LOW>\n"
+               "                | characterize <file> <x300|N321>\n";
+        return -1;
+    }
+
+    QLocalSocket socket;
+    socket.connectToServer(socketName());
+    if (!socket.waitForConnected(3000)) {
+        out << "Cannot connect to the tuning daemon: " << socket.errorString() << "\n";
+        return -1;
+    }
+    socket.write(QJsonDocument(request).toJson(QJsonDocument::Compact) + "\n");
+    socket.flush();
+
+    // watch keeps printing events until the daemon goes away; everything else prints one reply.
+    bool ok = false;
+    while (socket.state() == QLocalSocket::ConnectedState || socket.bytesAvailable() > 0) {
+        if (!socket.canReadLine() && !socket.waitForReadyRead(cmd == "watch" ? -1 : 10000))
+            break;
+        while (socket.canReadLine()) {
+            QByteArray line = socket.readLine().trimmed();
+            out << line << "\n" << Qt::flush;
+            ok = QJsonDocument::fromJson(line).object().value("ok").toBool(ok);
+            if (cmd != "watch")
+                return ok ? 0 : 1;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+#ifndef TUNINGDAEMON_H
+#define TUNINGDAEMON_H
+
+#include <QObject>
+#include <QList>
+#include <QSet>
+#include <QString>
+#include <QJsonObject>
+#include "tunejob.h"
+#include "waveformpreparer.h"
+
+class AmplifierSerial;
+class QLocalServer;
+class QLocalSocket;
+class QTextStream;
+class WaveformTuner;
+class WaveLogger;
+
+// Long-running tuning service. Keeps the amp ports, preparer and logger resident and
+// accepts jobs over a local socket, one JSON object per line:
+//   {"cmd":"submit","file":...,"ampModel":...,"min":...,"max":...,"critical":...,"mode":"tune","priority":0}
+//   {"cmd":"submit","jobFile":...}
+//   {"cmd":"cancel","id":N}
+//   {"cmd":"status"}
+//   {"cmd":"watch"}            (the connection then receives job events as they happen)
+// Jobs run one at a time on the rig attached to this host, highest priority first. Nothing
+// is written to a job's flowgraph until it runs, so a cancelled job leaves the file alone.
+class TuningDaemon : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TuningDaemon(QObject *parent = nullptr);
+    ~TuningDaemon();
+
+    bool listen();
+    static QString socketName();
+
+    // Command line client for the daemon; returns the process exit code.
+    static int runClient(const QStringList &args, QTextStream &out);
+
+private slots:
+    void onNewConnection();
+    void onPrepared(const PreparedWaveform &waveform);
+
+private:
+    struct Job {
+        int id = 0;
+        TuneJob job;
+        QString state;   // queued, preparing, running, done, failed, cancelled
+        QString detail;  // Result or failure reason
+        bool cancelRequested = false;  // Its tuner was aborted on a client's cancel
+    };
+
+    void handleRequest(QLocalSocket *client, const QJsonObject &request);
+    void send(QLocalSocket *client, const QJsonObject &message);
+    void broadcast(const QJsonObject &event);
+    int submit(const TuneJob &job);
+    void startNext();
+    void launch(Job *job, const PreparedWaveform &prepared);
+    void finishRunning(const QString &state, const QString &detail);
+    Job *nextQueued();
+    // Drops the oldest finished jobs beyond [Daemon] KeepFinished. Invalidates Job pointers.
+    void pruneFinished();
+    static bool isFinished(const Job &job);
+    // Drops what the preparer holds for a cancelled job, unless another job still needs it.
+    void discardPrepared(const Job &job);
+    Job *findJob(int id);
+    QJsonObject jobToJson(const Job &job) const;
+
+    QLocalServer *m_server;
+    QSet<QLocalSocket*> m_watchers;
+    QList<Job> m_jobs;
+    int m_nextId = 1;
+    int m_activeId = -1;             // Job being prepared or tuned, -1 if idle
+    WaveformTuner *m_tuner = nullptr;
+    AmplifierSerial *m_amps;
+    WaveformPreparer *m_preparer;
+    WaveLogger *m_logger;
+    int m_changeoverMs = 500;
+};
+
+#endif // TUNINGDAEMON_H
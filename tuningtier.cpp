@@ -0,0 +1,68 @@
+#include "tuningtier.h"
+#include "tuneconfig.h"
+
+QStringList TuningTier::names()
+{
+    return QStringList() << "survey" << "production" << "precision";
+}
+
+bool TuningTier::isValid(const QString &name)
+{
+    return names().contains(name.toLower());
+}
+
+QString TuningTier::defaultName()
+{
+    return TuneConfig::current()->defaultTier;
+}
+
+TuningTier TuningTier::named(const QString &name)
+{
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    const QString key = name.isEmpty() || !isValid(name) ? config->defaultTier : name.toLower();
+    return config->tiers.value(key, builtIn(key));
+}
+
+TuningTier TuningTier::builtIn(const QString &name)
+{
+    const QString key = isValid(name) ? name.toLower() : QString("production");
+    TuningTier tier;
+    tier.name = key;
+    if (key == "survey") {
+        tier.windowBelowDb = 0.5;
+        tier.windowAboveDb = 0.8;
+        tier.stableToleranceDb = 0.3;
+        tier.alcToleranceDb = 0.5;
+        tier.recheckToleranceDb = 0.2;
+        tier.samples = 2;
+        tier.maxAdjustDown = 1;
+        tier.recheckMaxPolls = 5;
+    } else if (key == "precision") {
+        tier.windowBelowDb = 0.05;
+        tier.windowAboveDb = 0.15;
+        tier.stableToleranceDb = 0.05;
+        tier.alcToleranceDb = 0.1;
+        tier.recheckToleranceDb = 0.01;
+        tier.samples = 5;
+        tier.maxAdjustDown = 5;
+        tier.recheckMaxPolls = 0;
+    } else {
+        tier.windowBelowDb = 0.1;
+        tier.windowAboveDb = 0.3;
+        tier.stableToleranceDb = 0.1;
+        tier.alcToleranceDb = 0.2;
+        tier.recheckToleranceDb = 0.01;
+        tier.samples = 3;
+        tier.maxAdjustDown = 3;
+        tier.recheckMaxPolls = 0;
+    }
+    return tier;
+}
+
+bool TuningTier::accepts(double targetMax, double maxPower, double targetMin, double minPower, bool lowCritical) const
+{
+    const double diff = targetMax - maxPower;
+    if (diff > windowBelowDb || diff < -windowAboveDb)
+        return false;
+    return !lowCritical || minPower - targetMin <= alcToleranceDb;
+}
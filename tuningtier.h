@@ -0,0 +1,41 @@
+#ifndef TUNINGTIER_H
+#define TUNINGTIER_H
+
+#include <QString>
+#include <QStringList>
+
+// How precisely a file is tuned. The built-in tiers are
+//
+//   survey       coarse and fast, for library-wide sweeps
+//   production   the tuner's long-standing tolerances (the default)
+//   precision    tighter windows and more samples
+//
+// and any value can be overridden under [Tiers] in waveTuneConfig.ini, e.g.
+//   [Tiers]
+//   survey\StableToleranceDb=0.3
+struct TuningTier {
+    QString name;
+    double windowBelowDb = 0.1;       // Max power may sit this far under the target...
+    double windowAboveDb = 0.3;       // ...or this far over it
+    double stableToleranceDb = 0.1;   // Successive VVA readings count as stable within this
+    double alcToleranceDb = 0.2;      // Same for ALC readings; also the allowed min overshoot
+    double recheckToleranceDb = 0.01;  // Same for the final max recheck
+    int samples = 3;                // Consecutive readings that must agree
+    int maxAdjustDown = 3;          // Gain-down steps before the max is accepted as is
+    int recheckMaxPolls = 0;        // Final recheck polls before settling for the mean, 0 = no limit
+
+    static QStringList names();
+    static bool isValid(const QString &name);
+    // The named tier, or the configured default ([Tuning] Tier) when name is empty, with
+    // its [Tiers] overrides from the current TuneConfig snapshot.
+    static TuningTier named(const QString &name);
+    static QString defaultName();
+    // The tier's values before any overrides.
+    static TuningTier builtIn(const QString &name);
+
+    // True if a max of maxPower and a min of minPower measured against targets meet this
+    // tier's windows (the min only matters for LOW-critical files).
+    bool accepts(double targetMax, double maxPower, double targetMin, double minPower, bool lowCritical) const;
+};
+
+#endif // TUNINGTIER_H
@@ -0,0 +1,151 @@
+#include "waveformdedup.h"
+#include "tuneconfig.h"
+#include "batchjournal.h"
+#include <QCryptographicHash>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+
+// Drops Python comments, leaving string literals (which may contain '#') alone.
+static QString stripComments(const QString &src)
+{
+    QString out;
+    out.reserve(src.size());
+    QChar quote;
+    bool triple = false;
+    for (int i = 0; i < src.size(); ++i) {
+        const QChar c = src.at(i);
+        if (!quote.isNull()) {
+            out += c;
+            if (c == '\\' && i + 1 < src.size()) {
+                out += src.at(++i);
+            } else if (c == quote) {
+                if (!triple) {
+                    quote = QChar();
+                } else if (src.mid(i, 3) == QString(3, quote)) {
+                    out += src.mid(i + 1, 2);
+                    i += 2;
+                    quote = QChar();
+                }
+            }
+            continue;
+        }
+        if (c == '#') {
+            while (i + 1 < src.size() && src.at(i + 1) != '\n')
+                ++i;
+            continue;
+        }
+        if (c == '"' || c == '\'') {
+            quote = c;
+            triple = src.mid(i, 3) == QString(3, c);
+            if (triple) {
+                out += src.mid(i, 3);
+                i += 2;
+                continue;
+            }
+        }
+        out += c;
+    }
+    return out;
+}
+
+WaveformDedup::WaveformDedup(QObject *parent)
+    : QObject(parent)
+{
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    m_enabled = config->dedupEnabled;
+    m_verify = config->dedupVerify;
+}
+
+QByteArray WaveformDedup::contentHash(const QString &file)
+{
+    QFile in(file);
+    if (!in.open(QIODevice::ReadOnly | QIODevice::Text))
+        return QByteArray();
+    QString src = stripComments(QString::fromUtf8(in.readAll()));
+
+    // GRC names the top block (and the window title) after the flowgraph, so a copy saved
+    // under another name differs only in those identifiers.
+    static const QRegularExpression topBlockRe("class\\s+(\\w+)\\s*\\(\\s*gr\\.top_block");
+    QStringList names;
+    names << QFileInfo(file).completeBaseName();
+    QRegularExpressionMatch topBlock = topBlockRe.match(src);
+    if (topBlock.hasMatch())
+        names << topBlock.captured(1);
+    for (const QString &name : qAsConst(names)) {
+        if (!name.isEmpty())
+            src.replace(QRegularExpression("\\b" + QRegularExpression::escape(name) + "\\b"), "@NAME@");
+    }
+
+    static const QRegularExpression gainRe("(\\.set_gain\\s*\\(\\s*)[-+]?\\d+(?:\\.\\d*)?");
+    src.replace(gainRe, "\\1@GAIN@");
+    static const QRegularExpression spaceRe("\\s+");
+    src.remove(spaceRe);
+    return QCryptographicHash::hash(src.toUtf8(), QCryptographicHash::Sha256).toHex();
+}
+
+QString WaveformDedup::jobKey(const TuneJob &job)
+{
+    return BatchJournal::keyFor(job) + "|" + job.tier + "|" + job.promoteTo;
+}
+
+void WaveformDedup::add(const TuneJob &job, const PreparedWaveform &waveform)
+{
+    if (!m_enabled || job.characterize || !waveform.valid || waveform.contentHash.isEmpty())
+        return;
+    const QString classKey = QString("%1|%2|%3|%4|%5|%6|%7")
+                                 .arg(QString::fromLatin1(waveform.contentHash))
+                                 .arg(waveform.isL1L2 ? "L1_L2" : QString("ch%1").arg(waveform.channel))
+                                 .arg(job.ampModel.toLower())
+                                 .arg(job.minPower, 0, 'f', 2)
+                                 .arg(job.maxPower, 0, 'f', 2)
+                                 .arg(job.critical.toUpper())
+                                 .arg(job.tier + ">" + job.promoteTo);
+    m_classOf.insert(jobKey(job), classKey);
+    ++m_classSizes[classKey];
+}
+
+int WaveformDedup::classCount() const
+{
+    return m_classSizes.size();
+}
+
+int WaveformDedup::duplicateCount() const
+{
+    return m_classOf.size() - m_classSizes.size();
+}
+
+QMap<int, int> WaveformDedup::result(const TuneJob &job) const
+{
+    return m_results.value(m_classOf.value(jobKey(job)));
+}
+
+QString WaveformDedup::resultSource(const TuneJob &job) const
+{
+    return m_sources.value(m_classOf.value(jobKey(job)));
+}
+
+bool WaveformDedup::usedTrim(const TuneJob &job) const
+{
+    const QMap<int, double> trims = m_trims.value(m_classOf.value(jobKey(job)));
+    for (double level : trims) {
+        if (level < 100.0)
+            return true;
+    }
+    return false;
+}
+
+void WaveformDedup::recordResult(const TuneJob &job, int channel, int gain, double vvaLevel)
+{
+    const QString classKey = m_classOf.value(jobKey(job));
+    if (classKey.isEmpty() || m_classSizes.value(classKey) < 2)
+        return;
+    // The first file of the class to finish defines the result; verification runs of the
+    // duplicates do not overwrite it.
+    if (!m_sources.contains(classKey))
+        m_sources.insert(classKey, job.file);
+    else if (m_sources.value(classKey) != job.file)
+        return;
+    m_results[classKey].insert(channel, gain);
+    m_trims[classKey].insert(channel, vvaLevel);
+}
@@ -0,0 +1,57 @@
+#ifndef WAVEFORMDEDUP_H
+#define WAVEFORMDEDUP_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QMap>
+#include <QString>
+#include "tunejob.h"
+#include "waveformpreparer.h"
+
+// Groups a batch's waveforms into equivalence classes so each class is tuned once.
+// Two jobs are equivalent when their flowgraphs hash the same after normalization
+// (comments, whitespace, set_gain literals and the file's own name removed) and they
+// are tuned on the same channel layout to the same targets and tier.
+//
+// The first job of a class to finish records its gains. Later jobs of the class either
+// take those gains as is, or (with [Dedup] Verify) start a normal tune from them, which
+// confirms the result in one run when the files really are equivalent. A result that
+// needed a VVA fine trim is always verified: the trim lives on the amp, not in the file,
+// so copying the gains alone would not reproduce it.
+class WaveformDedup : public QObject
+{
+    Q_OBJECT
+public:
+    explicit WaveformDedup(QObject *parent = nullptr);
+
+    // SHA-256 of the normalized flowgraph, hex encoded; empty if the file cannot be read.
+    static QByteArray contentHash(const QString &file);
+
+    bool isEnabled() const { return m_enabled; }
+    bool verify() const { return m_verify; }
+
+    // Indexes a validated job. Characterization jobs are never deduplicated.
+    void add(const TuneJob &job, const PreparedWaveform &waveform);
+    int duplicateCount() const;
+    int classCount() const;
+
+    // Gains (channel -> gain) recorded for job's class by another file, empty if none yet.
+    QMap<int, int> result(const TuneJob &job) const;
+    QString resultSource(const TuneJob &job) const;
+    // True if the recorded result trimmed the VVA below 100 on any channel.
+    bool usedTrim(const TuneJob &job) const;
+    void recordResult(const TuneJob &job, int channel, int gain, double vvaLevel = 100.0);
+
+private:
+    static QString jobKey(const TuneJob &job);
+
+    bool m_enabled;
+    bool m_verify;
+    QMap<QString, QString> m_classOf;       // Job key -> class key
+    QMap<QString, int> m_classSizes;
+    QMap<QString, QMap<int, int>> m_results; // Class key -> channel -> gain
+    QMap<QString, QString> m_sources;        // Class key -> file the result came from
+    QMap<QString, QMap<int, double>> m_trims; // Class key -> channel -> VVA level
+};
+
+#endif // WAVEFORMDEDUP_H
@@ -0,0 +1,241 @@
+#include "waveformpreparer.h"
+#include "pythoneditor.h"
+#include "waveformtuner.h"
+#include "gainpredictor.h"
+#include "tuneconfig.h"
+#include <QProcess>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QRegularExpression>
+#include <QDebug>
+
+// Byte-compiles the flowgraph (without writing a .pyc next to it) and imports its
+// top-level modules so the real launch finds them in the page cache.
+static const char *kWarmupScript =
+    "import sys, importlib\n"
+    "src = open(sys.argv[1]).read()\n"
+    "compile(src, sys.argv[1], 'exec')\n"
+    "for name in sys.argv[2:]:\n"
+    "    try:\n"
+    "        importlib.import_module(name)\n"
+    "    except Exception:\n"
+    "        pass\n";
+
+WaveformPreparer::WaveformPreparer(QObject *parent)
+    : QObject(parent)
+{
+}
+
+WaveformPreparer::~WaveformPreparer()
+{
+    for (QProcess *process : qAsConst(m_warmups)) {
+        process->disconnect(this);
+        process->kill();
+        process->waitForFinished(1000);
+    }
+}
+
+bool WaveformPreparer::isFileExcluded(const QString &fileName)
+{
+    // The [Exclusions] keywords are compiled into one case-insensitive matcher per snapshot.
+    return TuneConfig::current()->isExcluded(fileName);
+}
+
+int WaveformPreparer::initialGainFor(const QString &ampModel)
+{
+    if (ampModel.compare("N321", Qt::CaseInsensitive) == 0)
+        return 12;
+    return 0;
+}
+
+int WaveformPreparer::initialGainFor(const QString &file, const QString &ampModel, int channel, double maxPower)
+{
+    const std::shared_ptr<const TuneConfig> config = TuneConfig::current();
+    if (config->predictorEnabled) {
+        const GainPrediction prediction = GainPredictor::predict(file, ampModel, channel, maxPower, *config);
+        if (prediction.ok)
+            return prediction.gain;
+    }
+    return initialGainFor(ampModel);
+}
+
+QString WaveformPreparer::interpreter()
+{
+    return TuneConfig::current()->pythonInterpreter;
+}
+
+bool WaveformPreparer::compileCheck(const QString &file, QString *error)
+{
+    QProcess process;
+    process.start(interpreter(), QStringList() << "-c" << kWarmupScript << file);
+    if (!process.waitForStarted(5000)) {
+        if (error)
+            *error = "Could not start the Python interpreter.";
+        return false;
+    }
+    if (!process.waitForFinished(30000)) {
+        process.kill();
+        process.waitForFinished(1000);
+        if (error)
+            *error = "Python check timed out.";
+        return false;
+    }
+    if (process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0) {
+        QStringList errLines = QString::fromUtf8(process.readAllStandardError()).split('\n', Qt::SkipEmptyParts);
+        if (error)
+            *error = errLines.isEmpty() ? QString("Python check failed.") : errLines.last().trimmed();
+        return false;
+    }
+    return true;
+}
+
+PreparedWaveform WaveformPreparer::inspect(const QString &file, const QString &ampModel)
+{
+    PreparedWaveform w;
+    w.file = file;
+    w.baseName = QFileInfo(file).fileName();
+    w.initialGain = initialGainFor(ampModel);
+
+    if (isFileExcluded(w.baseName)) {
+        w.excluded = true;
+        w.problem = "Excluded by configuration.";
+        return w;
+    }
+
+    QFile fileObj(file);
+    if (!fileObj.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        w.problem = "Cannot open file for reading.";
+        return w;
+    }
+    QTextStream in(&fileObj);
+    QString content = in.readAll();
+    fileObj.close();
+
+    static const QRegularExpression importRe("^(?:from\\s+([A-Za-z_][\\w.]*)\\s+import|import\\s+([A-Za-z_][\\w.]*))",
+                                             QRegularExpression::MultilineOption);
+    QRegularExpressionMatchIterator it = importRe.globalMatch(content);
+    while (it.hasNext()) {
+        QRegularExpressionMatch m = it.next();
+        QString module = m.captured(1).isEmpty() ? m.captured(2) : m.captured(1);
+        if (!w.imports.contains(module))
+            w.imports << module;
+    }
+
+    // Resolve channels the same way WaveformTuner and PythonEditor will.
+    QList<int> channels;
+    if (w.baseName.startsWith("L1_L2_")) {
+        w.isL1L2 = true;
+        w.channel = 0;
+        channels << 0 << 1;
+    } else if (w.baseName.startsWith("L2_")) {
+        w.channel = WaveformTuner::extractChannelFromFile(file);
+        channels << w.channel;
+    } else {
+        w.channel = 0;
+        channels << 0;
+    }
+    PythonEditor editor;
+    QList<qint64> siteOffsets;
+    for (int ch : channels) {
+        GainSite site;
+        if (!editor.gainSite(file, ch, &site)) {
+            w.problem = QString("No set_gain call resolves to channel %1.").arg(ch);
+            return w;
+        }
+        if (siteOffsets.contains(site.offset)) {
+            w.problem = "Both channels resolve to the same set_gain call.";
+            return w;
+        }
+        siteOffsets << site.offset;
+    }
+
+    w.valid = true;
+    return w;
+}
+
+void WaveformPreparer::prepare(const QString &file, const QString &ampModel, bool presetGain, double maxPower)
+{
+    if (m_ready.contains(file) || m_pending.contains(file))
+        return;
+    m_pending.insert(file);
+
+    PreparedWaveform w = inspect(file, ampModel);
+    if (!w.valid) {
+        finish(w);
+        return;
+    }
+
+    // With launch overrides the gain is never written during the search.
+    if (TuneConfig::current()->launchOverrides)
+        presetGain = false;
+
+    if (presetGain) {
+        // The file is not running yet, so it is safe to write its starting gain now.
+        w.initialGain = initialGainFor(file, ampModel, w.channel, maxPower);
+        PythonEditor editor;
+        bool ok = editor.editGainValue(file, w.initialGain, w.channel);
+        if (ok && w.isL1L2)
+            ok = editor.editGainValue(file, w.initialGain, 1);
+        w.gainPreset = ok;
+    }
+
+    QProcess *process = new QProcess(this);
+    m_warmups.insert(file, process);
+    connect(process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this,
+            [this, process, w](int exitCode, QProcess::ExitStatus exitStatus) mutable {
+        m_warmups.remove(w.file);
+        if (exitStatus != QProcess::NormalExit || exitCode != 0) {
+            QStringList errLines = QString::fromUtf8(process->readAllStandardError())
+                                       .split('\n', Qt::SkipEmptyParts);
+            w.valid = false;
+            w.problem = errLines.isEmpty() ? QString("Python check failed.")
+                                           : errLines.last().trimmed();
+        }
+        process->deleteLater();
+        finish(w);
+    });
+    connect(process, &QProcess::errorOccurred, this, [this, process, w](QProcess::ProcessError error) {
+        // The interpreter itself is missing; do not hold the batch back on the warm-up.
+        if (error != QProcess::FailedToStart)
+            return;
+        qWarning() << "Could not start" << process->program() << "to pre-warm" << w.baseName;
+        m_warmups.remove(w.file);
+        process->deleteLater();
+        finish(w);
+    });
+    process->start(interpreter(), QStringList() << "-c" << kWarmupScript << file << w.imports);
+}
+
+bool WaveformPreparer::isPrepared(const QString &file) const
+{
+    return m_ready.contains(file);
+}
+
+bool WaveformPreparer::isPending(const QString &file) const
+{
+    return m_pending.contains(file);
+}
+
+PreparedWaveform WaveformPreparer::take(const QString &file)
+{
+    return m_ready.take(file);
+}
+
+void WaveformPreparer::discard(const QString &file)
+{
+    m_ready.remove(file);
+    m_pending.remove(file);
+    if (QProcess *process = m_warmups.take(file)) {
+        disconnect(process, nullptr, this, nullptr);
+        process->kill();
+        process->deleteLater();
+    }
+}
+
+void WaveformPreparer::finish(const PreparedWaveform &waveform)
+{
+    m_pending.remove(waveform.file);
+    m_ready.insert(waveform.file, waveform);
+    emit prepared(waveform);
+}
@@ -0,0 +1,68 @@
+#ifndef WAVEFORMPREPARER_H
+#define WAVEFORMPREPARER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QMap>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+class QProcess;
+
+// Everything the batch loop needs to know about a waveform before handing it to a tuner.
+struct PreparedWaveform {
+    QString file;
+    QString baseName;
+    bool valid = false;
+    bool excluded = false;
+    QString problem;        // Why the file cannot be tuned, when !valid
+    bool isL1L2 = false;
+    int channel = 0;        // Channel tuned first (0 for L1 and L1_L2 files)
+    int initialGain = 0;
+    bool gainPreset = false; // The initial gain has already been written to the file
+    QStringList imports;    // Top-level modules the flowgraph imports
+    QByteArray contentHash; // Normalized flowgraph hash (WaveformDedup), set by WaveformScanner
+};
+
+// Validates, parses and pre-edits the next waveform while the current one is being
+// measured, and warms the interpreter's module cache for it, so the batch loop can
+// hand over as soon as the rig is free.
+class WaveformPreparer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit WaveformPreparer(QObject *parent = nullptr);
+    ~WaveformPreparer();
+
+    // Static checks only (no file writes, no processes); safe to call from any thread.
+    static PreparedWaveform inspect(const QString &file, const QString &ampModel);
+    static bool isFileExcluded(const QString &fileName);
+    static int initialGainFor(const QString &ampModel);
+    // The GainPredictor's starting gain for file when it is confident, else the model's.
+    static int initialGainFor(const QString &file, const QString &ampModel, int channel, double maxPower);
+    static QString interpreter();
+    // Byte-compiles file in a blocking child interpreter; returns false with the error on failure.
+    static bool compileCheck(const QString &file, QString *error);
+
+    // Starts preparing file; prepared() is emitted when it is ready. When presetGain is set
+    // the initial gain for a maxPower target is written to the file up front.
+    void prepare(const QString &file, const QString &ampModel, bool presetGain, double maxPower);
+    bool isPrepared(const QString &file) const;
+    bool isPending(const QString &file) const;
+    PreparedWaveform take(const QString &file);
+    // Forgets file: a finished result is dropped and a warm-up still running is killed.
+    void discard(const QString &file);
+
+signals:
+    void prepared(const PreparedWaveform &waveform);
+
+private:
+    void finish(const PreparedWaveform &waveform);
+
+    QMap<QString, PreparedWaveform> m_ready;
+    QMap<QString, QProcess*> m_warmups;
+    QSet<QString> m_pending;
+};
+
+#endif // WAVEFORMPREPARER_H
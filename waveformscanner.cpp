@@ -0,0 +1,33 @@
+#include "waveformscanner.h"
+#include "waveformdedup.h"
+#include <QtConcurrent>
+
+namespace {
+
+struct ScanFile {
+    typedef PreparedWaveform result_type;
+
+    PreparedWaveform operator()(const TuneJob &job) const
+    {
+        PreparedWaveform w = WaveformPreparer::inspect(job.file, job.ampModel);
+        if (!w.valid)
+            return w;
+        QString error;
+        if (!WaveformPreparer::compileCheck(job.file, &error)) {
+            w.valid = false;
+            w.problem = error;
+            return w;
+        }
+        w.contentHash = WaveformDedup::contentHash(job.file);
+        return w;
+    }
+};
+
+} // namespace
+
+WaveformManifest WaveformScanner::scan(const QList<TuneJob> &jobs)
+{
+    WaveformManifest manifest;
+    manifest.entries = QtConcurrent::blockingMapped<QList<PreparedWaveform>>(jobs, ScanFile());
+    return manifest;
+}
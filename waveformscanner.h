@@ -0,0 +1,21 @@
+#ifndef WAVEFORMSCANNER_H
+#define WAVEFORMSCANNER_H
+
+#include <QList>
+#include "waveformpreparer.h"
+#include "tunejob.h"
+
+// Result of validating a whole batch up front, in the original job order.
+struct WaveformManifest {
+    QList<PreparedWaveform> entries;
+};
+
+// Validates every selected waveform on the global thread pool before any amp is touched:
+// exclusions, set_gain sites and channel resolution, and a Python byte-compile.
+class WaveformScanner
+{
+public:
+    static WaveformManifest scan(const QList<TuneJob> &jobs);
+};
+
+#endif // WAVEFORMSCANNER_H
@@ -1,8 +1,13 @@
 #include "waveformtuner.h"
+#include "gainpredictor.h"
+#include "tuneconfig.h"
 #include "amplifierserial.h"
 #include "pythoneditor.h"
 #include "pythonrunner.h"
 #include "wavelogger.h"
+#include "settleprofile.h"
+#include "loadwatchdog.h"
+#include "simulatedrig.h"
 #include <QTimer>
 #include <QDebug>
 #include <QtMath>
@@ -12,14 +17,16 @@
 #include <QTextStream>
 
 // Constructor
-WaveformTuner::WaveformTuner(QObject *parent, WaveLogger *logger)
+WaveformTuner::WaveformTuner(QObject *parent, WaveLogger *logger, AmplifierSerial *sharedAmps)
     : QObject(parent),
     m_currentGain(1),
     m_channel(0),
-    m_ampSerial(new AmplifierSerial(this)),
+    m_ampSerial(sharedAmps ? sharedAmps : new AmplifierSerial(this)),
+    m_ownsAmpSerial(sharedAmps == nullptr),
     m_pythonEditor(new PythonEditor(this)),
     m_pythonRunner(nullptr),
     m_delayTimer(new QTimer(this)),
+    m_watchdog(nullptr),
     m_state(Idle),
     m_logger(logger ? logger : new WaveLogger(this)),
     m_gainStep(1),
@@ -31,15 +38,57 @@ WaveformTuner::WaveformTuner(QObject *parent, WaveLogger *logger)
     m_finalStableMax(0.0)
 {
     m_delayTimer->setSingleShot(true);
+    m_watchdog = new LoadWatchdog(m_ampSerial, this);
     connect(m_ampSerial, &AmplifierSerial::ampOutput, this, &WaveformTuner::onAmpOutput);
     connect(m_ampSerial, &AmplifierSerial::ampError, this, &WaveformTuner::onAmpFault);
+    connect(m_ampSerial, &AmplifierSerial::batchFinished, this, &WaveformTuner::onAmpBatchFinished);
+    connect(m_ampSerial, &AmplifierSerial::commandReply, this, &WaveformTuner::onAmpReply);
+    connect(m_watchdog, &LoadWatchdog::loadFault, this, &WaveformTuner::onLoadFault);
+    // A sweep that fails part way still leaves the waveform as it found it.
+    connect(this, &WaveformTuner::tuningFailed, this, [this]() {
+        if (m_characterizing && !m_originalGains.isEmpty()) {
+            restoreSweptGains();
+            m_originalGains.clear();
+        }
+    });
     qDebug() << "WaveformTuner constructed, initial state Idle";
 }
 
 // Destructor
 WaveformTuner::~WaveformTuner()
 {
-    m_ampSerial->disconnectAll();
+    // A shared AmplifierSerial keeps its ports open for the next tuner.
+    if (m_ownsAmpSerial)
+        m_ampSerial->disconnectAll();
+}
+
+void WaveformTuner::abort(const QString &reason)
+{
+    if (m_ended)
+        return;
+    qDebug() << "Aborting tuning of" << m_waveformFile << ":" << reason;
+    fail(reason);
+}
+
+void WaveformTuner::fail(const QString &reason)
+{
+    if (m_ended)
+        return;
+    // Timers already scheduled by transitionToState see m_ended and do nothing.
+    m_ended = true;
+    m_state = Idle;
+    if (m_pythonRunner)
+        m_pythonRunner->stopScript();
+    emit tuningFailed(reason);
+}
+
+void WaveformTuner::finish()
+{
+    if (m_ended)
+        return;
+    m_ended = true;
+    m_state = Idle;
+    emit tuningFinished();
 }
 
 int WaveformTuner::extractChannelFromFile(const QString &filePath) {
@@ -78,21 +127,132 @@ void WaveformTuner::startTuning(const QString &waveformFile,
     m_minPower = minPower;
     m_maxPower = maxPower;
     m_critical = critical;
+    m_characterizing = false;
 
     // Determine initial gain based on amplifier model.
-    if (ampModel.compare("x300", Qt::CaseInsensitive) == 0)
-        m_initialGain = 0;
-    else if (ampModel.compare("N321", Qt::CaseInsensitive) == 0)
-        m_initialGain = 12;
-    else
-        m_initialGain = 0;
+    m_initialGain = WaveformPreparer::initialGainFor(ampModel);
     m_currentGain = m_initialGain;
+    if (m_resumeChannel >= 0) {
+        // Continue an interrupted run from its last known gain.
+        m_currentGain = m_resumeGain;
+        qDebug() << "Resuming channel" << m_resumeChannel << "from gain" << m_resumeGain;
+    }
+
+    beginSession();
+}
+
+void WaveformTuner::setTier(const QString &tier, const QString &promoteTo)
+{
+    m_baseTier = TuningTier::named(tier);
+    m_tier = m_baseTier;
+    m_promoteTier = promoteTo.isEmpty() ? TuningTier() : TuningTier::named(promoteTo);
+    m_promoteTo = !promoteTo.isEmpty() && m_promoteTier.name != m_baseTier.name;
+}
+
+bool WaveformTuner::stableAverage(const QList<double> &readings, double tolerance, double *avg) const
+{
+    const int n = m_tier.samples;
+    if (readings.size() < n)
+        return false;
+    const QList<double> recent = readings.mid(readings.size() - n);
+    double sum = recent.first();
+    for (int i = 1; i < n; ++i) {
+        if (qAbs(recent.at(i) - recent.at(i - 1)) >= tolerance)
+            return false;
+        sum += recent.at(i);
+    }
+    if (avg)
+        *avg = sum / n;
+    return true;
+}
+
+int WaveformTuner::initialGain(int channel) const
+{
+    return m_startGains.value(channel, m_initialGain);
+}
+
+void WaveformTuner::setResumePoint(int channel, int gain)
+{
+    m_resumeChannel = channel;
+    m_resumeGain = gain;
+}
+
+void WaveformTuner::startTuning(const PreparedWaveform &prepared,
+                                const QString &ampModel,
+                                double minPower,
+                                double maxPower,
+                                const QString &critical)
+{
+    // Kept only if the tune starts from the same gain (checked once it is predicted).
+    m_gainPreset = prepared.gainPreset && m_resumeChannel < 0;
+    m_presetGain = prepared.initialGain;
+    startTuning(prepared.file, ampModel, minPower, maxPower, critical);
+}
+
+void WaveformTuner::startCharacterization(const QString &waveformFile, const QString &ampModel)
+{
+    m_waveformFile = waveformFile;
+    m_ampModel = ampModel;
+    m_characterizing = true;
+    m_gainPreset = false;
+    m_sweepDone = false;
+    m_sweepFaults = 0;
+    m_critical = "HIGH";
+
+    beginSession();
+}
+
+void WaveformTuner::beginSession()
+{
+    // One snapshot for the whole session: another lane may apply a reload meanwhile.
+    m_config = TuneConfig::current();
+    const TuneConfig &config = *m_config;
+    m_pythonEditor->setConfig(m_config);
+
+    if (m_characterizing) {
+        m_initialGain = config.sweepStart;
+        m_sweepStop = config.sweepStop;
+        m_sweepStep = config.sweepStep;
+        m_sweepCeiling = config.sweepMaxPower;
+        // ALC is measured at a low level so the sweep records the lowest output the ALC can reach.
+        m_minPower = config.sweepAlcLevel;
+        m_maxPower = m_sweepCeiling;
+        m_currentGain = m_initialGain;
+        qDebug() << "Starting characterization of" << m_waveformFile << "for" << m_ampModel
+                 << "over gains" << m_initialGain << "to" << m_sweepStop << "step" << m_sweepStep;
+    }
+
+    // The configured minimum gain bounds the LOW-critical minimum search.
+    m_gainFloor = config.gainMin;
+    m_gainCeiling = config.gainMax;
+    resetMinSearch();
+
+    // Pass gains to the flowgraph at launch instead of rewriting it on every iteration.
+    m_injectGains = config.launchOverrides;
+    m_gainOverrides.clear();
+
+    // Optional second-stage trim of the max power through the amp's VVA level.
+    m_fineTrimEnabled = config.fineTrimEnabled;
+    m_vvaDbPerLevel = config.fineTrimDbPerLevel;
+    m_vvaMinLevel = config.fineTrimMinLevel;
+    m_vvaTrimMaxIterations = config.fineTrimMaxIterations;
+    m_vvaTrimMaxRestarts = config.fineTrimMaxRestarts;
+    m_vvaTrimRestarts = 0;
+    m_vvaRefRecheck = false;
+    m_vvaLevel = 100.0;
+
+    // Skip the amp setup sequence when the previous tuner left the amp configured.
+    m_reuseAmpSetup = config.reuseAmpSetup;
+    m_setupReady.clear();
 
     // Determine the channel.
     QString fileName = QFileInfo(m_waveformFile).fileName();
     if (fileName.startsWith("L1_L2_")) {
         m_isL1L2 = true;
         m_channel = 0;  // For L1_L2, start with channel 0 (later switch to channel 1)
+        // Channel 0 was already finished (and written) if the run was interrupted on channel 1.
+        if (!m_characterizing && m_resumeChannel == 1)
+            m_channel = 1;
     }
     else if (fileName.startsWith("L2_")) {
         m_isL1L2 = false;
@@ -103,19 +263,93 @@ void WaveformTuner::startTuning(const QString &waveformFile,
         m_channel = 0;
     }
 
-    m_ampSerial->disconnectAll();
-    qDebug() << "Searching for amplifier devices...";
-    m_ampSerial->searchAndConnect();
+    m_startGains.clear();
+    if (!m_characterizing && config.predictorEnabled) {
+        // Start each channel from the gain similar flowgraphs needed, when that is known well enough.
+        QList<int> channels;
+        if (m_isL1L2)
+            channels << 0 << 1;
+        else
+            channels << m_channel;
+        for (int ch : channels) {
+            const GainPrediction prediction = GainPredictor::predict(m_waveformFile, m_ampModel, ch, m_maxPower, config);
+            QString logMsg;
+            if (prediction.ok) {
+                m_startGains.insert(ch, prediction.gain);
+                logMsg = QString("%1 ch %2: starting at gain %3 (%4 predicts %5 +/- %6 dB from %7 tunes)")
+                             .arg(fileName, ch == 0 ? "L1" : "L2").arg(prediction.gain)
+                             .arg(prediction.source).arg(prediction.predicted, 0, 'f', 1)
+                             .arg(prediction.sigmaDb, 0, 'f', 1).arg(prediction.samples);
+            } else {
+                logMsg = QString("%1 ch %2: no gain prediction, starting at gain %3: %4")
+                             .arg(fileName, ch == 0 ? "L1" : "L2").arg(m_initialGain).arg(prediction.reason);
+            }
+            if (m_logger)
+                m_logger->debugAndLog(logMsg);
+        }
+        if (m_resumeChannel < 0)
+            m_currentGain = initialGain(m_channel);
+    }
+    if (m_gainPreset && m_presetGain != m_currentGain)
+        m_gainPreset = false;
+    m_channelStartIteration = m_iteration;
+
+    if (m_characterizing) {
+        // Remember the file's gains so the sweep leaves the waveform as it found it.
+        m_originalGains.clear();
+        QList<int> channels;
+        if (m_isL1L2)
+            channels << 0 << 1;
+        else
+            channels << m_channel;
+        for (int ch : channels) {
+            int gain = 0;
+            if (!m_pythonEditor->readGainValue(m_waveformFile, ch, &gain)) {
+                fail(QString("Cannot read the current gain for channel %1.").arg(ch));
+                return;
+            }
+            m_originalGains.insert(ch, gain);
+        }
+        m_curve = GainCurve();
+        m_curve.waveform = fileName;
+        m_curve.ampModel = m_ampModel;
+        m_curve.channel = m_channel;
+        m_curve.alcLevel = m_minPower;
+    }
+
+    if (m_ownsAmpSerial || m_ampSerial->connectedDevices().isEmpty()) {
+        m_ampSerial->disconnectAll();
+        qDebug() << "Searching for amplifier devices...";
+        m_ampSerial->searchAndConnect();
+    }
     m_allAmpDevices = m_ampSerial->connectedDevices();
+    // Another tuner may be running on the other amp of the rig.
+    if (!m_deviceFilter.isEmpty()) {
+        QStringList owned;
+        for (const QString &dev : qAsConst(m_allAmpDevices)) {
+            if (m_deviceFilter.contains(dev))
+                owned << dev;
+        }
+        m_allAmpDevices = owned;
+    }
+    // Serial numbers select the amps' settle profiles.
+    for (const QString &dev : qAsConst(m_allAmpDevices)) {
+        if (m_ampSerial->identity(dev) == dev)
+            m_ampSerial->getSerialId(dev);
+    }
     qDebug() << "Connected amp devices:" << m_allAmpDevices;
     if (m_allAmpDevices.isEmpty()) {
-        emit tuningFailed("No amplifier devices found.");
+        fail("No amplifier devices found.");
         return;
     }
 
     resetRollingAverages();
-    m_pythonRunner = new PythonRunner(m_waveformFile, this);
+    m_pythonRunner = new PythonRunner(m_waveformFile, m_config, this);
     connect(m_pythonRunner, &PythonRunner::pythonOutput, this, &WaveformTuner::onPythonOutput);
+    // The load is watched whenever the waveform is transmitting.
+    connect(m_pythonRunner, &PythonRunner::scriptStarted, this, [this]() { m_watchdog->start(targetDevices()); });
+    connect(m_pythonRunner, &PythonRunner::scriptStopped, m_watchdog, &LoadWatchdog::stop);
+    connect(m_pythonRunner, &PythonRunner::scriptFinished, m_watchdog, &LoadWatchdog::stop);
     m_delayTimer->singleShot(1000, this, [this]() { transitionToState(CheckAmpMode); });
 }
 
@@ -125,50 +359,174 @@ void WaveformTuner::resetRollingAverages()
     m_testingAmpDevices.clear();
 }
 
+void WaveformTuner::resetMinSearch()
+{
+    m_minSearchActive = false;
+    m_minSearchLowVerified = false;
+    m_minSearchResolved = false;
+    m_minSearchLow = m_gainFloor;
+    m_minSearchHigh = m_currentGain;
+    m_minSearchLowAlc = 0.0;
+    m_lastAlcExcess = -1.0;
+    m_alcRangeCount = 0;
+}
+
+int WaveformTuner::nextMinSearchGain() const
+{
+    // Adjacent bracket ends: the answer is the low end (re-run it if it was only assumed).
+    if (m_minSearchHigh - m_minSearchLow <= 1)
+        return m_minSearchLow;
+
+    // Until a gain meeting the minimum is known, step by the measured excess
+    // (ALC output tracks SDR gain roughly dB for dB) instead of halving all the
+    // way down to the floor.
+    if (!m_minSearchLowVerified && m_lastAlcExcess > 0.0) {
+        int guess = m_minSearchHigh - qMax(1, qCeil(m_lastAlcExcess - 0.2));
+        return qBound(m_minSearchLow, guess, m_minSearchHigh - 1);
+    }
+
+    // Otherwise bisect the bracket.
+    return m_minSearchLow + (m_minSearchHigh - m_minSearchLow) / 2;
+}
+
+bool WaveformTuner::applyGain(int channel, int gain)
+{
+    if (!m_injectGains)
+        return m_pythonEditor->editGainValue(m_waveformFile, gain, channel);
+
+    // Validate as the editor would, but only remember the value; it is applied at launch.
+    if (gain < m_gainFloor || gain > m_gainCeiling) {
+        qWarning() << "Gain value out of allowed range:" << gain
+                   << "(Allowed range:" << m_gainFloor << "to" << m_gainCeiling << ")";
+        return false;
+    }
+    if (!m_pythonEditor->gainSite(m_waveformFile, channel, nullptr)) {
+        qWarning() << "No set_gain call resolves to channel" << channel << "in" << m_waveformFile;
+        return false;
+    }
+    m_gainOverrides.insert(channel, gain);
+    return true;
+}
+
+bool WaveformTuner::restoreSweptGains()
+{
+    // SetInitialGain writes both lines while channel 0 of an L1_L2 file is swept.
+    QList<int> channels;
+    if (m_isL1L2 && m_channel == 0)
+        channels << 0 << 1;
+    else
+        channels << m_channel;
+    bool ok = true;
+    for (int ch : channels) {
+        if (!m_originalGains.contains(ch))
+            continue;
+        // With launch overrides the file was never touched, so this write is skipped as unchanged.
+        m_gainOverrides.remove(ch);
+        if (!m_pythonEditor->editGainValue(m_waveformFile, m_originalGains.value(ch), ch)) {
+            qWarning() << "Failed to restore gain" << m_originalGains.value(ch) << "on channel" << ch
+                       << "of" << m_waveformFile;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+void WaveformTuner::syncGainOverrides()
+{
+    // Sites are resolved at launch time, since a final write may have shifted offsets.
+    QList<GainSite> overrides;
+    for (auto it = m_gainOverrides.constBegin(); it != m_gainOverrides.constEnd(); ++it) {
+        GainSite site;
+        if (m_pythonEditor->gainSite(m_waveformFile, it.key(), &site)) {
+            site.value = it.value();
+            overrides << site;
+        }
+    }
+    m_pythonRunner->setGainOverrides(overrides);
+}
+
+int WaveformTuner::coarseGainStep(double diff) const
+{
+    if (diff > 2.2)
+        return 5;
+    if (diff > 1.8)
+        return 4;
+    if (diff > 1.2)
+        return 3;
+    if (diff > 0.6)
+        return 2;
+    return 1;
+}
+
+void WaveformTuner::startVvaTrim(double avg)
+{
+    // avg was measured at VVA level 100 for the current SDR gain.
+    m_vvaRefPower = avg;
+    m_vvaRefGain = m_currentGain;
+    m_vvaBestLevel = m_vvaLevel;
+    m_vvaBestPower = avg;
+    m_vvaPrevLevel = m_vvaLevel;
+    m_vvaPrevPower = avg;
+    m_vvaTrimIterations = 0;
+    double excess = avg - m_maxPower;
+    m_vvaLevel = qBound(m_vvaMinLevel, m_vvaLevel - excess / m_vvaDbPerLevel, 100.0);
+    qDebug() << "Fine trim: measured" << avg << "dBm at VVA level" << m_vvaPrevLevel
+             << ", trying VVA level" << m_vvaLevel;
+    m_delayTimer->singleShot(500, this, [this](){ transitionToState(VvaTrimSet); });
+}
+
 QStringList WaveformTuner::targetDevices() const {
     // If only one amp was found, always return that amp.
     if (m_allAmpDevices.size() == 1)
         return m_allAmpDevices;
 
     // If two or more are available, choose one based on m_channel.
-    if (m_allAmpDevices.size() >= 2) {
-        QStringList result;
-        if (m_channel == 0) {
-            // Look for a device name that clearly indicates "L1" (but not "L1L2" or "L2")
-            for (const QString &dev : m_allAmpDevices) {
-                if (dev.contains("L1", Qt::CaseInsensitive) &&
-                    !dev.contains("L2", Qt::CaseInsensitive)) {
-                    result << dev;
-                    break;
-                }
-            }
-            if (result.isEmpty())
-                result << m_allAmpDevices.first();
-        }
-        else if (m_channel == 1) {
-            // Look for a device name that clearly indicates "L2" (and not "L1L2")
-            for (const QString &dev : m_allAmpDevices) {
-                if (dev.contains("L2", Qt::CaseInsensitive) &&
-                    !dev.contains("L1", Qt::CaseInsensitive)) {
-                    result << dev;
-                    break;
-                }
-            }
-            if (result.isEmpty()) {
-                // Fallback: if at least two exist, pick the second one.
-                if (m_allAmpDevices.size() >= 2)
-                    result << m_allAmpDevices.at(1);
-                else
-                    result << m_allAmpDevices.first();
-            }
+    if (m_allAmpDevices.size() >= 2 && (m_channel == 0 || m_channel == 1))
+        return QStringList() << deviceForChannel(m_allAmpDevices, m_channel);
+    return m_allAmpDevices;
+}
+
+QString WaveformTuner::deviceForChannel(const QStringList &devices, int channel)
+{
+    if (devices.isEmpty())
+        return QString();
+    if (channel == 0) {
+        // Look for a device name that clearly indicates "L1" (but not "L1L2" or "L2")
+        for (const QString &dev : devices) {
+            if (dev.contains("L1", Qt::CaseInsensitive) &&
+                !dev.contains("L2", Qt::CaseInsensitive))
+                return dev;
         }
-        return result;
+        return devices.first();
     }
-    return m_allAmpDevices;
+    // Look for a device name that clearly indicates "L2" (and not "L1L2")
+    for (const QString &dev : devices) {
+        if (dev.contains("L2", Qt::CaseInsensitive) &&
+            !dev.contains("L1", Qt::CaseInsensitive))
+            return dev;
+    }
+    // Fallback: if at least two exist, pick the second one.
+    return devices.size() >= 2 ? devices.at(1) : devices.first();
+}
+
+void WaveformTuner::setDevices(const QStringList &devices)
+{
+    m_deviceFilter = devices;
+}
+
+bool WaveformTuner::ownsDevice(const QString &device) const
+{
+    return m_deviceFilter.isEmpty() || m_deviceFilter.contains(device);
 }
 
 void WaveformTuner::transitionToState(TuningState newState)
 {
+    if (m_ended)
+        return;
+    // Replies to an earlier measurement's queries, still in flight, no longer count.
+    const int phase = measurementPhase(newState);
+    if (phase != 0 && phase != measurementPhase(m_state))
+        m_fwdTag = m_ampSerial->nextTag();
     m_state = newState;
     switch(m_state) {
     case CheckAmpMode: {
@@ -178,64 +536,44 @@ void WaveformTuner::transitionToState(TuningState newState)
             m_ampSerial->sendCommand("MODE?", dev);
     }
     break;
-    case InitialModeVVA: {
-        QStringList targets = targetDevices();
-        for (const QString &dev : targets)
-            m_ampSerial->setMode("VVA", dev);
-        m_delayTimer->singleShot(1200, this, [this](){ transitionToState(InitialVvaLevel); });
-    }
-    break;
-    case InitialVvaLevel: {
-        QStringList targets = targetDevices();
-        for (const QString &dev : targets)
-            m_ampSerial->setGainLvl(100, dev);
-        m_delayTimer->singleShot(1000, this, [this](){ transitionToState(InitialModeALC); });
-    }
-    break;
-    case InitialModeALC: {
-        QStringList targets = targetDevices();
-        for (const QString &dev : targets)
-            m_ampSerial->setMode("ALC", dev);
-        m_delayTimer->singleShot(1000, this, [this](){ transitionToState(InitialAlcLevel); });
-    }
-    break;
-    case InitialAlcLevel: {
-        QStringList targets = targetDevices();
-        for (const QString &dev : targets)
-            m_ampSerial->setAlcLvl(m_minPower, dev);
-        m_delayTimer->singleShot(1000, this, [this](){ transitionToState(SetOnline); });
-    }
-    break;
-    case SetOnline: {
-        QStringList targets = targetDevices();
-        for (const QString &dev : targets)
-            m_ampSerial->sendCommand("ONLINE", dev);
-        m_delayTimer->singleShot(500, this, [this](){ transitionToState(SetInitialGain); });
+    case InitialSetup: {
+        // The whole standby-to-online sequence goes out in one write per amp.
+        qDebug() << "Configuring target amp: VVA 100, ALC" << m_minPower << "dBm, online.";
+        QStringList commands;
+        commands << "MODE VVA"
+                 << "VVA_LEVEL 100.0"
+                 << "MODE ALC"
+                 << QString("ALC_LEVEL %1").arg(m_minPower, 0, 'f', 1)
+                 << "ONLINE";
+        runAmpBatch(commands, SetInitialGain, settleDelay({"Online"}, 500));
     }
     break;
     case SetInitialGain:
         qDebug() << "Step 1: Setting initial gain to" << m_currentGain << "dBm.";
-        if (m_isL1L2) {
+        if (m_gainPreset) {
+            // Written while the previous waveform was being measured.
+            m_gainPreset = false;
+        } else if (m_isL1L2) {
             if (m_channel == 0) {
                 // For channel 0 on an L1_L2 file, update both gain lines.
-                if (!m_pythonEditor->editGainValue(m_waveformFile, m_currentGain, 0)) {
-                    emit tuningFailed("Failed to set initial gain for channel 0.");
+                if (!applyGain(0, m_currentGain)) {
+                    fail("Failed to set initial gain for channel 0.");
                     return;
                 }
-                if (!m_pythonEditor->editGainValue(m_waveformFile, m_currentGain, 1)) {
-                    emit tuningFailed("Failed to set initial gain for channel 1.");
+                if (!applyGain(1, m_currentGain)) {
+                    fail("Failed to set initial gain for channel 1.");
                     return;
                 }
             } else {
                 // For channel 1 tuning, update only the channel 1 line.
-                if (!m_pythonEditor->editGainValue(m_waveformFile, m_currentGain, 1)) {
-                    emit tuningFailed("Failed to set initial gain for channel 1.");
+                if (!applyGain(1, m_currentGain)) {
+                    fail("Failed to set initial gain for channel 1.");
                     return;
                 }
             }
         } else {
-            if (!m_pythonEditor->editGainValue(m_waveformFile, m_currentGain, m_channel)) {
-                emit tuningFailed("Failed to set initial gain.");
+            if (!applyGain(m_channel, m_currentGain)) {
+                fail("Failed to set initial gain.");
                 return;
             }
         }
@@ -243,6 +581,8 @@ void WaveformTuner::transitionToState(TuningState newState)
         break;
     case StartWaveform:
         qDebug() << "Step 2: Starting waveform.";
+        emit progress(m_channel, m_currentGain, ++m_iteration);
+        syncGainOverrides();
         m_pythonRunner->startScript();
         transitionToState(WaitForPythonPrompt);
         break;
@@ -250,28 +590,18 @@ void WaveformTuner::transitionToState(TuningState newState)
         qDebug() << "Waiting for waveform to start...";
         break;
     case SetModeVVA_All: {
-        qDebug() << "Step 3: Setting mode VVA (Gain) on target amp.";
-        QStringList targets = targetDevices();
-        for (const QString &dev : targets)
-            m_ampSerial->setMode("VVA", dev);
-        m_delayTimer->singleShot(1000, this, [this](){ transitionToState(SetGain100_All); });
-    }
-    break;
-    case SetGain100_All: {
-        qDebug() << "Setting gain level to 100 on target amp.";
-        QStringList targets = targetDevices();
-        for (const QString &dev : targets)
-            m_ampSerial->setGainLvl(100, dev);
-        m_delayTimer->singleShot(1000, this, [this](){ transitionToState(QueryFwdPwr); });
+        qDebug() << "Step 3: Setting mode VVA (Gain) and gain level 100 on target amp.";
+        m_vvaLevel = 100.0;
+        runAmpBatch(QStringList() << "MODE VVA" << "VVA_LEVEL 100.0", QueryFwdPwr,
+                    settleDelay({"ModeVva", "VvaLevel"}, 1000));
     }
     break;
     case QueryFwdPwr: {
         qDebug() << "Step 4: Querying forward power on target amp.";
         QStringList targets = targetDevices();
-        for (const QString &dev : targets) {
+        for (const QString &dev : targets)
             m_ampReadings[dev].clear();
-            m_ampSerial->getFwdPwr(dev);
-        }
+        queryFwdPwr();
         m_delayTimer->singleShot(500, this, [this](){ transitionToState(WaitForStable); });
     }
     break;
@@ -280,66 +610,59 @@ void WaveformTuner::transitionToState(TuningState newState)
         qDebug() << "Checking for stable forward power on target amp...";
         QStringList targets = targetDevices();
         for (const QString &dev : targets) {
-            int numReadings = m_ampReadings[dev].size();
-            if (numReadings >= 3) {
-                QList<double> lastThree = m_ampReadings[dev].mid(numReadings - 3, 3);
-                if (qAbs(lastThree[0] - lastThree[1]) < 0.1 &&
-                    qAbs(lastThree[1] - lastThree[2]) < 0.1) {
-                    if (!m_testingAmpDevices.contains(dev))
-                        m_testingAmpDevices.append(dev);
-                    stableFound = true;
-                }
+            if (stableAverage(m_ampReadings[dev], m_tier.stableToleranceDb, nullptr)) {
+                if (!m_testingAmpDevices.contains(dev))
+                    m_testingAmpDevices.append(dev);
+                stableFound = true;
             }
         }
+        // The waveform keeps running so the ALC minimum can be measured in the same run.
         if (stableFound)
-            m_delayTimer->singleShot(500, this, [this](){ transitionToState(StopWaveform); });
+            m_delayTimer->singleShot(500, this, [this](){ transitionToState(ComparePower); });
         else {
-            QStringList targets = targetDevices();
-            for (const QString &dev : targets)
-                m_ampSerial->getFwdPwr(dev);
+            queryFwdPwr();
             m_delayTimer->singleShot(500, this, [this](){ transitionToState(WaitForStable); });
         }
     }
     break;
-    case StopWaveform:
-        qDebug() << "Step 5: Stopping waveform.";
-        m_pythonRunner->stopScript();
-        m_delayTimer->singleShot(500, this, [this](){ transitionToState(ComparePower); });
-        break;
     case ComparePower: {
-        qDebug() << "Step 6: Comparing results to target" << m_maxPower << "dBm on target amp.";
+        qDebug() << "Step 5: Comparing results to target" << m_maxPower << "dBm on target amp.";
         double total = 0;
         int count = 0;
         QStringList targets = targetDevices();
         for (const QString &dev : targets) {
             int numReadings = m_ampReadings[dev].size();
-            if (numReadings >= 3) {
-                QList<double> lastThree = m_ampReadings[dev].mid(numReadings - 3, 3);
+            if (numReadings >= m_tier.samples) {
+                const QList<double> recent = m_ampReadings[dev].mid(numReadings - m_tier.samples);
                 double sum = 0;
-                for (double r : lastThree)
+                for (double r : recent)
                     sum += r;
-                double devAvg = sum / lastThree.size();
-                total += devAvg;
+                total += sum / recent.size();
                 ++count;
             }
         }
         double avg = (count > 0) ? total / count : 0;
+        if (m_characterizing) {
+            // Record the VVA point and measure ALC on the same run.
+            m_sweepPoint = GainPoint();
+            m_sweepPoint.gain = m_currentGain;
+            m_sweepPoint.vvaPower = avg;
+            m_sweepDone = (avg >= m_sweepCeiling);
+            qDebug() << "Characterization: gain" << m_currentGain << "VVA power" << avg << "dBm";
+            m_delayTimer->singleShot(1000, this, [this](){ transitionToState(SetModeALC); });
+            break;
+        }
         double diff = m_maxPower - avg;
         qDebug() << "Measured average:" << avg << "Difference:" << diff;
-        if (diff > 0.1) {
-            if (diff > 2.2)
-                m_gainStep = 5;
-            else if (diff > 1.8)
-                m_gainStep = 4;
-            else if (diff > 1.2)
-                m_gainStep = 3;
-            else if (diff > 0.6)
-                m_gainStep = 2;
-            else
-                m_gainStep = 1;
+        if (diff > m_tier.windowBelowDb) {
+            m_gainStep = coarseGainStep(diff);
             m_delayTimer->singleShot(1000, this, [this](){ transitionToState(AdjustGainUp); });
         }
-        else if (diff < -0.3) {
+        else if (diff < -m_tier.windowAboveDb && m_fineTrimEnabled) {
+            // The coarse gain brackets the target from above; close the loop on the VVA level live.
+            startVvaTrim(avg);
+        }
+        else if (diff < -m_tier.windowAboveDb) {
             m_gainStep = 1;
             // Store the computed average for later use in AdjustGainDown.
             m_lastAvg = avg;
@@ -352,63 +675,162 @@ void WaveformTuner::transitionToState(TuningState newState)
     }
     break;
     case AdjustGainUp: {
-        qDebug() << "Step 7: Increasing gain. New gain:" << (m_currentGain + m_gainStep);
+        qDebug() << "Step 6: Stopping waveform and increasing gain. New gain:" << (m_currentGain + m_gainStep);
+        m_pythonRunner->stopScript();
         m_lastGainAdjustment = 1;
         m_currentGain += m_gainStep;
         QStringList targets = targetDevices();
         for (const QString &dev : targets)
             m_ampReadings[dev].clear();
-        if (!m_pythonEditor->editGainValue(m_waveformFile, m_currentGain, m_channel)) {
-            emit tuningFailed("Failed to increment gain.");
+        if (!applyGain(m_channel, m_currentGain)) {
+            fail("Failed to increment gain.");
             return;
         }
         m_delayTimer->singleShot(1000, this, [this](){ transitionToState(StartWaveform); });
     }
     break;
     case AdjustGainDown: {
-        qDebug() << "Step 7: Lowering gain. New gain:" << (m_currentGain - m_gainStep);
+        qDebug() << "Step 6: Lowering gain. New gain:" << (m_currentGain - m_gainStep);
         m_lastGainAdjustment = -1;
         // Increment the down-adjust counter.
         m_adjustDownCount++;
-        // If we've reached 3 downward adjustments, accept the higher gain value.
-        if (m_adjustDownCount >= 3) {
-            qDebug() << "AdjustGainDown reached 3 times; accepting stable max:" << m_lastAvg;
+        // After the tier's limit of downward adjustments, accept the higher gain value.
+        if (m_adjustDownCount >= m_tier.maxAdjustDown) {
+            qDebug() << "AdjustGainDown reached" << m_adjustDownCount << "times; accepting stable max:" << m_lastAvg;
             m_finalStableMax = m_lastAvg;
             m_adjustDownCount = 0; // reset counter for future use.
             m_delayTimer->singleShot(1000, this, [this](){ transitionToState(SetModeALC); });
         } else {
+            m_pythonRunner->stopScript();
             m_currentGain -= m_gainStep;
             QStringList targets = targetDevices();
             for (const QString &dev : targets)
                 m_ampReadings[dev].clear();
-            if (!m_pythonEditor->editGainValue(m_waveformFile, m_currentGain, m_channel)) {
-                emit tuningFailed("Failed to decrement gain.");
+            if (!applyGain(m_channel, m_currentGain)) {
+                fail("Failed to decrement gain.");
                 return;
             }
             m_delayTimer->singleShot(1000, this, [this](){ transitionToState(StartWaveform); });
         }
     }
     break;
-    case SetModeALC: {
-        qDebug() << "Step 8: Setting up ALC test for minimum power on target amp.";
+    case VvaTrimSet: {
         QStringList targets = targetDevices();
         for (const QString &dev : targets) {
             m_ampReadings[dev].clear();
-            m_ampSerial->setMode("ALC", dev);
+            m_ampSerial->setGainLvl(m_vvaLevel, dev);
         }
-        m_delayTimer->singleShot(1500, this, [this](){ transitionToState(PreSetAlc); });
+        m_delayTimer->singleShot(1000, this, [this](){ transitionToState(VvaTrimQuery); });
     }
     break;
-    case PreSetAlc: {
-        qDebug() << "Setting ALC level to" << m_minPower << "dBm on target amp.";
+    case VvaTrimQuery: {
+        queryFwdPwr();
+        m_delayTimer->singleShot(500, this, [this](){ transitionToState(VvaTrimWait); });
+    }
+    break;
+    case VvaTrimWait: {
+        double total = 0;
+        int count = 0;
+        bool allReady = true;
+        QStringList targets = targetDevices();
+        for (const QString &dev : targets) {
+            double devAvg = 0.0;
+            if (stableAverage(m_ampReadings[dev], m_tier.stableToleranceDb, &devAvg)) {
+                total += devAvg;
+                ++count;
+            } else {
+                allReady = false;
+            }
+        }
+        if (!allReady || count == 0) {
+            m_delayTimer->singleShot(500, this, [this](){ transitionToState(VvaTrimQuery); });
+            break;
+        }
+        double avg = total / count;
+        double diff = m_maxPower - avg;
+        ++m_vvaTrimIterations;
+        qDebug() << "Fine trim: VVA level" << m_vvaLevel << "gives" << avg << "dBm, difference:" << diff;
+
+        if (qAbs(diff) < qAbs(m_maxPower - m_vvaBestPower)) {
+            m_vvaBestLevel = m_vvaLevel;
+            m_vvaBestPower = avg;
+        }
+
+        // Refine the dB-per-level slope from the last two points.
+        if (qAbs(m_vvaLevel - m_vvaPrevLevel) > 0.05) {
+            double slope = (avg - m_vvaPrevPower) / (m_vvaLevel - m_vvaPrevLevel);
+            if (slope > 0.001)
+                m_vvaDbPerLevel = slope;
+        }
+
+        if (diff <= m_tier.windowBelowDb && diff >= -m_tier.windowAboveDb) {
+            m_finalStableMax = avg;
+            m_delayTimer->singleShot(1000, this, [this](){ transitionToState(SetModeALC); });
+            break;
+        }
+
+        double nextLevel = qBound(m_vvaMinLevel, m_vvaLevel + diff / m_vvaDbPerLevel, 100.0);
+        bool pinned = qAbs(nextLevel - m_vvaLevel) < 0.05;
+        if (m_vvaTrimIterations >= m_vvaTrimMaxIterations || pinned) {
+            const double bestDiff = m_maxPower - m_vvaBestPower;
+            if (bestDiff >= -m_tier.windowAboveDb && bestDiff <= m_tier.windowBelowDb) {
+                // Not converging, but some level landed inside the window: keep the closest one.
+                qDebug() << "Fine trim did not converge; keeping VVA level" << m_vvaBestLevel
+                         << "at" << m_vvaBestPower << "dBm.";
+                m_vvaLevel = m_vvaBestLevel;
+                m_finalStableMax = m_vvaBestPower;
+                m_delayTimer->singleShot(1000, this, [this](){ transitionToState(SetModeALC); });
+                break;
+            }
+            // Either even the lowest VVA level is above the target, or the closest level
+            // still undershoots it (full VVA was above, so the trim steps over the window).
+            // Both call for a lower SDR gain, which leaves the trim less to take off.
+            const bool below = bestDiff > m_tier.windowBelowDb;
+            if (++m_vvaTrimRestarts > m_vvaTrimMaxRestarts) {
+                fail(below ? QString("Fine trim kept landing below the %1 dBm max (closest %2 dBm at VVA %3) after %4 gain steps.")
+                                 .arg(m_maxPower).arg(m_vvaBestPower, 0, 'f', 2).arg(m_vvaBestLevel, 0, 'f', 1)
+                                 .arg(m_vvaTrimMaxRestarts)
+                           : QString("Fine trim could not bring the max down to %1 dBm after %2 gain steps.")
+                                 .arg(m_maxPower).arg(m_vvaTrimMaxRestarts));
+                return;
+            }
+            qDebug() << "Fine trim ended" << (below ? "below" : "above") << "the window at" << m_vvaBestPower
+                     << "dBm; stepping the SDR gain down.";
+            m_vvaLevel = 100.0;
+            m_gainStep = below ? 1 : coarseGainStep(-bestDiff);
+            m_lastAvg = m_vvaRefPower;
+            m_delayTimer->singleShot(1000, this, [this](){ transitionToState(AdjustGainDown); });
+            break;
+        }
+        m_vvaPrevLevel = m_vvaLevel;
+        m_vvaPrevPower = avg;
+        m_vvaLevel = nextLevel;
+        m_delayTimer->singleShot(500, this, [this](){ transitionToState(VvaTrimSet); });
+    }
+    break;
+    case SetModeALC: {
+        qDebug() << "Step 7: Switching target amp to ALC for the minimum power test.";
         QStringList targets = targetDevices();
         for (const QString &dev : targets)
-            m_ampSerial->setAlcLvl(m_minPower, dev);
-        m_delayTimer->singleShot(1500, this, [this](){ transitionToState(StartWaveform_ALC); });
+            m_ampReadings[dev].clear();
+        qDebug() << "Setting ALC level to" << m_minPower << "dBm on target amp.";
+        QStringList commands;
+        commands << "MODE ALC" << QString("ALC_LEVEL %1").arg(m_minPower, 0, 'f', 1);
+        runAmpBatch(commands, PreSetAlc, settleDelay({"ModeAlc", "AlcLevel"}, 1500));
+    }
+    break;
+    case PreSetAlc: {
+        // Measure on the flowgraph that is already transmitting; only start it if it is not running.
+        if (m_pythonRunner->isRunning())
+            m_delayTimer->singleShot(1500, this, [this](){ transitionToState(QueryFwdPwrALC); });
+        else
+            m_delayTimer->singleShot(1500, this, [this](){ transitionToState(StartWaveform_ALC); });
     }
     break;
     case StartWaveform_ALC:
-        qDebug() << "Step 9: Starting waveform in ALC mode.";
+        qDebug() << "Step 8: Starting waveform in ALC mode.";
+        emit progress(m_channel, m_currentGain, ++m_iteration);
+        syncGainOverrides();
         m_pythonRunner->startScript();
         transitionToState(WaitForPythonPrompt_ALC);
         break;
@@ -416,33 +838,48 @@ void WaveformTuner::transitionToState(TuningState newState)
         qDebug() << "Waiting for waveform to start in ALC mode...";
         break;
     case QueryFwdPwrALC: {
-        qDebug() << "Step 10: Querying forward power in ALC mode on target amp.";
-        QStringList targets = targetDevices();
-        for (const QString &dev : targets)
-            m_ampSerial->getFwdPwr(dev);
+        qDebug() << "Step 9: Querying forward power in ALC mode on target amp.";
+        queryFwdPwr();
         m_delayTimer->singleShot(1000, this, [this](){ transitionToState(WaitForAlcStable); });
     }
     break;
     case WaitForAlcStable: {
-        const double tolerance = 0.2;
+        const double tolerance = m_tier.alcToleranceDb;
+        const bool lowCritical = (m_critical.compare("LOW", Qt::CaseInsensitive) == 0);
+
+        if (m_characterizing && m_alcRangeCount >= 3) {
+            m_alcRangeCount = 0;
+            m_sweepPoint.alcPower = m_sweepPoint.vvaPower;
+            m_sweepPoint.alcSaturated = true;
+            m_curve.points.append(m_sweepPoint);
+            qDebug() << "Characterization: gain" << m_currentGain << "ALC saturated";
+            m_delayTimer->singleShot(500, this, [this]() { transitionToState(CharacterizeNext); });
+            break;
+        }
+
+        // Repeated "ALC Range" replies mean the amp cannot pull the output down to the
+        // ALC level at this drive; treat it as an overshoot without waiting for stability.
+        if (lowCritical && m_alcRangeCount >= 3) {
+            qDebug() << "ALC Range saturation reported at gain" << m_currentGain << "; treating as overshoot.";
+            m_alcRangeCount = 0;
+            m_lastAlcExcess = -1.0;
+            m_minSearchActive = true;
+            m_minSearchHigh = m_currentGain;
+            m_delayTimer->singleShot(1000, this, [this]() { transitionToState(AdjustMinDown); });
+            break;
+        }
+
         bool allReady = true;
         double total = 0;
         int count = 0;
         QStringList targets = targetDevices();
         for (const QString &dev : targets) {
-            int numReadings = m_ampReadings[dev].size();
-            if (numReadings < 3) {
-                allReady = false;
+            double avg = 0.0;
+            if (stableAverage(m_ampReadings[dev], tolerance, &avg)) {
+                total += avg;
+                ++count;
             } else {
-                QList<double> lastThree = m_ampReadings[dev].mid(numReadings - 3, 3);
-                if (qAbs(lastThree[0] - lastThree[1]) < tolerance &&
-                    qAbs(lastThree[1] - lastThree[2]) < tolerance) {
-                    double avg = (lastThree[0] + lastThree[1] + lastThree[2]) / 3.0;
-                    total += avg;
-                    ++count;
-                } else {
-                    allReady = false;
-                }
+                allReady = false;
             }
         }
         if (!allReady || count == 0) {
@@ -450,7 +887,24 @@ void WaveformTuner::transitionToState(TuningState newState)
             break;
         }
         double avgALC = total / count;
-        if (m_critical.compare("LOW", Qt::CaseInsensitive) == 0 && ((avgALC - m_minPower) > 0.2)) {
+        if (m_characterizing) {
+            m_sweepPoint.alcPower = avgALC;
+            m_curve.points.append(m_sweepPoint);
+            qDebug() << "Characterization: gain" << m_currentGain << "ALC power" << avgALC << "dBm";
+            m_delayTimer->singleShot(500, this, [this]() { transitionToState(CharacterizeNext); });
+            break;
+        }
+        if (lowCritical && ((avgALC - m_minPower) > tolerance)) {
+            // Overshoot: this gain becomes the upper end of the bracket.
+            m_minSearchActive = true;
+            m_minSearchHigh = m_currentGain;
+            m_lastAlcExcess = avgALC - m_minPower;
+            m_delayTimer->singleShot(1000, this, [this]() { transitionToState(AdjustMinDown); });
+        } else if (m_minSearchActive && (m_minSearchHigh - m_currentGain) > 1) {
+            // Meets the minimum, but a higher gain inside the bracket might as well.
+            m_minSearchLow = m_currentGain;
+            m_minSearchLowVerified = true;
+            m_minSearchLowAlc = avgALC;
             m_delayTimer->singleShot(1000, this, [this]() { transitionToState(AdjustMinDown); });
         } else {
             m_finalStableMin = avgALC;
@@ -458,122 +912,271 @@ void WaveformTuner::transitionToState(TuningState newState)
         }
     }
     break;
-    case AdjustMinDown:
-        qDebug() << "Adjusting minimum: lowering gain. New gain:" << (m_currentGain - 1);
-        if (m_currentGain <= 0) {
-            qDebug() << "Gain is already 0. Cannot lower further.";
+    case AdjustMinDown: {
+        if (m_minSearchHigh <= m_minSearchLow) {
+            qDebug() << "Gain is already at the configured minimum" << m_gainFloor << ". Cannot lower further.";
             if (m_logger)
                 m_logger->debugAndLog("Tuning failed: gain cannot be lowered further for LOW critical tuning.");
-            emit tuningFailed("Gain cannot be lowered further for LOW critical tuning.");
+            fail("Gain cannot be lowered further for LOW critical tuning.");
             return;
         }
-        m_currentGain--;
-        if (!m_pythonEditor->editGainValue(m_waveformFile, m_currentGain, m_channel)) {
-            emit tuningFailed("Failed to lower gain for LOW critical.");
+        int nextGain = nextMinSearchGain();
+        // If the low end is already measured and the bracket is closed, only a restart
+        // at that gain is needed before the final max recheck.
+        m_minSearchResolved = (m_minSearchLowVerified && nextGain == m_minSearchLow &&
+                               m_minSearchHigh - m_minSearchLow <= 1);
+        qDebug() << "Adjusting minimum: bracket [" << m_minSearchLow << "," << m_minSearchHigh
+                 << "], new gain:" << nextGain;
+        m_currentGain = nextGain;
+        if (!applyGain(m_channel, m_currentGain)) {
+            fail("Failed to lower gain for LOW critical.");
             return;
         }
-        {
-            QStringList targets = targetDevices();
-            for (const QString &dev : targets)
-                m_ampReadings[dev].clear();
-        }
+        QStringList targets = targetDevices();
+        for (const QString &dev : targets)
+            m_ampReadings[dev].clear();
+        m_alcRangeCount = 0;
         m_pythonRunner->stopScript();
         m_delayTimer->singleShot(1000, this, [this]() { transitionToState(StartWaveform_ALC); });
-        break;
+    }
+    break;
     case FinalizeTuning: {
-        qDebug() << "Step 11: Finalizing tuning on target amp.";
-        QStringList targets = targetDevices();
-        for (const QString &dev : targets) {
-            m_ampSerial->setMode("VVA", dev);
-            m_delayTimer->singleShot(500, this, [this, dev]() {
-                m_ampSerial->setGainLvl(100, dev);
-                m_ampReadings[dev].clear();
-            });
-        }
-        m_delayTimer->singleShot(2500, this, [this]() { transitionToState(RecheckMax); });
+        qDebug() << "Step 10: Switching target amp back to VVA to recheck maximum power.";
+        // A trimmed result is reported as an equivalent SDR gain, which needs the full-VVA
+        // power at the final gain; the minimum search may have moved it since the trim.
+        m_vvaRefRecheck = m_vvaLevel < 100.0 && m_vvaRefGain != m_currentGain;
+        const double level = m_vvaRefRecheck ? 100.0 : m_vvaLevel;
+        if (m_vvaRefRecheck)
+            qDebug() << "Re-measuring the VVA 100 reference at gain" << m_currentGain;
+        QStringList commands;
+        commands << "MODE VVA" << QString("VVA_LEVEL %1").arg(level, 0, 'f', 1);
+        runAmpBatch(commands, RecheckMax, settleDelay({"ModeVva", "VvaLevel"}, 2500));
     }
     break;
     case RecheckMax: {
+        m_recheckPolls = 0;
         QStringList targets = targetDevices();
-        for (const QString &dev : targets) {
+        for (const QString &dev : targets)
             m_ampReadings[dev].clear();
-            m_ampSerial->getFwdPwr(dev);
-        }
+        queryFwdPwr();
         m_delayTimer->singleShot(1000, this, [this]() { transitionToState(WaitForMaxStable); });
     }
     break;
     case WaitForMaxStable: {
-        const double tolerance = 0.01;
+        const double tolerance = m_tier.recheckToleranceDb;
         bool allReady = true;
         double total = 0;
         int count = 0;
         QStringList targets = targetDevices();
         for (const QString &dev : targets) {
-            int numReadings = m_ampReadings[dev].size();
-            if (numReadings < 3)
+            double avg = 0.0;
+            if (stableAverage(m_ampReadings[dev], tolerance, &avg)) {
+                total += avg;
+                ++count;
+            } else {
                 allReady = false;
-            else {
-                QList<double> lastThree = m_ampReadings[dev].mid(numReadings - 3, 3);
-                if (qAbs(lastThree[0] - lastThree[1]) < tolerance &&
-                    qAbs(lastThree[1] - lastThree[2]) < tolerance) {
-                    double avg = (lastThree[0] + lastThree[1] + lastThree[2]) / 3.0;
-                    total += avg;
-                    ++count;
-                } else {
-                    allReady = false;
-                }
+            }
+        }
+        // Coarse tiers stop chasing a noisy amp and take the mean of what they have.
+        ++m_recheckPolls;
+        if ((!allReady || count == 0) && m_tier.recheckMaxPolls > 0 && m_recheckPolls >= m_tier.recheckMaxPolls) {
+            total = 0;
+            count = 0;
+            for (const QString &dev : targets) {
+                const QList<double> &readings = m_ampReadings[dev];
+                if (readings.isEmpty())
+                    continue;
+                const QList<double> recent = readings.mid(qMax(0, readings.size() - m_tier.samples));
+                double sum = 0;
+                for (double r : recent)
+                    sum += r;
+                total += sum / recent.size();
+                ++count;
+            }
+            if (count > 0) {
+                qDebug() << "Final maximum not stable within" << tolerance << "dB after" << m_recheckPolls
+                         << "polls; accepting the mean for the" << m_tier.name << "tier.";
+                allReady = true;
             }
         }
         if (!allReady || count == 0) {
             qDebug() << "Final maximum readings not yet stable, scheduling another query.";
-            QStringList targets = targetDevices();
-            for (const QString &dev : targets)
-                m_ampSerial->getFwdPwr(dev);
+            queryFwdPwr();
             m_delayTimer->singleShot(1000, this, [this]() { transitionToState(WaitForMaxStable); });
             break;
         }
         double avgMax = total / count;
+        if (m_vvaRefRecheck) {
+            m_vvaRefPower = avgMax;
+            m_vvaRefGain = m_currentGain;
+            m_delayTimer->singleShot(500, this, [this]() { transitionToState(FinalizeTuning); });
+            break;
+        }
         m_finalStableMax = avgMax;
         m_delayTimer->singleShot(1000, this, [this]() { transitionToState(LogResults); });
     }
     break;
+    case CharacterizeNext: {
+        m_pythonRunner->stopScript();
+        m_sweepFaults = 0;
+        int nextGain = m_currentGain + m_sweepStep;
+        if (!m_sweepDone && nextGain <= m_sweepStop) {
+            m_currentGain = nextGain;
+            QStringList targets = targetDevices();
+            for (const QString &dev : targets)
+                m_ampReadings[dev].clear();
+            if (!applyGain(m_channel, m_currentGain)) {
+                fail("Failed to step gain during characterization.");
+                return;
+            }
+            m_delayTimer->singleShot(1000, this, [this](){ transitionToState(StartWaveform); });
+            break;
+        }
+
+        QString channelString = (m_channel == 0 ? "L1" : "L2");
+        // Simulated sweeps measure the simulator, not the amp; they are not stored.
+        bool saved = SimulatedRig::isEnabled() || GainCurveStore::save(m_curve);
+        QString logMsg = QString("%1 ch %2 characterized: %3 points from gain %4 to %5%6")
+                             .arg(m_curve.waveform, channelString)
+                             .arg(m_curve.points.size())
+                             .arg(m_initialGain)
+                             .arg(m_currentGain)
+                             .arg(saved ? "" : " (failed to save curve)");
+        if (m_logger)
+            m_logger->debugAndLog(logMsg);
+        if (!restoreSweptGains()) {
+            fail("Failed to restore the original gain after characterization.");
+            return;
+        }
+        if (m_isL1L2 && m_channel == 0) {
+            m_channel = 1;
+            m_currentGain = m_initialGain;
+            m_sweepDone = false;
+            m_curve.points.clear();
+            m_curve.channel = 1;
+            resetRollingAverages();
+            QTimer::singleShot(1000, this, [this]() { transitionToState(SetInitialGain); });
+        } else {
+            finish();
+        }
+    }
+    break;
     case LogResults: {
+        // A coarse pass that misses the finer tier's windows carries on at the finer tier
+        // from the gain it reached.
+        if (m_promoteTo && !m_promoteTier.accepts(m_maxPower, m_finalStableMax, m_minPower, m_finalStableMin,
+                                                   m_critical.compare("LOW", Qt::CaseInsensitive) == 0)) {
+            if (m_logger)
+                m_logger->debugAndLog(QString("%1 ch %2: %3 pass gave max %4 / min %5 dBm at gain %6; promoting to %7")
+                                          .arg(QFileInfo(m_waveformFile).fileName(), m_channel == 0 ? "L1" : "L2",
+                                               m_tier.name)
+                                          .arg(m_finalStableMax, 0, 'f', 2).arg(m_finalStableMin, 0, 'f', 2)
+                                          .arg(m_currentGain).arg(m_promoteTier.name));
+            m_tier = m_promoteTier;
+            m_promoteTo = false;
+            m_adjustDownCount = 0;
+            m_vvaTrimRestarts = 0;
+            resetRollingAverages();
+            resetMinSearch();
+            m_vvaLevel = 100.0;
+            m_pythonRunner->stopScript();
+            QTimer::singleShot(1000, this, [this]() { transitionToState(SetInitialGain); });
+            break;
+        }
         QFileInfo fileInfo(m_waveformFile);
         QString fileName = fileInfo.fileName();
         QString channelString = (m_channel == 0 ? "L1" : "L2");
         qDebug() << "Waveform" << fileName << "for channel" << channelString
                  << "is tuned to a min power of" << m_finalStableMin
                  << "dBm and a max power of" << m_finalStableMax << "dBm";
-        QString logMsg = QString("%1 ch %2 is tuned to min power %3 dBm, max power %4 dBm, with SDR gain %5 dBm")
+        QString logMsg = QString("%1 ch %2 is tuned to min power %3 dBm, max power %4 dBm, with SDR gain %5 dBm (%6 tier)")
                              .arg(fileName)
                              .arg(channelString)
                              .arg(m_finalStableMin, 0, 'f', 1)
                              .arg(m_finalStableMax, 0, 'f', 1)
-                             .arg(m_currentGain);
+                             .arg(m_currentGain)
+                             .arg(m_tier.name);
+        if (m_vvaLevel < 100.0) {
+            // Record the VVA trim as a second tuned parameter plus its SDR gain equivalent (~1 dB per step).
+            double trimDb = m_vvaRefPower - m_finalStableMax;
+            logMsg += QString(", VVA level %1 (equivalent SDR gain %2 dBm)")
+                          .arg(m_vvaLevel, 0, 'f', 1)
+                          .arg(m_currentGain - trimDb, 0, 'f', 1);
+        }
         if (m_logger)
             m_logger->debugAndLog(logMsg);
+        emit channelTuned(m_channel, m_currentGain, m_finalStableMin, m_finalStableMax);
+        // Teach the predictor the gain this file needed (with any VVA trim folded in).
+        // A simulated tune would teach it the simulator's gains.
+        if (!SimulatedRig::isEnabled())
+            GainPredictor::record(m_waveformFile, m_ampModel, m_channel, m_maxPower,
+                                  m_vvaLevel < 100.0 ? m_currentGain - (m_vvaRefPower - m_finalStableMax) : m_currentGain,
+                                  m_iteration - m_channelStartIteration);
+        if (m_injectGains) {
+            // The search ran on launch overrides; write the tuned value to the file once.
+            m_gainOverrides.remove(m_channel);
+            if (!m_pythonEditor->editGainValue(m_waveformFile, m_currentGain, m_channel)) {
+                fail("Failed to write the tuned gain.");
+                return;
+            }
+        }
         if (m_isL1L2 && m_channel == 0) {
             // Finished tuning channel 0 for an L1_L2 file. Now switch to channel 1.
             m_channel = 1;
-            m_currentGain = m_initialGain; // Reset channel 1's gain to the initial value.
+            m_currentGain = initialGain(1); // Reset channel 1's gain to its starting value.
+            m_channelStartIteration = m_iteration;
+            // Channel 1 starts over at the requested tier.
+            m_tier = m_baseTier;
+            m_promoteTo = !m_promoteTier.name.isEmpty() && m_promoteTier.name != m_baseTier.name;
+            m_adjustDownCount = 0;
+            m_vvaTrimRestarts = 0;
             resetRollingAverages();
+            resetMinSearch();
+            m_vvaLevel = 100.0;
             m_pythonRunner->stopScript();
             QTimer::singleShot(1000, this, [this]() { transitionToState(SetInitialGain); });
         } else {
             m_pythonRunner->stopScript();
-            emit tuningFinished();
+            finish();
         }
     }
     break;
     case RetryAfterFault:
         qDebug() << "Fault encountered. Retrying after fault...";
         m_pythonRunner->stopScript();
+        if (m_characterizing) {
+            // A fault that keeps recurring at this drive level ends the sweep at the last
+            // good point rather than hitting the amp again and again.
+            if (++m_sweepFaults > m_config->sweepMaxFaultRetries) {
+                if (m_curve.points.isEmpty()) {
+                    fail(QString("Characterization faulted %1 times at gain %2 before any point was measured.")
+                             .arg(m_sweepFaults).arg(m_currentGain));
+                    return;
+                }
+                if (m_logger)
+                    m_logger->debugAndLog(QString("%1 ch %2: faulted %3 times at gain %4; ending the sweep at gain %5")
+                                              .arg(m_curve.waveform, m_channel == 0 ? "L1" : "L2")
+                                              .arg(m_sweepFaults).arg(m_currentGain)
+                                              .arg(m_curve.points.last().gain));
+                m_currentGain = m_curve.points.last().gain;
+                m_sweepDone = true;
+                m_delayTimer->singleShot(500, this, [this](){ transitionToState(CharacterizeNext); });
+                break;
+            }
+            // The sweep needs every point; measure this gain again instead of backing off.
+            QStringList targets = targetDevices();
+            for (const QString &dev : targets)
+                m_ampReadings[dev].clear();
+            m_alcRangeCount = 0;
+            m_delayTimer->singleShot(1000, this, [this](){ transitionToState(StartWaveform); });
+            break;
+        }
         m_currentGain--;
-        if (!m_pythonEditor->editGainValue(m_waveformFile, m_currentGain, m_channel)) {
-            emit tuningFailed("Failed to adjust gain after fault.");
+        if (!applyGain(m_channel, m_currentGain)) {
+            fail("Failed to adjust gain after fault.");
             return;
         }
-        m_pythonRunner->startScript();
+        // PreSetAlc restarts the waveform since it is no longer running.
         m_delayTimer->singleShot(1000, this, [this](){ transitionToState(SetModeALC); });
         break;
     default:
@@ -584,10 +1187,27 @@ void WaveformTuner::transitionToState(TuningState newState)
 
 void WaveformTuner::onAmpOutput(const QString &device, const QString &output)
 {
+    if (m_ended || !ownsDevice(device))
+        return;
     if (m_state == CheckAmpMode) {
         if (output.contains("STANDBY, VVA")) {
             qDebug() << "Amp" << device << "is ready.";
-            transitionToState(InitialModeVVA);
+            // Run the full sequence from standby on every target.
+            for (const QString &dev : qAsConst(m_setupReady))
+                m_ampSerial->setStandby(dev);
+            m_setupReady.clear();
+            transitionToState(InitialSetup);
+            return;
+        }
+        if (output.contains("ONLINE") && setupMatches(device)) {
+            m_setupReady.insert(device);
+            const QStringList targets = targetDevices();
+            for (const QString &dev : targets) {
+                if (!m_setupReady.contains(dev))
+                    return;
+            }
+            qDebug() << "Amp setup already in place on" << targets << "- skipping to the initial gain.";
+            transitionToState(SetInitialGain);
             return;
         }
         if (output.contains("STANDBY, ALC")) {
@@ -608,6 +1228,41 @@ void WaveformTuner::onAmpOutput(const QString &device, const QString &output)
             return;
         }
     }
+}
+
+int WaveformTuner::measurementPhase(TuningState state)
+{
+    switch (state) {
+    case QueryFwdPwr:
+    case WaitForStable:
+        return 1;
+    case VvaTrimQuery:
+    case VvaTrimWait:
+        return 2;
+    case QueryFwdPwrALC:
+    case WaitForAlcStable:
+        return 3;
+    case RecheckMax:
+    case WaitForMaxStable:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+void WaveformTuner::queryFwdPwr()
+{
+    const QStringList targets = targetDevices();
+    for (const QString &dev : targets)
+        m_ampSerial->getFwdPwr(dev, m_fwdTag);
+}
+
+void WaveformTuner::onAmpReply(const QString &device, const QString &command, const QString &output, int tag)
+{
+    // Only this measurement's forward power replies are readings; the watchdog's own
+    // FWD_PWR? and REV_PWR? polls and identity queries share the same port.
+    if (m_ended || command != "FWD_PWR?" || tag != m_fwdTag || m_fwdTag == 0 || !ownsDevice(device))
+        return;
     if (m_state == QueryFwdPwrALC || m_state == WaitForAlcStable) {
         if (output.contains("ALC Range")) {
             m_alcRangeCount++;
@@ -632,21 +1287,85 @@ void WaveformTuner::onAmpOutput(const QString &device, const QString &output)
     }
 }
 
-void WaveformTuner::onAmpFault(const QString &device, const QString &error)
+int WaveformTuner::settleDelay(const QStringList &events, int fallbackMs) const
+{
+    QStringList serials;
+    const QStringList targets = targetDevices();
+    for (const QString &dev : targets)
+        serials << m_ampSerial->identity(dev);
+    return SettleProfileStore::delayMs(*m_config, m_ampModel, serials, events, fallbackMs);
+}
+
+void WaveformTuner::runAmpBatch(const QStringList &commands, TuningState next, int settleMs)
+{
+    m_ampBatchId = m_ampSerial->sendBatch(commands, targetDevices());
+    m_ampBatchNext = next;
+    m_ampBatchSettleMs = settleMs;
+}
+
+void WaveformTuner::onAmpBatchFinished(int batchId, bool ok, const QStringList &errors)
+{
+    if (m_ended || batchId != m_ampBatchId)
+        return;
+    m_ampBatchId = 0;
+    if (!ok) {
+        qWarning() << "Amp command batch failed:" << errors;
+        fail("Amp rejected setup: " + errors.join("; "));
+        return;
+    }
+    // Settle time is counted from the amp's acknowledgement, not from the write.
+    const TuningState next = m_ampBatchNext;
+    m_delayTimer->singleShot(m_ampBatchSettleMs, this, [this, next]() { transitionToState(next); });
+}
+
+bool WaveformTuner::setupMatches(const QString &device) const
+{
+    if (!m_reuseAmpSetup)
+        return false;
+    // Only settings this process commanded are trusted; the amp itself confirmed ONLINE.
+    const AmpSettings settings = m_ampSerial->settings(device);
+    return settings.known && settings.online && settings.alcLevel >= 0 &&
+           qAbs(settings.alcLevel - m_minPower) < 0.05;
+}
+
+void WaveformTuner::onLoadFault(const QString &device, const QString &reason)
 {
     Q_UNUSED(device);
+    if (m_ended)
+        return;
+    qWarning() << reason;
+    m_logger->debugAndLog(QString("Waveform %1: %2").arg(QFileInfo(m_waveformFile).fileName(), reason));
+    // Take the amps off the bad load before anything else.
+    const QStringList targets = targetDevices();
+    for (const QString &dev : targets)
+        m_ampSerial->setStandby(dev);
+    abort(reason);
+}
+
+void WaveformTuner::onAmpFault(const QString &device, const QString &error)
+{
+    // A failed or finished run is not retried.
+    if (m_ended || !ownsDevice(device))
+        return;
     qWarning() << "Fault detected:" << error;
     m_delayTimer->singleShot(1000, this, [this](){ transitionToState(RetryAfterFault); });
 }
 
 void WaveformTuner::onPythonOutput(const QString &output)
 {
+    if (m_ended)
+        return;
     if ((m_state == WaitForPythonPrompt || m_state == WaitForPythonPrompt_ALC) &&
         output.contains("Press Enter to quit"))
     {
-        if (m_state == WaitForPythonPrompt_ALC)
-            m_delayTimer->singleShot(1000, this, [this]() { transitionToState(QueryFwdPwrALC); });
+        const int startDelay = settleDelay({"WaveformStart"}, 1000);
+        if (m_state == WaitForPythonPrompt_ALC && m_minSearchResolved) {
+            m_finalStableMin = m_minSearchLowAlc;
+            m_delayTimer->singleShot(startDelay, this, [this]() { transitionToState(FinalizeTuning); });
+        }
+        else if (m_state == WaitForPythonPrompt_ALC)
+            m_delayTimer->singleShot(startDelay, this, [this]() { transitionToState(QueryFwdPwrALC); });
         else
-            m_delayTimer->singleShot(1000, this, [this]() { transitionToState(SetModeVVA_All); });
+            m_delayTimer->singleShot(startDelay, this, [this]() { transitionToState(SetModeVVA_All); });
     }
 }
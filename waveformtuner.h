@@ -3,20 +3,29 @@
 
 #include <QObject>
 #include <QMap>
+#include <QSet>
 #include <QString>
 #include <QStringList>
+#include <memory>
 #include "wavelogger.h"
+#include "gaincurve.h"
+#include "waveformpreparer.h"
+#include "tuningtier.h"
 
 class AmplifierSerial;
 class PythonEditor;
 class PythonRunner;
 class QTimer;
+class LoadWatchdog;
+struct TuneConfig;
 
 class WaveformTuner : public QObject
 {
     Q_OBJECT
 public:
-    explicit WaveformTuner(QObject *parent = nullptr, WaveLogger *logger = nullptr);
+    // With sharedAmps the tuner uses already-open amp ports and leaves them open afterwards.
+    explicit WaveformTuner(QObject *parent = nullptr, WaveLogger *logger = nullptr,
+                           AmplifierSerial *sharedAmps = nullptr);
     ~WaveformTuner();
 
     void startTuning(const QString &waveformFile,
@@ -24,16 +33,59 @@ public:
                      double minPower,
                      double maxPower,
                      const QString &critical);
+    // Starts from a waveform the batch loop already validated (and possibly pre-edited).
+    void startTuning(const PreparedWaveform &prepared,
+                     const QString &ampModel,
+                     double minPower,
+                     double maxPower,
+                     const QString &critical);
+
+    // Sweeps the SDR gain over [Characterize] GainStart..GainStop, records VVA and ALC
+    // forward power at each step into the GainCurveStore, then restores the file's gain.
+    void startCharacterization(const QString &waveformFile, const QString &ampModel);
+
+    // Returns the channel argument of the first set_gain(<gain>, <channel>) call, 0 if none.
+    static int extractChannelFromFile(const QString &filePath);
+    // The amp that carries channel (0 = L1, 1 = L2) among devices.
+    static QString deviceForChannel(const QStringList &devices, int channel);
+
+    // Restricts this tuner to devices so a second tuner can use the rig's other amp.
+    // Call before startTuning(); by default every connected amp is used.
+    void setDevices(const QStringList &devices);
+
+    // Resume an interrupted tune of channel from gain instead of the model's initial gain.
+    // Call before startTuning().
+    void setResumePoint(int channel, int gain);
+
+    // Tunes at tier (empty for the configured default). With promoteTo, a channel whose
+    // result misses that tier's windows carries on at promoteTo from the gain it reached.
+    // Call before startTuning().
+    void setTier(const QString &tier, const QString &promoteTo = QString());
+
+    // Gain channel starts from in this tune: the GainPredictor's when it is confident,
+    // otherwise the amp model's default. Valid once tuning has started.
+    int initialGain(int channel) const;
+
+    // VVA level of the channel channelTuned just reported; 100 when no fine trim was needed.
+    double trimLevel() const { return m_vvaLevel; }
+
+    // Stops the waveform and emits tuningFailed(reason); no further states run.
+    void abort(const QString &reason);
 
 signals:
     void tuningFinished();
     void tuningFailed(const QString &reason);
+    void channelTuned(int channel, int gain, double minPower, double maxPower);
+    // Emitted each time the waveform is (re)started with a new gain.
+    void progress(int channel, int gain, int iteration);
 
 private slots:
     void onAmpOutput(const QString &device, const QString &output);
     void onAmpFault(const QString &device, const QString &error);
     void onPythonOutput(const QString &output);
-    int extractChannelFromFile(const QString &filePath);
+    void onAmpBatchFinished(int batchId, bool ok, const QStringList &errors);
+    void onAmpReply(const QString &device, const QString &command, const QString &output, int tag);
+    void onLoadFault(const QString &device, const QString &reason);
 
 private:
     // Final measured values for logging.
@@ -44,32 +96,93 @@ private:
     double m_lastAvg = 0.0;
 
     int m_alcRangeCount = 0;
+
+    // Tolerances, sample counts and limits for this tune.
+    TuningTier m_tier = TuningTier::named(QString());
+    TuningTier m_baseTier = m_tier;
+    TuningTier m_promoteTier;
+    bool m_promoteTo = false;
+    int m_recheckPolls = 0;
+
+    // Bracketed search for the LOW-critical ALC minimum.
+    // m_minSearchLow is the highest gain known (or assumed, at the floor) to meet the
+    // minimum; m_minSearchHigh is the lowest gain known to overshoot it.
+    int m_gainFloor = 0;
+    int m_gainCeiling = 60;
+    bool m_minSearchActive = false;
+    bool m_minSearchLowVerified = false;
+    bool m_minSearchResolved = false;
+    int m_minSearchLow = 0;
+    int m_minSearchHigh = 0;
+    double m_minSearchLowAlc = 0.0;
+    double m_lastAlcExcess = -1.0; // Excess over m_minPower at the last overshoot, -1 if unknown
+
+    // Launch-time gain injection (see [Injection] in waveTuneConfig.ini).
+    bool m_injectGains = false;
+    QMap<int, int> m_gainOverrides; // Channel -> gain passed to the flowgraph at launch
+
+    // Live fine trim of the max through the amp's VVA level (see [FineTrim] in waveTuneConfig.ini).
+    bool m_fineTrimEnabled = false;
+    double m_vvaDbPerLevel = 0.1;   // Current dB-per-VVA-level estimate, refined by secant
+    double m_vvaMinLevel = 50.0;
+    int m_vvaTrimMaxIterations = 6;
+    int m_vvaTrimIterations = 0;
+    double m_vvaLevel = 100.0;      // VVA level currently applied to the target amp
+    double m_vvaPrevLevel = 100.0;
+    double m_vvaPrevPower = 0.0;
+    double m_vvaRefPower = 0.0;     // Max power measured at VVA level 100...
+    int m_vvaRefGain = 0;           // ...at this SDR gain
+    bool m_vvaRefRecheck = false;   // The final recheck is re-measuring the VVA 100 reference
+    double m_vvaBestLevel = 100.0;  // Trim level whose power came closest to the target
+    double m_vvaBestPower = 0.0;
+    int m_vvaTrimRestarts = 0;      // Gain steps down after a trim that could not get low enough
+    int m_vvaTrimMaxRestarts = 2;
+
+    // Characterization sweep.
+    bool m_characterizing = false;
+    bool m_sweepDone = false;
+    int m_sweepStop = 0;
+    int m_sweepStep = 1;
+    double m_sweepCeiling = 0.0;    // Stop sweeping once the VVA power reaches this
+    int m_sweepFaults = 0;          // Faults at the current point
+    GainPoint m_sweepPoint;
+    GainCurve m_curve;
+    QMap<int, int> m_originalGains; // Channel -> gain in the file before the sweep
     double m_measuredMin;
     int m_gainStep;
     WaveLogger *m_logger = nullptr;
     int m_gainSwapCount = 0;
     int m_lastGainAdjustment = 0;
     int m_initialGain;
+    bool m_gainPreset = false; // Initial gain already written by WaveformPreparer
+    int m_presetGain = 0;      // The gain WaveformPreparer wrote
+    QMap<int, int> m_startGains; // Channel -> predicted starting gain, where confident
+    int m_channelStartIteration = 0; // m_iteration when the current channel started
+    int m_resumeChannel = -1;
+    int m_resumeGain = 0;
+    int m_iteration = 0;       // Waveform runs so far
+    bool m_reuseAmpSetup = true;
+    QSet<QString> m_setupReady; // Targets already online at this session's ALC level
+    int m_ampBatchId = 0;       // Outstanding amp command batch, 0 if none
+    int m_fwdTag = 0;           // Tag of this measurement's FWD_PWR? queries; others are ignored
+    int m_ampBatchSettleMs = 0;
 
     enum TuningState {
         Idle,
         CheckAmpMode,
-        InitialModeVVA,
-        InitialVvaLevel,
-        InitialModeALC,
-        InitialAlcLevel,
-        SetOnline,
+        InitialSetup,
         SetInitialGain,
         StartWaveform,
         WaitForPythonPrompt,
         SetModeVVA_All,
-        SetGain100_All,
         QueryFwdPwr,
         WaitForStable,
-        StopWaveform,
         ComparePower,
         AdjustGainUp,
         AdjustGainDown,
+        VvaTrimSet,
+        VvaTrimQuery,
+        VvaTrimWait,
         SetModeALC,
         PreSetAlc,
         AdjustMinDown,
@@ -80,13 +193,38 @@ private:
         FinalizeTuning,
         RecheckMax,
         WaitForMaxStable,
+        CharacterizeNext,
         LogResults,
         RetryAfterFault
     };
 
     void transitionToState(TuningState newState);
+    // States that poll forward power for one measurement share a phase.
+    static int measurementPhase(TuningState state);
+    void queryFwdPwr();
+    void beginSession();
     void resetRollingAverages();
+    void resetMinSearch();
+    int nextMinSearchGain() const;
+    int coarseGainStep(double diff) const;
+    // True if the last m_tier.samples readings step by less than tolerance; avg gets their mean.
+    bool stableAverage(const QList<double> &readings, double tolerance, double *avg) const;
+    bool applyGain(int channel, int gain);
+    void syncGainOverrides();
+    // Writes back the file's gains on the lines the current channel's sweep has set.
+    bool restoreSweptGains();
+    void startVvaTrim(double avg);
     QStringList targetDevices() const; // Returns the amp devices for the current channel
+    bool setupMatches(const QString &device) const;
+    bool ownsDevice(const QString &device) const;
+    // Sends commands to the target amps as one batch and enters next settleMs after
+    // the last one is acknowledged.
+    void runAmpBatch(const QStringList &commands, TuningState next, int settleMs);
+    // End the run: the state goes to Idle and pending timers and late amp replies are ignored.
+    void fail(const QString &reason);
+    void finish();
+    // Calibrated settle time for events on the target amps, or fallbackMs.
+    int settleDelay(const QStringList &events, int fallbackMs) const;
 
     // User parameters.
     QString m_waveformFile;
@@ -100,14 +238,20 @@ private:
     bool m_isL1L2;         // True if tuning an L1_L2 file
 
     AmplifierSerial *m_ampSerial;
+    bool m_ownsAmpSerial;
+    bool m_ended = false;           // Failed, aborted or finished; nothing more may run
+    std::shared_ptr<const TuneConfig> m_config;  // Taken when the session begins
     PythonEditor   *m_pythonEditor;
     PythonRunner   *m_pythonRunner;
     QStringList m_allAmpDevices;    // All discovered amplifier devices
+    QStringList m_deviceFilter;     // Devices this tuner may use, empty for all
     QStringList m_testingAmpDevices; // Devices that responded stably
 
     QTimer *m_delayTimer;
+    LoadWatchdog *m_watchdog;     // Reverse power / VSWR while transmitting
     QMap<QString, QList<double>> m_ampReadings;
     TuningState m_state;
+    TuningState m_ampBatchNext = Idle; // Entered once the outstanding batch completes
 };
 
 #endif // WAVEFORMTUNER_H